@@ -597,6 +597,21 @@ double effective_range(const T& v, double percentil_out = 0.25)
     return max_val - min_val;
 }
 
+/** Effective range of a MultidimArray
+ *
+ * As the generic effective_range, but the two percentiles are the exact
+ * ones, found by selection instead of through a histogram.
+ */
+template<typename T>
+double effective_range(const MultidimArray<T>& v, double percentil_out = 0.25)
+{
+    std::vector<double> p(2), range;
+    p[0] = percentil_out / 2;
+    p[1] = 100 - percentil_out / 2;
+    v.computePercentiles(p, range);
+    return range[1] - range[0];
+}
+
 /** Clips the array values within the effective range
  *
  * Look at the documentation of effective_rage
@@ -30,6 +30,14 @@
 #include "metadata.h"
 #include "xmipp_image.h"
 #include "xmipp_program_sql.h"
+#include "xmipp_threads.h"
+
+//Bytes of a STAR loop block parsed by each thread at once
+#define STAR_CHUNK_SIZE 4194304
+//Bytes of formatted rows kept before writing them to the stream
+#define STAR_WRITE_BUFFER_SIZE 1048576
+
+int MetaData::readThreads = 1;
 
 // Get the blocks available
 void getBlocksInMetaDataFile(const FileName &inFile, StringVector& blockList)
@@ -1042,37 +1050,47 @@ void MetaData::append(const FileName &outFile) const
 
 void MetaData::_writeRows(std::ostream &os) const
 {
-	size_t i=0;				// Loop counter.
-	size_t length=0;		// Loop upper bound.
-
-	// Prepare statement.
-	this->initGetRow( true);
+    // Comments are not written in the rows
+    std::vector<MDLabel> labels;
+    std::vector<MDObject> values;
+    for (size_t i = 0; i < activeLabels.size(); i++)
+        if (activeLabels[i] != MDL_STAR_COMMENT)
+        {
+            labels.push_back(activeLabels[i]);
+            values.push_back(MDObject(activeLabels[i]));
+        }
 
-	// Metadata objects loop.
-    FOR_ALL_OBJECTS_IN_METADATA(*this)
+    if (labels.empty())
     {
-        std::vector<MDObject> mdValues;
+        os << String(size(), '\n');
+        return;
+    }
 
-        // Get metadata values.
-        this->bindValue( __iter.objId);
-    	myMDSql->getObjectsValues( activeLabels, &mdValues);
+    // Rows are formatted into a buffer that is written in large blocks
+    String buffer;
+    buffer.reserve(STAR_WRITE_BUFFER_SIZE + 4096);
+    int precision = os.precision();
 
-    	// Build metadata line.
-    	length = activeLabels.size();
-    	for (i=0; i<length ;i++)
+    if (myMDSql->initializeSelectRows(labels))
+    {
+        while (myMDSql->getRowValues(values))
         {
-            if (activeLabels[i] != MDL_STAR_COMMENT)
+            for (size_t i = 0; i < values.size(); i++)
+            {
+                values[i].toBuffer(buffer, precision);
+                buffer += ' ';
+            }
+            buffer += '\n';
+            if (buffer.size() >= STAR_WRITE_BUFFER_SIZE)
             {
-                os.width(1);
-                mdValues[i].toStream(os, true);
-                os << " ";
+                os.write(buffer.data(), buffer.size());
+                buffer.clear();
             }
         }
-
-        os << std::endl;
+        myMDSql->finalizePreparedStmt();
     }
-    // Finalize statement.
-    myMDSql->finalizePreparedStmt();
+    os.write(buffer.data(), buffer.size());
+    os.flush();
 }
 
 void MetaData::print() const
@@ -1175,7 +1193,24 @@ void MetaData::_readColumns(std::istream& is, std::vector<MDObject*> & columnVal
 }
 
 
-void MetaData::_parseObjects(std::istream &is, std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels, bool firstTime)
+void MetaData::_parseObjects(const char * iter, const char * end, std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels, bool firstTime)
+{
+	size_t i=0;				// Loop counter.
+	size_t size=0;			// Column values vector size.
+	bool parsed=true;		// Once a value fails, the rest of the row is not parsed.
+
+	// Columns loop.
+	size = columnValues.size();
+	for (i=0; i<size ;i++)
+	{
+		parsed = parsed && columnValues[i]->fromBuffer(iter, end);
+		columnValues[i]->failed = !parsed;
+	}
+
+	_insertObjects(columnValues, desiredLabels, firstTime);
+}
+
+void MetaData::_insertObjects(const std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels, bool firstTime)
 {
 	size_t i=0;				// Loop counter.
 	size_t size=0;			// Column values vector size.
@@ -1184,11 +1219,9 @@ void MetaData::_parseObjects(std::istream &is, std::vector<MDObject*> & columnVa
 	size = columnValues.size();
 	for (i=0; i<size ;i++)
 	{
-		columnValues[i]->fromStream(is);
-		if (is.fail())
+		if (columnValues[i]->failed)
 		{
 		   String errorMsg = formatString("MetaData: Error parsing column '%s' value.", MDL::label2Str(columnValues[i]->label).c_str());
-		   columnValues[i]->failed = true;
 		   std::cerr << "WARNING: " << errorMsg << std::endl;
 		   //REPORT_ERROR(ERR_MD_BADLABEL, (String)"read: Error parsing data column, expecting " + MDL::label2Str(object.label));
 		}
@@ -1369,54 +1402,178 @@ void MetaData::_readRows(std::istream& is, std::vector<MDObject*> & columnValues
     }
 }
 
+/* Locate the next data line in [iter, end), skipping empty lines and
+ * comments. The values of the line are in [lineBegin, lineEnd). The last
+ * line without newline is copied in lastLine, so there is always a
+ * delimiter after the values.
+ */
+static bool nextStarLine(const char * &iter, const char * end, String &lastLine,
+                         const char * &lineBegin, const char * &lineEnd)
+{
+    while (iter < end)
+    {
+        const char * newline = (const char *) memchr(iter, '\n', end - iter);
+        if (newline != NULL)
+        {
+            lineBegin = iter;
+            lineEnd = newline;
+            iter = newline + 1;
+        }
+        else
+        {
+            lastLine.assign(iter, end - iter);
+            lineBegin = lastLine.c_str();
+            lineEnd = lineBegin + lastLine.size();
+            iter = end;
+        }
+        //trim spaces at the beginning
+        while (lineBegin < lineEnd && isspace(*lineBegin))
+            ++lineBegin;
+        if (lineBegin < lineEnd && lineBegin[0] != '#')
+            return true;
+    }
+    return false;
+}
+
 /* This function will be used to parse the rows data in START format
  */
 void MetaData::_readRowsStar(mdBlock &block, std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels)
 {
-    String line;
-    std::stringstream ss;
+    String lastLine;
     size_t n = block.end - block.loop;
     bool firstTime=true;
 
     if (n==0)
         return;
 
-    char * buffer = new char[n];
-    memcpy(buffer, block.loop, n);
-    char *iter = buffer, *end = iter + n, * newline = NULL;
+    //Only parse in parallel big blocks when all rows are needed
+    if (readThreads > 1 && _maxRows == 0 && n > STAR_CHUNK_SIZE)
+    {
+        _readRowsStarParallel(block, columnValues, desiredLabels);
+        return;
+    }
+
+    //Values are parsed directly from the mapped file, line by line
+    const char *iter = block.loop, *end = block.end;
+    const char *lineBegin, *lineEnd;
     _parsedLines = 0; //Check how many lines the md have
 
     if (myMDSql->initializeInsert( desiredLabels, columnValues))
     {
-		while (iter < end) //while there are data lines
+		while (nextStarLine(iter, end, lastLine, lineBegin, lineEnd))
 		{
-			//Assing \n position and check if NULL at the same time
-			if (!(newline = END_OF_LINE()))
-				newline = end;
-			line.assign(iter, newline - iter);
-			trim(line);
-
-			if (!line.empty() && line[0] != '#')
+			//_maxRows would be > 0 if we only want to read some
+			// rows from the md for performance reasons...
+			// anyway the number of lines will be counted in _parsedLines
+			if (_maxRows == 0 || _parsedLines < _maxRows)
 			{
-				//_maxRows would be > 0 if we only want to read some
-				// rows from the md for performance reasons...
-				// anyway the number of lines will be counted in _parsedLines
-				if (_maxRows == 0 || _parsedLines < _maxRows)
-				{
-					std::stringstream ss(line);
-					_parseObjects( ss, columnValues, desiredLabels, firstTime);
-					firstTime=false;
-				}
-				_parsedLines++;
+				_parseObjects( lineBegin, lineEnd, columnValues, desiredLabels, firstTime);
+				firstTime=false;
 			}
-			iter = newline + 1; //go to next line
+			_parsedLines++;
 		}
 
 		// Finalize statement.
 		myMDSql->finalizePreparedStmt();
     }
+}
 
-    delete[] buffer;
+/* Rows of a chunk of a STAR loop block, parsed by one thread */
+struct StarChunk
+{
+    const char * begin;
+    const char * end;
+    size_t rows;
+    std::vector<MDObject> values; // Values of all rows, one row after the other
+};
+
+struct StarChunkData
+{
+    const std::vector<MDObject*> * columnValues;
+    std::vector<StarChunk> chunks;
+};
+
+/* Thread function parsing the chunk of its thread_id */
+static void parseStarChunk(ThreadArgument &arg)
+{
+    StarChunkData * data = (StarChunkData *) arg.data;
+    StarChunk &chunk = data->chunks[arg.thread_id];
+    const std::vector<MDObject*> &columnValues = *(data->columnValues);
+    size_t nCols = columnValues.size();
+    const char *iter = chunk.begin, *lineBegin, *lineEnd;
+    String lastLine;
+
+    chunk.rows = 0;
+    chunk.values.clear();
+    while (nextStarLine(iter, chunk.end, lastLine, lineBegin, lineEnd))
+    {
+        bool parsed = true;
+        for (size_t i = 0; i < nCols; ++i)
+        {
+            chunk.values.push_back(MDObject(columnValues[i]->label));
+            MDObject &value = chunk.values.back();
+            parsed = parsed && value.fromBuffer(lineBegin, lineEnd);
+            value.failed = !parsed;
+        }
+        chunk.rows++;
+    }
+}
+
+void MetaData::_readRowsStarParallel(mdBlock &block, std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels)
+{
+    const char *iter = block.loop, *end = block.end;
+    size_t nCols = columnValues.size();
+    bool firstTime = true;
+    _parsedLines = 0;
+
+    if (!myMDSql->initializeInsert( desiredLabels, columnValues))
+        return;
+
+    StarChunkData data;
+    data.columnValues = &columnValues;
+    data.chunks.resize(readThreads);
+    ThreadManager threadManager(readThreads);
+    std::vector<MDObject*> rowValues(nCols);
+
+    //Each round parses up to STAR_CHUNK_SIZE bytes per thread,
+    //so memory used by parsed values is bounded
+    while (iter < end)
+    {
+        for (int t = 0; t < readThreads; ++t)
+        {
+            StarChunk &chunk = data.chunks[t];
+            chunk.begin = iter;
+            if ((size_t)(end - iter) > STAR_CHUNK_SIZE)
+            {
+                //Chunks always end after a newline
+                const char * newline = (const char *) memchr(iter + STAR_CHUNK_SIZE, '\n',
+                                       end - iter - STAR_CHUNK_SIZE);
+                iter = (newline == NULL) ? end : newline + 1;
+            }
+            else
+                iter = end;
+            chunk.end = iter;
+        }
+        threadManager.run(parseStarChunk, &data);
+
+        //Insert rows in the same order than in the file
+        for (int t = 0; t < readThreads; ++t)
+        {
+            StarChunk &chunk = data.chunks[t];
+            for (size_t r = 0; r < chunk.rows; ++r)
+            {
+                for (size_t i = 0; i < nCols; ++i)
+                    rowValues[i] = &(chunk.values[r * nCols + i]);
+                _insertObjects(rowValues, desiredLabels, firstTime);
+                firstTime = false;
+            }
+            _parsedLines += chunk.rows;
+            chunk.values.clear();
+        }
+    }
+
+    // Finalize statement.
+    myMDSql->finalizePreparedStmt();
 }
 
 /*This function will read the md data if is in row format */
@@ -2543,6 +2700,39 @@ bool MDRowIterator::hasNext()
 	return this->rowReturned;
 }
 
+MDRowCursor::MDRowCursor(const MetaData &md, const std::vector<MDLabel> &labels)
+{
+    this->md = &md;
+    allLabels = labels.empty();
+    setLabels(allLabels ? *md.getActiveLabelsAddress() : labels);
+}
+
+void MDRowCursor::setLabels(const std::vector<MDLabel> &labels)
+{
+    currentRow.clear();
+    values.clear();
+    mdLabels = md->getActiveLabelsAddress()->size();
+    for (size_t i = 0; i < labels.size(); ++i)
+        if (labels[i] != MDL_STAR_COMMENT && md->containsLabel(labels[i]) &&
+            !currentRow.containsLabel(labels[i]))
+        {
+            currentRow.addLabel(labels[i]);
+            values.push_back(currentRow.getObject(labels[i]));
+        }
+}
+
+bool MDRowCursor::read(size_t objId)
+{
+    //Labels added to the metadata while iterating
+    if (allLabels && mdLabels != md->getActiveLabelsAddress()->size())
+        setLabels(*md->getActiveLabelsAddress());
+
+    for (size_t i = 0; i < values.size(); ++i)
+        if (!md->getValue(*values[i], objId))
+            return false;
+    return true;
+}
+
 //////////// Generators implementations
 inline double MDRandGenerator::getRandValue()
 {
@@ -2625,6 +2815,67 @@ WriteModeMetaData metadataModeConvert (String mode)
 }
 
 
+MDStarWriter::MDStarWriter(const FileName &fn, const std::vector<MDLabel> &labels,
+                           const String &blockName, const String &comment, WriteModeMetaData mode)
+{
+    for (size_t i = 0; i < labels.size(); i++)
+        if (labels[i] != MDL_STAR_COMMENT)
+        {
+            this->labels.push_back(labels[i]);
+            defaults.push_back(MDObject(labels[i]));
+        }
+    rows = 0;
+
+    bool append = mode == MD_APPEND && fn.exists();
+    ofs.open(fn.c_str(), append ? std::ios_base::app : std::ios_base::out);
+    if (!ofs)
+        REPORT_ERROR(ERR_IO_NOWRITE, "MDStarWriter: can not write file " + fn);
+    precision = ofs.precision();
+    buffer.reserve(STAR_WRITE_BUFFER_SIZE + 4096);
+
+    if (!append)
+        ofs << FileNameVersion << " * " << std::endl << WordWrap(comment, line_max);
+    ofs << "data_" << blockName << std::endl;
+    ofs << "loop_" << std::endl;
+    for (size_t i = 0; i < this->labels.size(); i++)
+        ofs << " _" << MDL::label2Str(this->labels[i]) << std::endl;
+}
+
+MDStarWriter::~MDStarWriter()
+{
+    //Errors can not be reported from here
+    if (ofs.is_open())
+        ofs.write(buffer.data(), buffer.size());
+}
+
+void MDStarWriter::addRow(const MDRow &row)
+{
+    for (size_t i = 0; i < labels.size(); i++)
+    {
+        MDObject * object = row.getObject(labels[i]);
+        (object != NULL ? object : &defaults[i])->toBuffer(buffer, precision);
+        buffer += ' ';
+    }
+    buffer += '\n';
+    ++rows;
+    if (buffer.size() >= STAR_WRITE_BUFFER_SIZE)
+        flush();
+}
+
+void MDStarWriter::flush()
+{
+    ofs.write(buffer.data(), buffer.size());
+    buffer.clear();
+    if (!ofs)
+        REPORT_ERROR(ERR_IO_NOWRITE, "MDStarWriter: error writing rows");
+}
+
+void MDStarWriter::close()
+{
+    flush();
+    ofs.close();
+}
+
 /* Class to generate values for columns of a metadata*/
 void MDValueGenerator::fill(MetaData &md)
 {
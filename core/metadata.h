@@ -222,6 +222,55 @@ public:
 }
 ;//class MDRowIterator
 
+////////////////////////////// MetaData Row Cursor ////////////////////////////
+/** Reads rows of a metadata into a single reused row.
+ * Only the requested labels are read. The objects of the row are created
+ * once and the values are copied into them, so reading a row does not
+ * allocate memory (apart from growing strings or vectors).
+ * The row is overwritten by the next read.
+ *
+ * @code
+ * MDRowCursor cursor(md);
+ * FOR_ALL_OBJECTS_IN_METADATA(md)
+ * {
+ *     cursor.read(__iter.objId);
+ *     cursor.row().getValue(MDL_IMAGE, fnImg);
+ * }
+ * @endcode
+ */
+class MDRowCursor
+{
+protected:
+    const MetaData * md;
+    // Read all active labels of the metadata
+    bool allLabels;
+    // Number of active labels of the metadata when the row was created
+    size_t mdLabels;
+    // Objects of currentRow, in reading order
+    std::vector<MDObject*> values;
+    MDRow currentRow;
+
+    /** Create the objects of the row for the given labels */
+    void setLabels(const std::vector<MDLabel> &labels);
+public:
+    /** Cursor over some labels of md, all the active ones if empty.
+     * Labels not present in md are ignored.
+     */
+    MDRowCursor(const MetaData &md, const std::vector<MDLabel> &labels=std::vector<MDLabel>());
+
+    /** Read the values of an object.
+     * Return false if the object does not exist.
+     */
+    bool read(size_t objId);
+
+    /** Row with the last values read */
+    const MDRow &row() const
+    {
+        return currentRow;
+    }
+}
+;//class MDRowCursor
+
 typedef std::vector<MDRow> VMetaData;
 
 /** Class to manage data files.
@@ -323,6 +372,10 @@ protected:
      * @param maxRows if this number if greater than 0, only this number of rows will be parsed.
      */
     void _readRowsStar(mdBlock &block, std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels);
+    /** Same as _readRowsStar, but the rows are parsed in chunks by several
+     * threads and inserted in the same order they have in the file.
+     */
+    void _readRowsStarParallel(mdBlock &block, std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels);
     void _readRowFormat(std::istream& is);
 
     /** This two variables will be used to read the metadata information (labels and size)
@@ -330,6 +383,9 @@ protected:
      */
     size_t _maxRows, _parsedLines;
 
+    /** Number of threads used for parsing STAR files */
+    static int readThreads;
+
 public:
     /** @name Constructors
      *  @{
@@ -391,6 +447,16 @@ public:
       _maxRows = maxRows;
     }
 
+    /** Set the number of threads used to parse the rows of STAR files.
+     * Large loop blocks are split at line boundaries in chunks that are
+     * parsed in parallel, rows are inserted in the file order.
+     * By default only one thread is used.
+     */
+    static void setReadThreads(int threads)
+    {
+        readThreads = (threads < 1) ? 1 : threads;
+    }
+
     /** Return the number of lines in the metadata file.
      * Serves to know the number of items even is read with
      * maxRows != 0
@@ -455,7 +521,15 @@ public:
      */
     void writeText(const FileName fn,  const std::vector<MDLabel>* desiredLabels) const;
 
-    void _parseObjects(std::istream &is, std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels, bool firstTime);
+    /* Parse the values of one row from the characters in [iter, end)
+     * and insert them in the DB with the prepared insert statement.
+     */
+    void _parseObjects(const char * iter, const char * end, std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels, bool firstTime);
+
+    /* Insert already parsed values of one row with the prepared insert
+     * statement. If firstTime, the labels of the columns are added.
+     */
+    void _insertObjects(const std::vector<MDObject*> & columnValues, const std::vector<MDLabel> *desiredLabels, bool firstTime);
 
     /* Helper function to parse an MDObject and set its value.
      * The parsing will be from an input stream(istream)
@@ -1166,6 +1240,56 @@ public:
 }
 ;//class MetaData
 
+/** Write a STAR file row by row.
+ *
+ * Rows are formatted as MetaData::write does and buffered, so a file
+ * with millions of rows can be generated without keeping them in a
+ * MetaData. The header is written on construction and the pending rows
+ * on close() or destruction.
+ * In MD_APPEND mode the block is added at the end of the file, an existing
+ * block with the same name is not removed.
+ *
+ * @code
+ * MDStarWriter writer("particles.xmd", labels, "particles");
+ * for (...)
+ * {
+ *     row.setValue(MDL_IMAGE, fnImg);
+ *     writer.addRow(row);
+ * }
+ * writer.close();
+ * @endcode
+ */
+class MDStarWriter
+{
+    std::ofstream ofs;
+    std::vector<MDLabel> labels;
+    //Values written for labels missing in a row
+    std::vector<MDObject> defaults;
+    String buffer;
+    int precision;
+    size_t rows;
+
+    /** Write the buffered rows to the file */
+    void flush();
+public:
+    /** Open the file and write the header of the block */
+    MDStarWriter(const FileName &fn, const std::vector<MDLabel> &labels,
+                 const String &blockName=DEFAULT_BLOCK_NAME, const String &comment="",
+                 WriteModeMetaData mode=MD_OVERWRITE);
+    /** The file is closed if close() was not called */
+    ~MDStarWriter();
+    /** Add a row, only the labels given on construction are written */
+    void addRow(const MDRow &row);
+    /** Number of rows written */
+    size_t size() const
+    {
+        return rows;
+    }
+    /** Write the pending rows and close the file */
+    void close();
+}
+;//class MDStarWriter
+
 /** print metadata
  *
  */
@@ -602,6 +602,85 @@ void MDObject::toStream(std::ostream &os, bool withFormat, bool isSql, bool esca
         }//close switch
 }//close function toStream
 
+/** Append a double with the format of DOUBLE2STREAM */
+static inline void doubleToBuffer(String &buffer, double d, int precision)
+{
+    char number[64];
+    int n = snprintf(number, sizeof(number), (d != 0. && ABS(d) < 0.001) ? "%12.*e" : "%12.*f", precision, d);
+    if (n >= (int) sizeof(number))//huge numbers in fixed notation
+        buffer += formatString("%12.*f", precision, d);
+    else
+        buffer.append(number, n);
+}
+
+void MDObject::toBuffer(String &buffer, int precision) const
+{
+    char number[32];
+
+    switch (label == MDL_UNDEFINED ? LABEL_NOTYPE : MDL::labelType(label))
+    {
+    case LABEL_BOOL:
+        buffer += data.boolValue ? '1' : '0';
+        break;
+    case LABEL_INT:
+        buffer.append(number, snprintf(number, sizeof(number), "%20d", data.intValue));
+        break;
+    case LABEL_SIZET:
+        buffer.append(number, snprintf(number, sizeof(number), "%20lu", (unsigned long) data.longintValue));
+        break;
+    case LABEL_DOUBLE:
+        doubleToBuffer(buffer, data.doubleValue, precision);
+        break;
+    case LABEL_VECTOR_DOUBLE:
+        {
+            const std::vector<double> &vectorDouble = *(data.vectorValue);
+            buffer += "' ";
+            for (size_t i = 0; i < vectorDouble.size(); i++)
+            {
+                doubleToBuffer(buffer, vectorDouble[i], precision);
+                buffer += ' ';
+            }
+            buffer += _QUOT;
+        }
+        break;
+    case LABEL_VECTOR_SIZET:
+        {
+            const std::vector<size_t> &vector = *(data.vectorValueLong);
+            buffer += "' ";
+            for (size_t i = 0; i < vector.size(); i++)
+                buffer.append(number, snprintf(number, sizeof(number), "%lu ", (unsigned long) vector[i]));
+            buffer += _QUOT;
+        }
+        break;
+    case LABEL_STRING:
+        {
+            const String &str = *(data.stringValue);
+            char c = _SPACE;
+            if (str.find_first_of(_DQUOT) != String::npos)
+                c = _QUOT;
+            else if (str.find_first_of(_QUOT) != String::npos)
+                c = _DQUOT;
+            else if (str.empty() || str.find_first_of(_SPACE) != String::npos)
+                c = _QUOT;
+            if (c == _SPACE)
+                buffer += str;
+            else
+            {
+                buffer += c;
+                buffer += str;
+                buffer += c;
+            }
+        }
+        break;
+    default:
+        {
+            std::stringstream ss;
+            toStream(ss, true);
+            buffer += ss.str();
+        }
+    }
+}
+
 String MDObject::toString(bool withFormat, bool isSql) const
 {
     if (type == LABEL_STRING)
@@ -724,6 +803,137 @@ bool MDObject::fromChar(const char * szChar)
     std::stringstream ss(szChar);
     return fromStream(ss);
 }
+
+/* Helpers for parsing values directly from a buffer */
+static inline void skipSpaces(const char * &iter, const char * end)
+{
+    while (iter < end && isspace(*iter))
+        ++iter;
+}
+
+static inline const char * tokenEnd(const char * iter, const char * end)
+{
+    while (iter < end && !isspace(*iter))
+        ++iter;
+    return iter;
+}
+
+static inline bool parseDouble(const char * &iter, const char * end, double &d)
+{
+    skipSpaces(iter, end);
+    if (iter >= end)
+        return false;
+    char * next;
+    d = strtod(iter, &next);
+    if (next == iter)
+        return false;
+    iter = next;
+    return true;
+}
+
+static inline bool parseSizeT(const char * &iter, const char * end, size_t &value)
+{
+    skipSpaces(iter, end);
+    if (iter >= end)
+        return false;
+    char * next;
+    value = strtoull(iter, &next, 10);
+    if (next == iter)
+        return false;
+    iter = next;
+    return true;
+}
+
+/* Move iter after the next quote, looking at most 256 characters
+ * as is.ignore(256, _QUOT) does */
+static inline void skipQuote(const char * &iter, const char * end)
+{
+    size_t n = std::min((size_t)(end - iter), (size_t)256);
+    const char * quote = (const char *) memchr(iter, _QUOT, n);
+    iter = (quote == NULL) ? iter + n : quote + 1;
+}
+
+bool MDObject::fromBuffer(const char * &iter, const char * end)
+{
+    skipSpaces(iter, end);
+    if (label == MDL_UNDEFINED) //if undefine label, skip the literal string
+    {
+        if (iter >= end)
+            return false;
+        iter = tokenEnd(iter, end);
+        return true;
+    }
+
+    //NOTE: int, bool and long(size_t) are read as double for compatibility with old doc files
+    double d;
+    size_t value;
+    switch (type)
+    {
+    case LABEL_BOOL: //bools are int in sqlite3
+        if (!parseDouble(iter, end, d))
+            return false;
+        data.boolValue = (bool) ((int)d);
+        break;
+    case LABEL_INT:
+        if (!parseDouble(iter, end, d))
+            return false;
+        data.intValue = (int) d;
+        break;
+    case LABEL_SIZET:
+        if (!parseDouble(iter, end, d))
+            return false;
+        data.longintValue = (size_t) d;
+        break;
+    case LABEL_DOUBLE:
+        return parseDouble(iter, end, data.doubleValue);
+    case LABEL_STRING:
+        {
+            if (iter >= end)
+                return false;
+            data.stringValue->clear();
+            const char * tokEnd = tokenEnd(iter, end);
+            char chr = *iter;
+            if (chr == _QUOT || chr == _DQUOT)
+            {
+                //Quoted strings may contain spaces, join tokens until the closing quote
+                const char * tokBegin = iter + 1;
+                while (std::find(tokBegin, tokEnd, chr) == tokEnd)
+                {
+                    data.stringValue->append(tokBegin, tokEnd);
+                    data.stringValue->push_back(' ');
+                    iter = tokEnd;
+                    skipSpaces(iter, end);
+                    if (iter >= end)
+                        return false;
+                    tokBegin = iter;
+                    tokEnd = tokenEnd(iter, end);
+                }
+                data.stringValue->append(tokBegin, tokEnd - 1); //remove last char '
+            }
+            else
+                data.stringValue->assign(iter, tokEnd);
+            iter = tokEnd;
+        }
+        break;
+    case LABEL_VECTOR_DOUBLE:
+        skipQuote(iter, end);
+        data.vectorValue->clear();
+        while (parseDouble(iter, end, d)) //This will stop at ending "]"
+            data.vectorValue->push_back(d);
+        skipQuote(iter, end); //ignore the ending ']'
+        break;
+    case LABEL_VECTOR_SIZET:
+        skipQuote(iter, end);
+        data.vectorValueLong->clear();
+        while (parseSizeT(iter, end, value)) //This will stop at ending "]"
+            data.vectorValueLong->push_back(value);
+        skipQuote(iter, end); //ignore the ending ']'
+        break;
+    case LABEL_NOTYPE:
+        break;
+    }
+    return true;
+}
 //MDObject & MDRow::operator [](MDLabel label)
 //{
 //    for (iterator it = begin(); it != end(); ++it)
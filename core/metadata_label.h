@@ -1067,11 +1067,23 @@ public:
 
     void toStream(std::ostream &os, bool withFormat = false, bool isSql=false, bool escape=true) const;
     String toString(bool withFormat = false, bool isSql=false) const;
+    /** Append the value to buffer formatted as toStream(os, true) does,
+     * with the given precision for doubles. Used to write large files
+     * without going through a stream for each value.
+     */
+    void toBuffer(String &buffer, int precision = 6) const;
     bool fromStream(std::istream &is, bool fromString=false);
     friend std::istream& operator>> (std::istream& is, MDObject &value);
     friend std::ostream& operator<< (std::ostream& is, const MDObject &value);
     bool fromString(const String &str);
     bool fromChar(const char * str);
+    /** Parse the value from a buffer of characters, as fromStream does
+     * but without stream or string allocations. iter is moved after the
+     * parsed value. The character at end must be readable and must not
+     * be part of a value (a newline or a '\0').
+     * Return false if the value could not be parsed.
+     */
+    bool fromBuffer(const char * &iter, const char * end);
 
     friend class MDSql;
 }
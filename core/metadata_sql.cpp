@@ -34,15 +34,28 @@
 
 //This is needed for static memory allocation
 int MDSql::table_counter = 0;
-sqlite3 *MDSql::db;
+sqlite3 *MDSql::sharedDb = NULL;
+bool MDSql::privateConnections = false;
+bool MDSql::columnCache = true;
+bool MDSql::mathExtensions = false;
+bool MDSql::regExtensions = false;
+int MDSql::busyTimeOut = -1;
 MDSqlStaticInit MDSql::initialization;
-char *MDSql::errmsg;
-const char *MDSql::zLeftover;
-int MDSql::rc;
 Mutex sqlMutex; //Mutex to syncronize db access
+//Private connections currently open, guarded by connectionsMutex
+std::vector<sqlite3 *> privateDbs;
+Mutex connectionsMutex;
 
-std::stringstream MDSql::preparedStream;	// Stream.
-sqlite3_stmt * MDSql::preparedStmt;
+static bool loadMathExtensions(sqlite3 *conn)
+{
+    sqlite3_enable_load_extension(conn, 1);
+    return sqlite3_load_extension(conn, "libXmippCore.so", 0, 0) == SQLITE_OK;
+}
+
+static bool loadRegExtensions(sqlite3 *conn)
+{
+    return sqlite3_create_function(conn, "regexp", 2, SQLITE_ANY,0, &sqlite_regexp,0,0) == SQLITE_OK;
+}
 
 void sqlite_regexp(sqlite3_context* context, int argc, sqlite3_value** values) {
     int ret;
@@ -118,33 +131,64 @@ MDSql::MDSql(MetaData *md)
     myMd = md;
     myCache = new MDCache();
     beThreadSafe = false;
-
+    errmsg = NULL;
+    zLeftover = NULL;
+    preparedStmt = NULL;
+    db = sharedDb;
+    if (privateConnections && !openConnection(db))
+        REPORT_ERROR(ERR_MD_SQL, "Cannot open private metadata connection");
 }
 
 MDSql::~MDSql()
 {
     delete myCache;
+    finalizePreparedStmt();
+    releaseSources();
+    if (hasPrivateConnection())
+        closeConnection(db);
+}
+
+void MDSql::setPrivateConnections(bool privateConnections)
+{
+    MDSql::privateConnections = privateConnections;
+}
+
+bool MDSql::hasPrivateConnection() const
+{
+    return db != sharedDb;
+}
+
+void MDSql::setColumnCache(bool columnCache)
+{
+    MDSql::columnCache = columnCache;
 }
 
 bool MDSql::createMd()
 {
-    sqlMutex.lock();
+    //Private connections are not shared, no need to lock
+    bool lock = !hasPrivateConnection();
+    if (lock)
+        sqlMutex.lock();
     //std::cerr << "creating md" <<std::endl;
     bool result = createTable(&(myMd->activeLabels));
     //std::cerr << "leave creating md" <<std::endl;
-    sqlMutex.unlock();
+    if (lock)
+        sqlMutex.unlock();
 
     return result;
 }
 
 bool MDSql::clearMd()
 {
-    sqlMutex.lock();
+    bool lock = !hasPrivateConnection();
+    if (lock)
+        sqlMutex.lock();
     //std::cerr << "clearing md" <<std::endl;
     myCache->clear();
     bool result = dropTable();
     //std::cerr << "leave clearing md" <<std::endl;
-    sqlMutex.unlock();
+    if (lock)
+        sqlMutex.unlock();
 
     return result;
 }
@@ -196,20 +240,28 @@ bool MDSql::addColumn(MDLabel column)
 
 bool  MDSql::activateMathExtensions(void)
 {
-    const char* lib = "libXmippCore.so";
-    sqlite3_enable_load_extension(db, 1);
-    if( sqlite3_load_extension(db, lib, 0, 0)!= SQLITE_OK)
+    bool ok = loadMathExtensions(sharedDb);
+    connectionsMutex.lock();
+    for (size_t i = 0; i < privateDbs.size(); ++i)
+        ok = loadMathExtensions(privateDbs[i]) && ok;
+    mathExtensions = true;
+    connectionsMutex.unlock();
+    if (!ok)
         REPORT_ERROR(ERR_MD_SQL,"Cannot activate sqlite extensions");
-    else
-        return true;
+    return true;
 }
 
 bool  MDSql::activateRegExtensions(void)
 {
-	if( sqlite3_create_function(db, "regexp", 2, SQLITE_ANY,0, &sqlite_regexp,0,0)!= SQLITE_OK)
+    bool ok = loadRegExtensions(sharedDb);
+    connectionsMutex.lock();
+    for (size_t i = 0; i < privateDbs.size(); ++i)
+        ok = loadRegExtensions(privateDbs[i]) && ok;
+    regExtensions = true;
+    connectionsMutex.unlock();
+    if (!ok)
         REPORT_ERROR(ERR_MD_SQL,"Cannot activate sqlite extensions");
-    else
-        return true;
+    return true;
 }
 
 bool  MDSql::deactivateThreadMuting(void)
@@ -328,6 +380,12 @@ bool MDSql::setObjectValues( size_t id, const std::vector<MDObject*> columnValue
         <<"    code: " << rc << " error: " << sqlite3_errmsg(db) << std::endl;
         r = false;
     }
+    // Updated rows may be kept in memory, inserted ones are new.
+    else if (id != -1)
+    {
+        for (j=0; j<columnValues.size() ;j++)
+            updateColumnValue(id, *(columnValues[j]));
+    }
 
     // Reset statement and bindings.
     sqlite3_clear_bindings(this->preparedStmt);
@@ -366,6 +424,7 @@ bool MDSql::setObjectValue(const MDObject &value)
         r = false;
     }
     sqlite3_finalize(stmt);
+    myCache->clearColumn(column);
     return r;
 }
 
@@ -402,6 +461,8 @@ bool MDSql::setObjectValue(const int objId, const MDObject &value)
         <<"    code: " << rc << " error: " << sqlite3_errmsg(db) << std::endl;
         r = false;
     }
+    else
+        updateColumnValue(objId, value);
 
     return r;
 }
@@ -581,11 +642,51 @@ bool MDSql::getObjectsValues( std::vector<MDLabel> labels, std::vector<MDObject>
 	return(ret);
 }
 
+bool MDSql::initializeSelectRows(const std::vector<MDLabel> &labels)
+{
+    std::stringstream ss;
+    ss << "SELECT ";
+    for (size_t i = 0; i < labels.size(); i++)
+        ss << (i ? "," : "") << MDL::label2StrSql(labels[i]);
+    //Ordered as the objects are iterated, no matter the query plan
+    ss << " FROM " << tableName(tableId) << " ORDER BY objID;";
+
+    if (sqlite3_prepare_v2(db, ss.str().c_str(), -1, &this->preparedStmt, &zLeftover) != SQLITE_OK)
+    {
+        printf( "could not prepare statement: %s\n", sqlite3_errmsg(db) );
+        this->preparedStmt = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool MDSql::getRowValues(std::vector<MDObject> &values)
+{
+    if (sqlite3_step(this->preparedStmt) != SQLITE_ROW)
+        return false;
+    for (size_t i = 0; i < values.size(); i++)
+        extractValue(this->preparedStmt, i, values[i]);
+    return true;
+}
+
 bool MDSql::getObjectValue(const int objId, MDObject  &value)
 {
 	if (beThreadSafe) { sqlMutex.lock(); }
     std::stringstream ss;
     MDLabel column = value.label;
+
+    MDColumn *mdColumn = getColumn(column);
+    if (mdColumn != NULL)
+    {
+        long index = mdColumn->find(objId);
+        //Rows added after loading the column are read from sqlite
+        if (index >= 0)
+        {
+            mdColumn->get(index, value);
+            if (beThreadSafe) { sqlMutex.unlock(); }
+            return true;
+        }
+    }
     sqlite3_stmt * &stmt = myCache->getValueCache[column];
 
     if (stmt == NULL)//prepare stmt if not exists
@@ -682,18 +783,18 @@ size_t MDSql::copyObjects(MDSql * sqlOut, const MDQuery *queryPtr) const
         sep = ", ";
     }
     ss << "(" << ss2.str() << ") SELECT " << ss2.str();
-    ss << " FROM " << tableName(tableId);
+    ss << " FROM " << sqlOut->sourceTableName(this);
     if (queryPtr != NULL)
     {
         ss << queryPtr->whereString();
         ss << queryPtr->orderByString();
         ss << queryPtr->limitString();
     }
+    size_t copied = 0;
     if (sqlOut->execSingleStmt(ss))
-    {
-        return sqlite3_changes(db);
-    }
-    return 0;
+        copied = sqlite3_changes(sqlOut->db);
+    sqlOut->releaseSources();
+    return copied;
 }
 
 void MDSql::aggregateMd(MetaData *mdPtrOut,
@@ -702,8 +803,9 @@ void MDSql::aggregateMd(MetaData *mdPtrOut,
 {
     std::stringstream ss;
     std::stringstream ss2;
+    MDSql *sqlOut = mdPtrOut->myMDSql;
     std::string aggregateStr = MDL::label2StrSql(mdPtrOut->activeLabels[0]);
-    ss << "INSERT INTO " << tableName(mdPtrOut->myMDSql->tableId)
+    ss << "INSERT INTO " << tableName(sqlOut->tableId)
     << "(" << aggregateStr;
     ss2 << aggregateStr;
     //Start iterating on second label, first is the
@@ -736,11 +838,12 @@ void MDSql::aggregateMd(MetaData *mdPtrOut,
         << ") AS " << MDL::label2StrSql(mdPtrOut->activeLabels[i+1]);
     }
     ss << ") SELECT " << ss2.str();
-    ss << " FROM " << tableName(tableId);
+    ss << " FROM " << sqlOut->sourceTableName(this);
     ss << " GROUP BY " << aggregateStr;
     ss << " ORDER BY " << aggregateStr << ";";
     //std::cerr << "ss " << ss.str() <<std::endl;
-    execSingleStmt(ss);
+    sqlOut->execSingleStmt(ss);
+    sqlOut->releaseSources();
 }
 
 
@@ -753,12 +856,13 @@ void MDSql::aggregateMdGroupBy(MetaData *mdPtrOut,
     std::stringstream ss;
     std::stringstream ss2;
     std::stringstream groupByStr;
+    MDSql *sqlOut = mdPtrOut->myMDSql;
 
     groupByStr << MDL::label2StrSql(groupByLabels[0]);
     for (size_t i = 1; i < groupByLabels.size(); i++)
         groupByStr << ", " << MDL::label2StrSql(groupByLabels[i]);
 
-    ss << "INSERT INTO " << tableName(mdPtrOut->myMDSql->tableId) << "("
+    ss << "INSERT INTO " << tableName(sqlOut->tableId) << "("
     << groupByStr.str() << ", " << MDL::label2StrSql(resultLabel) << ")";
 
     ss2 << groupByStr.str() << ", ";
@@ -786,12 +890,13 @@ void MDSql::aggregateMdGroupBy(MetaData *mdPtrOut,
     ss2 << ") AS " << MDL::label2StrSql(resultLabel);
 
     ss << " SELECT " << ss2.str();
-    ss << " FROM " << tableName(tableId);
+    ss << " FROM " << sqlOut->sourceTableName(this);
     ss << " GROUP BY " << groupByStr.str();
     ss << " ORDER BY " << groupByStr.str() << ";";
 
     //std::cerr << "ss " << ss.str() <<std::endl;
-    execSingleStmt(ss);
+    sqlOut->execSingleStmt(ss);
+    sqlOut->releaseSources();
 }
 
 
@@ -935,15 +1040,19 @@ void MDSql::setOperate(MetaData *mdPtrOut, const std::vector<MDLabel> &columns,
     int size;
     std::string sep = " ";
     std::vector<MDLabel> * labelVector;
+    MDSql *sqlOut = mdPtrOut->myMDSql;
+    String outName = tableName(sqlOut->tableId);
+    String inName;
 
     switch (operation)
     {
     case UNION:
-        copyObjects(mdPtrOut->myMDSql);
+        copyObjects(sqlOut);
         execStmt = false;
         break;
 
     case UNION_DISTINCT: //unionDistinct
+        inName = sqlOut->sourceTableName(this);
         //Create string with columns list
         size = mdPtrOut->activeLabels.size();
         //std::cerr << "LABEL" <<  MDL::label2StrSql(column) <<std::endl;
@@ -952,10 +1061,10 @@ void MDSql::setOperate(MetaData *mdPtrOut, const std::vector<MDLabel> &columns,
             ss2 << sep << MDL::label2StrSql( myMd->activeLabels[i]);
             sep = ", ";
         }
-        ss << "INSERT INTO " << tableName(mdPtrOut->myMDSql->tableId)
+        ss << "INSERT INTO " << outName
         << " (" << ss2.str() << ")"
         << " SELECT " << ss2.str()
-        << " FROM " << tableName(tableId)
+        << " FROM " << inName
         << " WHERE ";
         for (size_t j=0; j<columns.size(); ++j)
         {
@@ -963,13 +1072,14 @@ void MDSql::setOperate(MetaData *mdPtrOut, const std::vector<MDLabel> &columns,
         		ss << " AND ";
         	ss << MDL::label2StrSql(columns[j])
 				<< " NOT IN (SELECT " << MDL::label2StrSql(columns[j])
-				<< " FROM " << tableName(mdPtrOut->myMDSql->tableId) << ") ";
+				<< " FROM " << outName << ") ";
         }
         ss << ";";
         break;
 
     case DISTINCT:
     case REMOVE_DUPLICATE:
+        inName = sqlOut->sourceTableName(this);
         //Create string with columns list
         size = mdPtrOut->activeLabels.size();
         sep = ' ';
@@ -981,27 +1091,28 @@ void MDSql::setOperate(MetaData *mdPtrOut, const std::vector<MDLabel> &columns,
         }
         if (operation == DISTINCT || columns[0] == MDL_UNDEFINED)
         {
-            ss << "INSERT INTO " << tableName(mdPtrOut->myMDSql->tableId)
+            ss << "INSERT INTO " << outName
             << " (" << ss2.str() << ")"
             << " SELECT DISTINCT " << ss2.str()
-            << " FROM " << tableName(tableId) << ";";
+            << " FROM " << inName << ";";
         }
         else {
             // We need this special case for the REMOVE_DUPLICATE because when using a subset
             // of labels as key, the rest of values are taken randomly.
             // The following query ensures that the first ocurrence of the first group of rows
             // is used to take the remaining values
-            ss << "INSERT INTO " << tableName(mdPtrOut->myMDSql->tableId)
+            ss << "INSERT INTO " << outName
             << " (ObjId," << ss2.str() << ")"
             << " SELECT M.* FROM (SELECT " << MDL::label2StrSql(columns[0]) << ", MIN(ObjId) AS first "
-            << " FROM " << tableName(tableId) << " GROUP BY " << MDL::label2StrSql(columns[0])
-            << " ) foo JOIN " << tableName(tableId) << " M ON foo.first = M.ObjId;";
+            << " FROM " << inName << " GROUP BY " << MDL::label2StrSql(columns[0])
+            << " ) foo JOIN " << inName << " M ON foo.first = M.ObjId;";
         }
         break;
 
     case INTERSECTION:
     case SUBSTRACTION:
-        ss << "DELETE FROM " << tableName(mdPtrOut->myMDSql->tableId)
+        inName = sqlOut->sourceTableName(this);
+        ss << "DELETE FROM " << outName
         << " WHERE ";
         for (size_t j=0; j<columns.size(); ++j)
         {
@@ -1011,7 +1122,7 @@ void MDSql::setOperate(MetaData *mdPtrOut, const std::vector<MDLabel> &columns,
             if (operation == INTERSECTION)
                 ss << " NOT";
 			ss << " IN (SELECT " << MDL::label2StrSql(columns[j])
-			   << " FROM " << tableName(tableId) << ") ";
+			   << " FROM " << inName << ") ";
         }
         ss << ";";
         break;
@@ -1020,7 +1131,10 @@ void MDSql::setOperate(MetaData *mdPtrOut, const std::vector<MDLabel> &columns,
     }
     //std::cerr << "ss " << ss.str() <<std::endl;
     if (execStmt)
-        execSingleStmt(ss);
+    {
+        sqlOut->execSingleStmt(ss);
+        sqlOut->releaseSources();
+    }
 }
 
 bool MDSql::equals(const MDSql &op)
@@ -1037,6 +1151,7 @@ bool MDSql::equals(const MDSql &op)
     ss2 << MDL::label2StrSql(MDL_OBJID);
     ss2Group << MDL::label2StrSql(MDL_OBJID);
     int precision = myMd->precision;
+    String opName = sourceTableName(&op);
     for (int i = 0; i < size; i++)
     {
         //when metadata  is double compare
@@ -1062,12 +1177,14 @@ bool MDSql::equals(const MDSql &op)
     FROM " <<   tableName(tableId)
     <<      " UNION ALL \
     SELECT " << ss2.str() << "\
-    FROM " << tableName(op.tableId)
+    FROM " << opName
     <<     ") tmp"
     << " GROUP BY " << ss2Group.str()
     << " HAVING COUNT(*) <> 2"
     << ") tmp1";
-    return (execSingleIntStmt(sqlQuery)==0);
+    bool result = (execSingleIntStmt(sqlQuery)==0);
+    releaseSources();
+    return result;
 }
 
 void MDSql::setOperate(const MetaData *mdInLeft,
@@ -1125,6 +1242,8 @@ void MDSql::setOperate(const MetaData *mdInLeft,
 			mdInLeft->addIndex(columnsLeft[0]);
     	}
     }
+    String leftName = sourceTableName(mdInLeft->myMDSql);
+    String rightName = sourceTableName(mdInRight->myMDSql);
     size = myMd->activeLabels.size();
     size_t sizeLeft = mdInLeft->activeLabels.size();
 
@@ -1133,17 +1252,17 @@ void MDSql::setOperate(const MetaData *mdInLeft,
         ss2 << sep << MDL::label2StrSql( myMd->activeLabels[i]);
         ss3 << sep;
         if (i < sizeLeft && mdInLeft->activeLabels[i] == myMd->activeLabels[i])
-            ss3 << tableName(mdInLeft->myMDSql->tableId) << ".";
+            ss3 << leftName << ".";
         else
-            ss3 << tableName(mdInRight->myMDSql->tableId) << ".";
+            ss3 << rightName << ".";
         ss3 << MDL::label2StrSql( myMd->activeLabels[i]);
         sep = ", ";
     }
     ss << "INSERT INTO " << tableName(tableId)
     << " (" << ss2.str() << ")"
     << " SELECT " << ss3.str()
-    << " FROM " << tableName(mdInLeft->myMDSql->tableId)
-    << join_type << " JOIN " << tableName(mdInRight->myMDSql->tableId);
+    << " FROM " << leftName
+    << join_type << " JOIN " << rightName;
 
     if (operation != NATURAL_JOIN)
     {
@@ -1152,8 +1271,8 @@ void MDSql::setOperate(const MetaData *mdInLeft,
         {
         	if (j>0)
         		ss << " AND ";
-        	ss << tableName(mdInLeft->myMDSql->tableId) << "." << MDL::label2StrSql(columnsLeft[j])
-               << "=" << tableName(mdInRight->myMDSql->tableId) << "." << MDL::label2StrSql(columnsRight[j]);
+        	ss << leftName << "." << MDL::label2StrSql(columnsLeft[j])
+               << "=" << rightName << "." << MDL::label2StrSql(columnsRight[j]);
         }
         ss << ") ";
     }
@@ -1167,10 +1286,10 @@ void MDSql::setOperate(const MetaData *mdInLeft,
                 if(mdInRight->activeLabels[i] == mdInLeft->activeLabels[j])
                 {
                     ss << sep
-                    << tableName(mdInRight->myMDSql->tableId) << "."
+                    << rightName << "."
                     << MDL::label2StrSql(mdInRight->activeLabels[i])
                     << " = "
-                    << tableName(mdInLeft->myMDSql->tableId) << "."
+                    << leftName << "."
                     << MDL::label2StrSql(mdInLeft->activeLabels[j]);
                     sep = " AND ";
                 }
@@ -1183,6 +1302,7 @@ void MDSql::setOperate(const MetaData *mdInLeft,
     //    for (int j = 0; j < sizeLeft; j++)
     //     std::cerr << "mdInLeft->activeLabels:"  << mdInLeft->activeLabels[1] << std::endl;
     execSingleStmt(ss);
+    releaseSources();
     //std::cerr << "ss:" << ss.str() << std::endl;
     //dumpToFile("kk.sqlite");
     //exit(0);
@@ -1200,12 +1320,13 @@ void MDSql::dumpToFile(const FileName &fileName)
 {
     sqlite3 *pTo;
     sqlite3_backup *pBackup;
+    int rc;
 
     sqlCommitTrans();
     rc = sqlite3_open(fileName.c_str(), &pTo);
     if( rc==SQLITE_OK )
     {
-        pBackup = sqlite3_backup_init(pTo, "main", db, "main");
+        pBackup = sqlite3_backup_init(pTo, "main", sharedDb, "main");
         if( pBackup )
         {
             sqlite3_backup_step(pBackup, -1);
@@ -1217,6 +1338,42 @@ void MDSql::dumpToFile(const FileName &fileName)
         REPORT_ERROR(ERR_MD_SQL, "dumpToFile: error opening db file");
     sqlite3_close(pTo);
     sqlBeginTrans();
+
+    //Table names are unique among connections, so the tables of the
+    //private connections are added to the file next to the shared ones
+    connectionsMutex.lock();
+    for (size_t i = 0; i < privateDbs.size(); ++i)
+    {
+        sqlite3 *conn = privateDbs[i];
+        char *errmsg;
+        char **tables;
+        int rows, columns;
+        sqlCommitTrans(conn);
+        String sqlCommand = (String)"ATTACH database '" + fileName + "' as save";
+        if (sqlite3_exec(conn, sqlCommand.c_str(), NULL, NULL, &errmsg) != SQLITE_OK)
+        {
+            std::cerr << "dumpToFile: couldn't attach file:  " << errmsg << std::endl;
+            sqlBeginTrans(conn);
+            continue;
+        }
+        if (sqlite3_get_table(conn, "SELECT name FROM main.sqlite_master WHERE type='table'"
+                              " AND name NOT LIKE 'sqlite_%'",
+                              &tables, &rows, &columns, &errmsg) == SQLITE_OK)
+        {
+            for (int r = 1; r <= rows; ++r)
+            {
+                sqlCommand = (String)"CREATE TABLE save." + tables[r]
+                             + " AS SELECT * FROM main." + tables[r];
+                if (sqlite3_exec(conn, sqlCommand.c_str(), NULL, NULL, &errmsg) != SQLITE_OK)
+                    std::cerr << "dumpToFile: couldn't write table " << tables[r]
+                    << ": " << errmsg << std::endl;
+            }
+            sqlite3_free_table(tables);
+        }
+        sqlite3_exec(conn, "DETACH save", NULL, NULL, &errmsg);
+        sqlBeginTrans(conn);
+    }
+    connectionsMutex.unlock();
 }
 
 void MDSql::copyTableFromFileDB(const FileName blockname,
@@ -1295,7 +1452,7 @@ void MDSql::copyTableFromFileDB(const FileName blockname,
 
     //Copy table to memory
     //tableName(tableId);
-    sqlCommitTrans();
+    sqlCommitTrans(db);
     dropTable();
     createMd();
 
@@ -1327,12 +1484,13 @@ void MDSql::copyTableFromFileDB(const FileName blockname,
         return;
     }
     sqlite3_exec(db, "DETACH load",NULL,NULL,&errmsg);
-    sqlBeginTrans();
+    myCache->clearColumns();
+    sqlBeginTrans(db);
 }
 
 void MDSql::copyTableToFileDB(const FileName blockname, const FileName &fileName)
 {
-    sqlCommitTrans();
+    sqlCommitTrans(db);
     String _blockname;
     if(blockname.empty())
         _blockname=DEFAULT_BLOCK_NAME;
@@ -1358,7 +1516,7 @@ void MDSql::copyTableToFileDB(const FileName blockname, const FileName &fileName
         return;
     }
     sqlite3_exec(db, "DETACH save",NULL,NULL,&errmsg);
-    sqlBeginTrans();
+    sqlBeginTrans(db);
 }
 
 bool MDSql::sqlBegin()
@@ -1366,19 +1524,60 @@ bool MDSql::sqlBegin()
     if (table_counter > 0)
         return true;
     //std::cerr << "entering sqlBegin" <<std::endl;
-    rc = sqlite3_open("", &db);
+    return openConnection(sharedDb);
+}
+
+bool MDSql::openConnection(sqlite3 *&conn)
+{
+    char *errmsg;
+    if (sqlite3_open("", &conn) != SQLITE_OK)
+        return false;
+
+    sqlite3_exec(conn, "PRAGMA temp_store=MEMORY",NULL, NULL, &errmsg);
+    sqlite3_exec(conn, "PRAGMA synchronous=OFF",NULL, NULL, &errmsg);
+    sqlite3_exec(conn, "PRAGMA count_changes=OFF",NULL, NULL, &errmsg);
+    sqlite3_exec(conn, "PRAGMA page_size=4092",NULL, NULL, &errmsg);
+
+    //Private connections get the same settings as the shared one and are
+    //registered, so that settings changed later also reach them
+    if (conn != sharedDb)
+    {
+        connectionsMutex.lock();
+        if (mathExtensions)
+            loadMathExtensions(conn);
+        if (regExtensions)
+            loadRegExtensions(conn);
+        if (busyTimeOut >= 0)
+            sqlite3_busy_timeout(conn, busyTimeOut);
+        privateDbs.push_back(conn);
+        connectionsMutex.unlock();
+    }
 
-    sqlite3_exec(db, "PRAGMA temp_store=MEMORY",NULL, NULL, &errmsg);
-    sqlite3_exec(db, "PRAGMA synchronous=OFF",NULL, NULL, &errmsg);
-    sqlite3_exec(db, "PRAGMA count_changes=OFF",NULL, NULL, &errmsg);
-    sqlite3_exec(db, "PRAGMA page_size=4092",NULL, NULL, &errmsg);
+    return sqlBeginTrans(conn);
+}
 
-    return sqlBeginTrans();
+void MDSql::closeConnection(sqlite3 *conn)
+{
+    if (conn != sharedDb)
+    {
+        connectionsMutex.lock();
+        privateDbs.erase(std::remove(privateDbs.begin(), privateDbs.end(), conn),
+                         privateDbs.end());
+        connectionsMutex.unlock();
+    }
+    sqlCommitTrans(conn);
+    sqlite3_close(conn);
 }
 
 void MDSql::sqlTimeOut(int miliseconds)
 {
-    if (sqlite3_busy_timeout(db, miliseconds) != SQLITE_OK)
+    bool ok = sqlite3_busy_timeout(sharedDb, miliseconds) == SQLITE_OK;
+    connectionsMutex.lock();
+    for (size_t i = 0; i < privateDbs.size(); ++i)
+        ok = sqlite3_busy_timeout(privateDbs[i], miliseconds) == SQLITE_OK && ok;
+    busyTimeOut = miliseconds;
+    connectionsMutex.unlock();
+    if (!ok)
     {
         std::cerr << "Couldn't not set timeOut:  " << std::endl;
         exit(0);
@@ -1389,14 +1588,15 @@ void MDSql::sqlTimeOut(int miliseconds)
 
 void MDSql::sqlEnd()
 {
-    sqlCommitTrans();
-    sqlite3_close(db);
+    closeConnection(sharedDb);
     //std::cerr << "Database sucessfully closed." <<std::endl;
 }
 
-bool MDSql::sqlBeginTrans()
+bool MDSql::sqlBeginTrans(sqlite3 *conn)
 {
-    if (sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, &errmsg) != SQLITE_OK)
+    char *errmsg;
+
+    if (sqlite3_exec(conn, "BEGIN TRANSACTION", NULL, NULL, &errmsg) != SQLITE_OK)
     {
         std::cerr << "Couldn't begin transaction:  " << errmsg << std::endl;
         return false;
@@ -1404,11 +1604,11 @@ bool MDSql::sqlBeginTrans()
     return true;
 }
 
-bool MDSql::sqlCommitTrans()
+bool MDSql::sqlCommitTrans(sqlite3 *conn)
 {
     char *errmsg;
 
-    if (sqlite3_exec(db, "COMMIT TRANSACTION", NULL, NULL, &errmsg) != SQLITE_OK)
+    if (sqlite3_exec(conn, "COMMIT TRANSACTION", NULL, NULL, &errmsg) != SQLITE_OK)
     {
         std::cerr << "Couldn't commit transaction:  " << errmsg << std::endl;
         return false;
@@ -1453,6 +1653,8 @@ void MDSql::prepareStmt(const std::stringstream &ss, sqlite3_stmt *stmt)
 
 bool MDSql::execSingleStmt(const std::stringstream &ss)
 {
+    //Any statement may modify the table, do not trust in-memory columns
+    myCache->clearColumns();
 
     sqlite3_stmt * stmt;
     sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, &zLeftover);
@@ -1518,6 +1720,105 @@ std::string MDSql::tableName(const int tableId) const
     return ss.str();
 }
 
+String MDSql::sourceTableName(const MDSql *source)
+{
+    if (source->db == db)
+        return tableName(source->tableId);
+
+    String importName = formatString("MDImport_%d", source->tableId);
+    if (std::find(importedTables.begin(), importedTables.end(), importName) != importedTables.end())
+        return importName;
+
+    //Create a temporary table with the same columns than the source one
+    const std::vector<MDLabel> &labels = source->myMd->activeLabels;
+    std::stringstream ss, columns, values;
+    ss << "CREATE TEMP TABLE " << importName << "(objID INTEGER PRIMARY KEY";
+    columns << "objID";
+    values << "?";
+    for (size_t i = 0; i < labels.size(); ++i)
+    {
+        ss << ", " << MDL::label2SqlColumn(labels[i]);
+        columns << ", " << MDL::label2StrSql(labels[i]);
+        values << ",?";
+    }
+    ss << ");";
+    execSingleStmt(ss);
+    importedTables.push_back(importName);
+
+    //Copy the rows from the source connection
+    sqlite3_stmt *selectStmt, *insertStmt;
+    ss.str(String());
+    ss << "SELECT " << columns.str() << " FROM " << tableName(source->tableId);
+    sqlite3_prepare_v2(source->db, ss.str().c_str(), -1, &selectStmt, NULL);
+    ss.str(String());
+    ss << "INSERT INTO " << importName << " (" << columns.str() << ") VALUES (" << values.str() << ");";
+    sqlite3_prepare_v2(db, ss.str().c_str(), -1, &insertStmt, NULL);
+
+    int nColumns = labels.size() + 1;
+    while (sqlite3_step(selectStmt) == SQLITE_ROW)
+    {
+        for (int i = 0; i < nColumns; ++i)
+            sqlite3_bind_value(insertStmt, i + 1, sqlite3_column_value(selectStmt, i));
+        execSingleStmt(insertStmt, &ss);
+        sqlite3_reset(insertStmt);
+    }
+    sqlite3_finalize(selectStmt);
+    sqlite3_finalize(insertStmt);
+
+    return importName;
+}
+
+MDColumn * MDSql::getColumn(MDLabel label)
+{
+    if (!columnCache)
+        return NULL;
+
+    std::map<MDLabel, MDColumn*>::iterator it = myCache->columns.find(label);
+    if (it != myCache->columns.end())
+        return it->second;
+
+    //Only load columns that are read repeatedly
+    if (++myCache->columnReads[label] < MDCache::COLUMN_LOAD_READS)
+        return NULL;
+
+    std::stringstream ss;
+    sqlite3_stmt *stmt;
+    ss << "SELECT objID, " << MDL::label2StrSql(label)
+    << " FROM " << tableName(tableId) << " ORDER BY objID;";
+    if (sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, &zLeftover) != SQLITE_OK)
+        return NULL;
+
+    MDColumn *column = new MDColumn(MDL::labelType(label));
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        column->append(sqlite3_column_int64(stmt, 0), stmt, 1);
+    sqlite3_finalize(stmt);
+
+    myCache->columns[label] = column;
+    return column;
+}
+
+void MDSql::updateColumnValue(size_t objId, const MDObject &value)
+{
+    std::map<MDLabel, MDColumn*>::iterator it = myCache->columns.find(value.label);
+    if (it == myCache->columns.end())
+        return;
+    long index = it->second->find(objId);
+    if (index >= 0)
+        it->second->set(index, value);
+}
+
+void MDSql::releaseSources()
+{
+    std::stringstream ss;
+    for (size_t i = 0; i < importedTables.size(); ++i)
+    {
+        ss.str(String());
+        ss << "DROP TABLE IF EXISTS " << importedTables[i] << ";";
+        execSingleStmt(ss);
+    }
+    importedTables.clear();
+}
+
 bool MDSql::bindStatement( size_t id)
 {
 	bool success=true;		// Return value.
@@ -1588,10 +1889,11 @@ void MDSql::extractValue(sqlite3_stmt *stmt, const int position, MDObject &value
         break;
     case LABEL_STRING:
     {
-        std::stringstream ss;
-        ss << sqlite3_column_text(stmt, position);
-        valueOut.data.stringValue->assign(ss.str());
-
+        const char * text = (const char *) sqlite3_column_text(stmt, position);
+        if (text != NULL)
+            valueOut.data.stringValue->assign(text);
+        else
+            valueOut.data.stringValue->clear();
         break;
     }
     case LABEL_VECTOR_DOUBLE:
@@ -1607,6 +1909,102 @@ void MDSql::extractValue(sqlite3_stmt *stmt, const int position, MDObject &value
     }
 }
 
+MDColumn::MDColumn(MDLabelType type)
+{
+    this->type = type;
+}
+
+long MDColumn::find(size_t objId) const
+{
+    size_t n = objIds.size();
+    if (n == 0 || objId < objIds[0] || objId > objIds[n - 1])
+        return -1;
+    //Usually objIds are consecutive and the position is direct
+    size_t index = objId - objIds[0];
+    if (index < n && objIds[index] == objId)
+        return index;
+    std::vector<size_t>::const_iterator it = std::lower_bound(objIds.begin(), objIds.end(), objId);
+    if (it != objIds.end() && *it == objId)
+        return it - objIds.begin();
+    return -1;
+}
+
+void MDColumn::append(size_t objId, sqlite3_stmt *stmt, int position)
+{
+    objIds.push_back(objId);
+    switch (type)
+    {
+    case LABEL_BOOL:
+    case LABEL_INT:
+        intValues.push_back(sqlite3_column_int(stmt, position));
+        break;
+    case LABEL_SIZET:
+        sizetValues.push_back(sqlite3_column_int(stmt, position));
+        break;
+    case LABEL_DOUBLE:
+        doubleValues.push_back(sqlite3_column_double(stmt, position));
+        break;
+    default:
+    {
+        const unsigned char *text = sqlite3_column_text(stmt, position);
+        stringValues.push_back(text == NULL ? String() : String((const char *)text));
+    }
+    }
+}
+
+void MDColumn::get(long index, MDObject &valueOut) const
+{
+    switch (type)
+    {
+    case LABEL_BOOL:
+        valueOut.data.boolValue = intValues[index] == 1;
+        break;
+    case LABEL_INT:
+        valueOut.data.intValue = intValues[index];
+        break;
+    case LABEL_SIZET:
+        valueOut.data.longintValue = sizetValues[index];
+        break;
+    case LABEL_DOUBLE:
+        valueOut.data.doubleValue = doubleValues[index];
+        break;
+    case LABEL_STRING:
+        valueOut.data.stringValue->assign(stringValues[index]);
+        break;
+    default:
+    {
+        std::stringstream ss(stringValues[index]);
+        valueOut.fromStream(ss);
+    }
+    }
+}
+
+void MDColumn::set(long index, const MDObject &valueIn)
+{
+    //Keep the same representation used when binding values
+    bool null = valueIn.failed;
+    switch (type)
+    {
+    case LABEL_BOOL:
+        intValues[index] = (!null && valueIn.data.boolValue) ? 1 : 0;
+        break;
+    case LABEL_INT:
+        intValues[index] = null ? 0 : valueIn.data.intValue;
+        break;
+    case LABEL_SIZET:
+        sizetValues[index] = null ? 0 : (int)valueIn.data.longintValue;
+        break;
+    case LABEL_DOUBLE:
+        doubleValues[index] = null ? 0. : valueIn.data.doubleValue;
+        break;
+    case LABEL_STRING:
+        stringValues[index] = null ? String() : *valueIn.data.stringValue;
+        break;
+    default:
+        stringValues[index] = null ? String() : valueIn.toString(false, true);
+    }
+}
+
 MDCache::MDCache()
 {
     this->addRowStmt = NULL;
@@ -1642,4 +2040,26 @@ void MDCache::clear()
         sqlite3_finalize(addRowStmt);
         addRowStmt = NULL;
     }
+
+    clearColumns();
+}
+
+void MDCache::clearColumns()
+{
+    std::map<MDLabel, MDColumn*>::iterator it;
+    for (it = columns.begin(); it != columns.end(); it++)
+        delete it->second;
+    columns.clear();
+    columnReads.clear();
+}
+
+void MDCache::clearColumn(MDLabel label)
+{
+    std::map<MDLabel, MDColumn*>::iterator it = columns.find(label);
+    if (it != columns.end())
+    {
+        delete it->second;
+        columns.erase(it);
+    }
+    columnReads.erase(label);
 }
@@ -36,6 +36,7 @@ class MDSqlStaticInit;
 class MDQuery;
 class MetaData;
 class MDCache;
+class MDColumn;
 
 /** @addtogroup MetaData
  * @{
@@ -73,7 +74,12 @@ void sqlite_regexp(sqlite3_context* context, int argc, sqlite3_value** values);
 class MDSql
 {
 public:
+    /** Save the tables of all the connections in a sqlite file.
+     * The transactions of the private connections are committed, so no
+     * other thread should be using metadata meanwhile.
+     */
     static void dumpToFile(const FileName &fileName);
+    /** Set the busy timeout of all the connections, present and future */
     static void sqlTimeOut(int miliSeconds);
 
     /**This library will provide common mathematical and string functions in
@@ -112,6 +118,31 @@ Serialized. In serialized mode, SQLite can be safely used by multiple threads wi
 */
     bool  activateThreadMuting(void);
 
+    /** Select the connection used by MetaData created from now on.
+     * By default all MetaData share a single in-memory database, so
+     * accesses from several threads are serialized. When private
+     * connections are enabled, each new MetaData opens its own in-memory
+     * database (with its own statement cache), and unrelated MetaData
+     * can be read, filtered and written concurrently from different
+     * threads. Operations involving MetaData living in different
+     * connections (import, join, set operations...) copy the source
+     * table into the destination connection first.
+     * This should be set at program start, before creating threads.
+     */
+    static void setPrivateConnections(bool privateConnections);
+
+    /** True if this instance owns its database connection */
+    bool hasPrivateConnection() const;
+
+    /** Enable or disable keeping hot columns in memory.
+     * When enabled (default), the columns that are read repeatedly
+     * with getValue are loaded once into typed vectors, and the
+     * following reads and single-value writes are served from memory.
+     * The database is still the reference storage, so queries, joins
+     * and file I/O work as usual.
+     */
+    static void setColumnCache(bool columnCache);
+
 private:
     /** write metadata in sqlite table
      *
@@ -167,6 +198,18 @@ private:
      */
     bool getObjectsValues( std::vector<MDLabel> labels, std::vector<MDObject> *values);
 
+    /** Prepare a select of the given columns over all objects, in objID order.
+     * Rows are then read with getRowValues and the statement released
+     * with finalizePreparedStmt.
+     */
+    bool initializeSelectRows(const std::vector<MDLabel> &labels);
+
+    /** Read the next row of the select prepared with initializeSelectRows.
+     * values should hold one MDObject per selected label, they are reused.
+     * Return false when there are no more rows.
+     */
+    bool getRowValues(std::vector<MDObject> &values);
+
     /** Get the value of an object.
      */
     bool getObjectValue(const int objId, MDObject  &value);
@@ -260,15 +303,46 @@ private:
     ~MDSql();
 
     static int table_counter;
-    static sqlite3 *db;
+    /// Connection shared by all MetaData without a private connection
+    static sqlite3 *sharedDb;
+    /// If true, new MDSql instances open their own connection
+    static bool privateConnections;
+    /// If true, hot columns are kept in memory
+    static bool columnCache;
+    /// Extensions to be activated on every new private connection
+    static bool mathExtensions;
+    static bool regExtensions;
+    /// Busy timeout in milliseconds of every connection, negative if not set
+    static int busyTimeOut;
 
     static MDSqlStaticInit initialization; //Just for initialization
 
     ///Just call this function once, at static initialization
     static bool sqlBegin();
     static void sqlEnd();
-    static bool sqlBeginTrans();
-    static bool sqlCommitTrans();
+    static bool sqlBeginTrans(sqlite3 *conn = sharedDb);
+    static bool sqlCommitTrans(sqlite3 *conn = sharedDb);
+    /** Open a new in-memory connection with the pragmas used by Xmipp
+     * and an open transaction.
+     */
+    static bool openConnection(sqlite3 *&conn);
+    static void closeConnection(sqlite3 *conn);
+
+    /** Name under which the table of source can be used in queries
+     * executed on this connection. If source lives in another connection
+     * its table is copied into a temporary table of this one, which
+     * will be dropped by releaseSources.
+     */
+    String sourceTableName(const MDSql *source);
+    /** Drop the temporary tables created by sourceTableName */
+    void releaseSources();
+
+    /** Return the in-memory column of label, loading it if it has
+     * been read often enough. NULL if it should be read from sqlite.
+     */
+    MDColumn * getColumn(MDLabel label);
+    /** Update the in-memory value after writing it to the database */
+    void updateColumnValue(size_t objId, const MDObject &value);
     /** Return an unique id for each metadata
      * this function should be called once for each
      * metada and the id will be used for operations
@@ -294,15 +368,18 @@ private:
     int 	bindValue(sqlite3_stmt *stmt, const int position, const MDObject &valueIn);
     void 	extractValue(sqlite3_stmt *stmt, const int position, MDObject &valueOut);
 
-    static char *errmsg;
-    static const char *zLeftover;
-    static int rc;
-    static sqlite3_stmt *stmt;
+    ///Non-static attributes
+    char *errmsg;
+    const char *zLeftover;
 
-    static std::stringstream preparedStream;	// Stream.
-    static sqlite3_stmt * preparedStmt;	// SQL statement.
+    std::stringstream preparedStream;	// Stream.
+    sqlite3_stmt * preparedStmt;	// SQL statement.
+
+    /// Connection used by this MetaData, sharedDb or a private one
+    sqlite3 *db;
+    /// Temporary copies of tables imported from other connections
+    std::vector<String> importedTables;
 
-    ///Non-static attributes
     int tableId;
     MetaData *myMd;
     MDCache *myCache;
@@ -676,7 +753,36 @@ public:
 }
 ;//end of class MDMultiQuery
 
+/** Values of a single column kept in memory.
+ * Values are stored in a typed contiguous vector, in the same
+ * representation that is stored in the database, together with the
+ * sorted objIds of the rows they belong to.
+ */
+class MDColumn
+{
+public:
+    MDLabelType type;
+    std::vector<size_t> objIds;
+    std::vector<int> intValues; ///< Used for int and bool labels
+    std::vector<size_t> sizetValues;
+    std::vector<double> doubleValues;
+    std::vector<String> stringValues; ///< Used for string and vector labels
+
+    MDColumn(MDLabelType type);
+
+    /** Position of objId in the column, or -1 if not present */
+    long find(size_t objId) const;
+    /** Append the value stored in position of stmt */
+    void append(size_t objId, sqlite3_stmt *stmt, int position);
+    /** Copy value at index into valueOut */
+    void get(long index, MDObject &valueOut) const;
+    /** Replace value at index */
+    void set(long index, const MDObject &valueIn);
+};
+
 /** Class to store some cached sql statements.
+ * It also keeps in memory the columns that are being read often,
+ * so repeated getValue calls do not need to go through sqlite.
  */
 class MDCache
 {
@@ -685,10 +791,20 @@ public:
     std::map<MDLabel, sqlite3_stmt*> getValueCache;
     std::map<MDLabel, sqlite3_stmt*> setValueCache;
     sqlite3_stmt *addRowStmt;
+    std::map<MDLabel, MDColumn*> columns;
+    /// Number of reads of each label since its column was invalidated
+    std::map<MDLabel, size_t> columnReads;
+
+    /// Reads of a label needed before loading its column in memory
+    static const size_t COLUMN_LOAD_READS = 8;
 
     MDCache();
     ~MDCache();
     void clear();
+    /** Remove all columns kept in memory */
+    void clearColumns();
+    /** Remove the column of a label kept in memory */
+    void clearColumn(MDLabel label);
 };
 
 /** Just to work as static constructor for initialize database.
@@ -378,6 +378,46 @@ void MultidimArray< std::complex< double > >::maxIndex(size_t &lmax, int& kmax,
     REPORT_ERROR(ERR_NOT_IMPLEMENTED,"MultidimArray::maxIndex not implemented for complex.");
 }
 
+template<>
+void MultidimArray< std::complex< float > >::computeDoubleMinMax(double& minval, double& maxval) const
+{
+    REPORT_ERROR(ERR_NOT_IMPLEMENTED,"MultidimArray::computeDoubleMinMax not implemented for complex.");
+}
+template<>
+void MultidimArray< std::complex< float > >::computeDoubleMinMaxRange(double& minval, double& maxval, size_t pos, size_t size) const
+{
+    REPORT_ERROR(ERR_NOT_IMPLEMENTED,"MultidimArray::computeDoubleMinMax not implemented for complex.");
+}
+template<>
+void MultidimArray< std::complex< float > >::rangeAdjust(std::complex< float > minF, std::complex< float > maxF)
+{
+    REPORT_ERROR(ERR_NOT_IMPLEMENTED,"MultidimArray::rangeAdjust not implemented for complex.");
+}
+
+template<>
+double MultidimArray< std::complex< float > >::computeAvg() const
+{
+    REPORT_ERROR(ERR_NOT_IMPLEMENTED,"MultidimArray::computeAvg not implemented for complex.");
+}
+
+template<>
+void MultidimArray< std::complex< float > >::maxIndex(size_t &lmax, int& kmax, int& imax, int& jmax) const
+{
+    REPORT_ERROR(ERR_NOT_IMPLEMENTED,"MultidimArray::maxIndex not implemented for complex.");
+}
+
+static int reductionThreads = 1;
+
+void setReductionThreads(int n)
+{
+    reductionThreads = (n < 1) ? 1 : n;
+}
+
+int getReductionThreads()
+{
+    return reductionThreads;
+}
+
 // void MultidimArray<double>::selfNormalizeInterval(double minPerc, double maxPerc, int Npix)
 // {
 //     std::vector<double> randValues; // Vector with random chosen values
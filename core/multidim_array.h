@@ -29,12 +29,15 @@
 #ifdef XMIPP_MMAP
 #include <sys/mman.h>
 #endif
+#include <limits>
 /// Consider biblib as external library
 /// for compilation, xmipp/external should be passed as -I
 #include "bilib/tsplinebasis.h"
 #include "bilib/kernel.h"
 
 #include "xmipp_strings.h"
+#include "xmipp_memory.h"
+#include "xmipp_threads.h"
 #include "matrix1d.h"
 #include "matrix2d.h"
 
@@ -622,6 +625,12 @@ extern String floatToString(float F, int _width, int _prec);
 template<typename T>
 class MultidimArray;
 
+template<typename T, typename E>
+class MultidimArrayExpr;
+
+template<typename T>
+class MultidimArrayView;
+
 template<typename T>
 void coreArrayByScalar(const MultidimArray<T>& op1, const T& op2,
                        MultidimArray<T>& result, char operation);
@@ -1173,6 +1182,493 @@ public:
     void printShape(std::ostream& out = std::cout) const;
 };
 
+/** @name Reduction kernels
+ *
+ * Kernels used by the statistics of MultidimArray. The loops accumulate on
+ * REDUCTION_LANES independent lanes and select minima and maxima without
+ * branches, so that the compiler can keep them in vector registers.
+ * Variances are computed block by block (two passes over a block that is
+ * in cache) and blocks are combined with the pairwise update of Chan et
+ * al., which does not suffer from the cancellation of sum(x^2)-N*avg^2.
+ * Arrays with at least REDUCTION_THREAD_MIN_SIZE elements are split among
+ * the threads set with setReductionThreads.
+ */
+//@{
+/** Number of independent accumulators of the reduction loops */
+#define REDUCTION_LANES 8
+
+/** Number of elements of the blocks whose statistics are combined */
+#define REDUCTION_BLOCK 2048
+
+/** Arrays smaller than this are always reduced by the calling thread */
+#define REDUCTION_THREAD_MIN_SIZE (1 << 22)
+
+/** Set the number of threads used to reduce large arrays.
+ * The default is 1, i.e., no threads are launched.
+ */
+void setReductionThreads(int n);
+
+/** Number of threads used to reduce large arrays */
+int getReductionThreads();
+
+/** Sum of a set of values */
+struct ReductionSum
+{
+    double sum;
+
+    ReductionSum(): sum(0)
+    {}
+
+    void merge(const ReductionSum &b)
+    {
+        sum += b.sum;
+    }
+};
+
+/** Minimum and maximum of a set of values */
+template<typename T>
+struct ReductionMinMax
+{
+    size_t N;
+    T minval, maxval;
+
+    ReductionMinMax(): N(0), minval(0), maxval(0)
+    {}
+
+    void merge(const ReductionMinMax<T> &b)
+    {
+        if (b.N == 0)
+            return;
+        if (N == 0)
+            *this = b;
+        else
+        {
+            minval = (b.minval < minval) ? b.minval : minval;
+            maxval = (b.maxval > maxval) ? b.maxval : maxval;
+            N += b.N;
+        }
+    }
+};
+
+/** Count, average, sum of squared deviations, minimum and maximum of a set
+ * of values.
+ */
+template<typename T>
+struct ReductionStats: public ReductionMinMax<T>
+{
+    double avg;
+    double m2;
+
+    ReductionStats(): avg(0), m2(0)
+    {}
+
+    void merge(const ReductionStats<T> &b)
+    {
+        size_t Na = this->N;
+        ReductionMinMax<T>::merge(b);
+        if (Na == 0 || b.N == 0)
+        {
+            if (b.N != 0)
+            {
+                avg = b.avg;
+                m2 = b.m2;
+            }
+            return;
+        }
+        double N = (double)(Na + b.N);
+        double delta = b.avg - avg;
+        avg += delta * b.N / N;
+        m2 += b.m2 + delta * delta * ((double)Na * b.N / N);
+    }
+};
+
+/** Count, averages, sums of squared deviations and co-moment of two sets of
+ * values.
+ */
+struct ReductionCovariance
+{
+    size_t N;
+    double avgx, avgy;
+    double m2x, m2y, cxy;
+
+    ReductionCovariance(): N(0), avgx(0), avgy(0), m2x(0), m2y(0), cxy(0)
+    {}
+
+    void merge(const ReductionCovariance &b)
+    {
+        if (b.N == 0)
+            return;
+        if (N == 0)
+        {
+            *this = b;
+            return;
+        }
+        double Nab = (double)(N + b.N);
+        double f = (double)N * b.N / Nab;
+        double deltax = b.avgx - avgx;
+        double deltay = b.avgy - avgy;
+        avgx += deltax * b.N / Nab;
+        avgy += deltay * b.N / Nab;
+        m2x += b.m2x + deltax * deltax * f;
+        m2y += b.m2y + deltay * deltay * f;
+        cxy += b.cxy + deltax * deltay * f;
+        N += b.N;
+    }
+};
+
+/** Arguments of a reduction.
+ * The kernel reduces the elements [first, last) into result.
+ */
+template<typename T, typename R>
+struct ReductionData
+{
+    const T * x;      // Values
+    const T * y;      // Second set of values, if any
+    const int * mask; // Mask, if any. Values where it is 0 are skipped
+    size_t N;         // Number of values
+    void (*kernel)(const ReductionData<T, R> &d, size_t first, size_t last, R &result);
+    std::vector<R> partial; // Result of each thread
+
+    ReductionData(const T * _x, size_t _N,
+                  void (*_kernel)(const ReductionData<T, R> &, size_t, size_t, R &),
+                  const T * _y = NULL, const int * _mask = NULL):
+        x(_x), y(_y), mask(_mask), N(_N), kernel(_kernel)
+    {}
+};
+
+/** Sum kernel */
+template<typename T>
+void reduceSum(const ReductionData<T, ReductionSum> &d, size_t first, size_t last, ReductionSum &result)
+{
+    const T * __restrict__ ptr = d.x;
+    double sum[REDUCTION_LANES] = {};
+    size_t nmax = first + REDUCTION_LANES * ((last - first) / REDUCTION_LANES);
+    for (size_t n = first; n < nmax; n += REDUCTION_LANES)
+        for (int l = 0; l < REDUCTION_LANES; ++l)
+            sum[l] += (double)ptr[n + l];
+    for (size_t n = nmax; n < last; ++n)
+        sum[0] += (double)ptr[n];
+    for (int l = 0; l < REDUCTION_LANES; ++l)
+        result.sum += sum[l];
+}
+
+/** Dot product kernel */
+template<typename T>
+void reduceDot(const ReductionData<T, ReductionSum> &d, size_t first, size_t last, ReductionSum &result)
+{
+    const T * __restrict__ ptrx = d.x;
+    const T * __restrict__ ptry = d.y;
+    double sum[REDUCTION_LANES] = {};
+    size_t nmax = first + REDUCTION_LANES * ((last - first) / REDUCTION_LANES);
+    for (size_t n = first; n < nmax; n += REDUCTION_LANES)
+        for (int l = 0; l < REDUCTION_LANES; ++l)
+            sum[l] += (double)ptrx[n + l] * (double)ptry[n + l];
+    for (size_t n = nmax; n < last; ++n)
+        sum[0] += (double)ptrx[n] * (double)ptry[n];
+    for (int l = 0; l < REDUCTION_LANES; ++l)
+        result.sum += sum[l];
+}
+
+/** Minimum and maximum kernel */
+template<typename T>
+void reduceMinMax(const ReductionData<T, ReductionMinMax<T> > &d, size_t first, size_t last, ReductionMinMax<T> &result)
+{
+    if (first >= last)
+        return;
+    const T * __restrict__ ptr = d.x;
+    T minval[REDUCTION_LANES], maxval[REDUCTION_LANES];
+    for (int l = 0; l < REDUCTION_LANES; ++l)
+        minval[l] = maxval[l] = ptr[first];
+    size_t nmax = first + REDUCTION_LANES * ((last - first) / REDUCTION_LANES);
+    for (size_t n = first; n < nmax; n += REDUCTION_LANES)
+        for (int l = 0; l < REDUCTION_LANES; ++l)
+        {
+            T val = ptr[n + l];
+            minval[l] = (val < minval[l]) ? val : minval[l];
+            maxval[l] = (val > maxval[l]) ? val : maxval[l];
+        }
+    for (size_t n = nmax; n < last; ++n)
+    {
+        T val = ptr[n];
+        minval[0] = (val < minval[0]) ? val : minval[0];
+        maxval[0] = (val > maxval[0]) ? val : maxval[0];
+    }
+    ReductionMinMax<T> b;
+    b.N = last - first;
+    b.minval = minval[0];
+    b.maxval = maxval[0];
+    for (int l = 1; l < REDUCTION_LANES; ++l)
+    {
+        b.minval = (minval[l] < b.minval) ? minval[l] : b.minval;
+        b.maxval = (maxval[l] > b.maxval) ? maxval[l] : b.maxval;
+    }
+    result.merge(b);
+}
+
+/** Statistics kernel.
+ * If a mask is given, only the values where it is not 0 are used.
+ */
+template<typename T>
+void reduceStats(const ReductionData<T, ReductionStats<T> > &d, size_t first, size_t last, ReductionStats<T> &result)
+{
+    const T * __restrict__ ptr = d.x;
+    const int * __restrict__ mask = d.mask;
+    for (size_t first0 = first; first0 < last; first0 += REDUCTION_BLOCK)
+    {
+        size_t last0 = std::min(first0 + REDUCTION_BLOCK, last);
+        size_t nmax = first0 + REDUCTION_LANES * ((last0 - first0) / REDUCTION_LANES);
+        double sum[REDUCTION_LANES] = {}, m2[REDUCTION_LANES] = {};
+        size_t count[REDUCTION_LANES] = {};
+        T minval[REDUCTION_LANES], maxval[REDUCTION_LANES];
+        ReductionStats<T> b;
+        if (mask == NULL)
+        {
+            for (int l = 0; l < REDUCTION_LANES; ++l)
+                minval[l] = maxval[l] = ptr[first0];
+            for (size_t n = first0; n < nmax; n += REDUCTION_LANES)
+                for (int l = 0; l < REDUCTION_LANES; ++l)
+                {
+                    T val = ptr[n + l];
+                    sum[l] += (double)val;
+                    minval[l] = (val < minval[l]) ? val : minval[l];
+                    maxval[l] = (val > maxval[l]) ? val : maxval[l];
+                }
+            for (size_t n = nmax; n < last0; ++n)
+            {
+                T val = ptr[n];
+                sum[0] += (double)val;
+                minval[0] = (val < minval[0]) ? val : minval[0];
+                maxval[0] = (val > maxval[0]) ? val : maxval[0];
+            }
+            b.N = last0 - first0;
+        }
+        else
+        {
+            for (int l = 0; l < REDUCTION_LANES; ++l)
+            {
+                minval[l] = std::numeric_limits<T>::max();
+                maxval[l] = std::numeric_limits<T>::lowest();
+            }
+            for (size_t n = first0; n < nmax; n += REDUCTION_LANES)
+                for (int l = 0; l < REDUCTION_LANES; ++l)
+                {
+                    T val = ptr[n + l];
+                    bool in = mask[n + l] != 0;
+                    count[l] += in;
+                    sum[l] += in ? (double)val : 0.0;
+                    minval[l] = (in && val < minval[l]) ? val : minval[l];
+                    maxval[l] = (in && val > maxval[l]) ? val : maxval[l];
+                }
+            for (size_t n = nmax; n < last0; ++n)
+            {
+                T val = ptr[n];
+                bool in = mask[n] != 0;
+                count[0] += in;
+                sum[0] += in ? (double)val : 0.0;
+                minval[0] = (in && val < minval[0]) ? val : minval[0];
+                maxval[0] = (in && val > maxval[0]) ? val : maxval[0];
+            }
+            for (int l = 0; l < REDUCTION_LANES; ++l)
+                b.N += count[l];
+            if (b.N == 0)
+                continue;
+        }
+
+        double total = 0;
+        b.minval = minval[0];
+        b.maxval = maxval[0];
+        for (int l = 0; l < REDUCTION_LANES; ++l)
+        {
+            total += sum[l];
+            b.minval = (minval[l] < b.minval) ? minval[l] : b.minval;
+            b.maxval = (maxval[l] > b.maxval) ? maxval[l] : b.maxval;
+        }
+        b.avg = total / b.N;
+
+        // Second pass on the block, already in cache
+        double avg = b.avg;
+        if (mask == NULL)
+        {
+            for (size_t n = first0; n < nmax; n += REDUCTION_LANES)
+                for (int l = 0; l < REDUCTION_LANES; ++l)
+                {
+                    double diff = (double)ptr[n + l] - avg;
+                    m2[l] += diff * diff;
+                }
+            for (size_t n = nmax; n < last0; ++n)
+            {
+                double diff = (double)ptr[n] - avg;
+                m2[0] += diff * diff;
+            }
+        }
+        else
+        {
+            for (size_t n = first0; n < nmax; n += REDUCTION_LANES)
+                for (int l = 0; l < REDUCTION_LANES; ++l)
+                {
+                    double diff = (mask[n + l] != 0) ? (double)ptr[n + l] - avg : 0.0;
+                    m2[l] += diff * diff;
+                }
+            for (size_t n = nmax; n < last0; ++n)
+            {
+                double diff = (mask[n] != 0) ? (double)ptr[n] - avg : 0.0;
+                m2[0] += diff * diff;
+            }
+        }
+        for (int l = 0; l < REDUCTION_LANES; ++l)
+            b.m2 += m2[l];
+        result.merge(b);
+    }
+}
+
+/** Covariance kernel */
+template<typename T>
+void reduceCovariance(const ReductionData<T, ReductionCovariance> &d, size_t first, size_t last, ReductionCovariance &result)
+{
+    const T * __restrict__ ptrx = d.x;
+    const T * __restrict__ ptry = d.y;
+    for (size_t first0 = first; first0 < last; first0 += REDUCTION_BLOCK)
+    {
+        size_t last0 = std::min(first0 + REDUCTION_BLOCK, last);
+        size_t nmax = first0 + REDUCTION_LANES * ((last0 - first0) / REDUCTION_LANES);
+        double sumx[REDUCTION_LANES] = {}, sumy[REDUCTION_LANES] = {};
+        for (size_t n = first0; n < nmax; n += REDUCTION_LANES)
+            for (int l = 0; l < REDUCTION_LANES; ++l)
+            {
+                sumx[l] += (double)ptrx[n + l];
+                sumy[l] += (double)ptry[n + l];
+            }
+        for (size_t n = nmax; n < last0; ++n)
+        {
+            sumx[0] += (double)ptrx[n];
+            sumy[0] += (double)ptry[n];
+        }
+
+        ReductionCovariance b;
+        b.N = last0 - first0;
+        for (int l = 0; l < REDUCTION_LANES; ++l)
+        {
+            b.avgx += sumx[l];
+            b.avgy += sumy[l];
+        }
+        b.avgx /= b.N;
+        b.avgy /= b.N;
+
+        // Second pass on the block, already in cache
+        double avgx = b.avgx, avgy = b.avgy;
+        double m2x[REDUCTION_LANES] = {}, m2y[REDUCTION_LANES] = {}, cxy[REDUCTION_LANES] = {};
+        for (size_t n = first0; n < nmax; n += REDUCTION_LANES)
+            for (int l = 0; l < REDUCTION_LANES; ++l)
+            {
+                double diffx = (double)ptrx[n + l] - avgx;
+                double diffy = (double)ptry[n + l] - avgy;
+                m2x[l] += diffx * diffx;
+                m2y[l] += diffy * diffy;
+                cxy[l] += diffx * diffy;
+            }
+        for (size_t n = nmax; n < last0; ++n)
+        {
+            double diffx = (double)ptrx[n] - avgx;
+            double diffy = (double)ptry[n] - avgy;
+            m2x[0] += diffx * diffx;
+            m2y[0] += diffy * diffy;
+            cxy[0] += diffx * diffy;
+        }
+        for (int l = 0; l < REDUCTION_LANES; ++l)
+        {
+            b.m2x += m2x[l];
+            b.m2y += m2y[l];
+            b.cxy += cxy[l];
+        }
+        result.merge(b);
+    }
+}
+
+/** Thread function of runReduction */
+template<typename T, typename R>
+void threadReduction(ThreadArgument &thArg)
+{
+    ReductionData<T, R> &d = *((ReductionData<T, R> *) thArg.data);
+    d.kernel(d, d.N * thArg.thread_id / thArg.threads,
+             d.N * (thArg.thread_id + 1) / thArg.threads,
+             d.partial[thArg.thread_id]);
+}
+
+/** Run a reduction.
+ * The result of the kernel is merged into result, in threads if the
+ * reduction is large enough.
+ */
+template<typename T, typename R>
+void runReduction(ReductionData<T, R> &d, R &result)
+{
+    int nThreads = getReductionThreads();
+    if (nThreads > 1 && d.N >= REDUCTION_THREAD_MIN_SIZE)
+    {
+        d.partial.assign(nThreads, R());
+        ThreadManager thMgr(nThreads);
+        thMgr.run(threadReduction<T, R>, &d);
+        for (int t = 0; t < nThreads; ++t)
+            result.merge(d.partial[t]);
+    }
+    else
+        d.kernel(d, 0, d.N, result);
+}
+//@}
+
+/** @name Selection kernels
+ *
+ * Percentiles found by selection (std::nth_element, an introselect) in
+ * linear expected time, instead of sorting all the values.
+ */
+//@{
+/** Percentiles of a set of values.
+ *
+ * The np percentages in p (from 0 to 100) are looked for among the N
+ * values, which are reordered in the process. Each percentile is
+ * interpolated linearly between the two closest values, so that the 50%
+ * percentile is the median. The percentiles are returned in result,
+ * in the same order as p.
+ */
+template<typename T>
+void selectPercentiles(T* values, size_t N, const double* p, size_t np, double* result)
+{
+    std::vector< std::pair<double, size_t> > order(np);
+    for (size_t i = 0; i < np; ++i)
+    {
+        if (p[i] < 0 || p[i] > 100)
+            REPORT_ERROR(ERR_VALUE_INCORRECT, formatString("Percentile %f out of [0,100]", p[i]));
+        order[i] = std::make_pair(p[i], i);
+    }
+    if (N == 0)
+    {
+        for (size_t i = 0; i < np; ++i)
+            result[i] = 0;
+        return;
+    }
+
+    // In increasing order, each selection only looks at the values not
+    // smaller than the previous one
+    std::sort(order.begin(), order.end());
+    size_t first = 0;
+    for (size_t i = 0; i < np; ++i)
+    {
+        double h = order[i].first / 100 * (N - 1);
+        size_t k = std::min((size_t)h, N - 1);
+        std::nth_element(values + first, values + k, values + N);
+        first = k;
+
+        double val = values[k];
+        double frac = h - k;
+        if (frac > 0 && k + 1 < N)
+        {
+            double next = *std::min_element(values + k + 1, values + N);
+            val += frac * (next - val);
+        }
+        result[order[i].second] = val;
+    }
+}
+//@}
+
 template<typename T>
 class MultidimArray: public MultidimArrayBase
 {
@@ -1252,6 +1748,21 @@ public:
         *this = V;
     }
 
+    /** Constructor from a lazy expression.
+     *
+     * The expression is evaluated in a single pass (see lazy()).
+     *
+     * @code
+     * MultidimArray< double > V3(lazy(V1) * V2 + 1.0);
+     * @endcode
+     */
+    template<typename E>
+    MultidimArray(const MultidimArrayExpr<T, E>& expr)
+    {
+        coreInit();
+        *this = expr;
+    }
+
     /** Copy constructor from a Matrix1D.
      * The Size constructor creates an array with memory associated,
      * and fills it with zeros.
@@ -1341,6 +1852,19 @@ public:
      *
      */
     void coreAllocate()
+    {
+        coreAllocateUninitialized();
+        memset(data,0,nzyxdim*sizeof(T));
+    }
+
+    /** Core allocate without initializing the values.
+     *
+     * Same as coreAllocate(), but the values are left uninitialized. Use it
+     * for arrays that are going to be completely overwritten.
+     * The memory is aligned to XMIPP_MEMORY_ALIGNMENT bytes and recycled
+     * through the memory pool of the thread (see askAlignedMemory).
+     */
+    void coreAllocateUninitialized()
     {
         if(data!=NULL)
             REPORT_ERROR(ERR_MEM_NOTDEALLOC, "do not allocate space for an image if you have not deallocate it first");
@@ -1349,22 +1873,13 @@ public:
             mFd = mmapFile(data, nzyxdim);
         else
         {
-            try
-            {
-                data = new T [nzyxdim];
-                if (data == NULL)
-                {
-                    setMmap(true);
-                    mFd = mmapFile(data, nzyxdim);
-                }
-            }
-            catch (std::bad_alloc &)
+            data = (T*) askAlignedMemory(nzyxdim*sizeof(T));
+            if (data == NULL)
             {
                 setMmap(true);
                 mFd = mmapFile(data, nzyxdim);
             }
         }
-        memset(data,0,nzyxdim*sizeof(T));
         nzyxdimAlloc = nzyxdim;
     }
 
@@ -1385,7 +1900,7 @@ public:
             mFd = mmapFile(data, nzyxdim);
         else
         {
-            data = new T [nzyxdim];
+            data = (T*) askAlignedMemory(nzyxdim*sizeof(T));
             if (data == NULL)
                 REPORT_ERROR(ERR_MEM_NOTENOUGH, "Allocate: No space left");
         }
@@ -1436,7 +1951,7 @@ public:
 
             }
             else
-                delete[] data;
+                freeAlignedMemory(data, nzyxdimAlloc*sizeof(T));
         }
         data = NULL;
         destroyData = true;
@@ -1521,6 +2036,121 @@ public:
         this->destroyData = false;
     }
 
+    /** View of the whole array.
+     *
+     * See MultidimArrayView. The data is not copied, so the array should
+     * not be resized while the view is in use.
+     */
+    MultidimArrayView<T> view() const
+    {
+        return MultidimArrayView<T>(*this);
+    }
+
+    /** View of an image (or volume) in a stack.
+     *
+     * Select_image starts at 0 towards Nsize.
+     *
+     * @code
+     * MultidimArrayView<double> I = stack.viewImage(3);
+     * I.computeStats(avg, stddev, minval, maxval);
+     * @endcode
+     */
+    MultidimArrayView<T> viewImage(size_t select_image) const
+    {
+        if (select_image >= NSIZE(*this))
+            REPORT_ERROR(ERR_INDEX_OUTOFBOUNDS, "viewImage: Selected image cannot be higher than N size.");
+        MultidimArrayView<T> v(*this);
+        v.data += select_image * v.nstride;
+        v.ndim = 1;
+        return v;
+    }
+
+    /** View of a box of a volume.
+     *
+     * The box goes from the logical position (z0, y0, x0) to (zF, yF, xF),
+     * both included, as in window, and it must be inside the volume. The
+     * view keeps the logical indexes of the array. The box is taken from
+     * the n-th volume of the stack.
+     *
+     * @code
+     * // Box around a particle, without copying it
+     * MultidimArrayView<double> box = V.viewBox(z - r, y - r, x - r, z + r, y + r, x + r);
+     * @endcode
+     */
+    MultidimArrayView<T> viewBox(int z0, int y0, int x0, int zF, int yF, int xF, size_t n = 0) const
+    {
+        if (z0 < STARTINGZ(*this) || zF > FINISHINGZ(*this) || z0 > zF ||
+            y0 < STARTINGY(*this) || yF > FINISHINGY(*this) || y0 > yF ||
+            x0 < STARTINGX(*this) || xF > FINISHINGX(*this) || x0 > xF)
+            REPORT_ERROR(ERR_INDEX_OUTOFBOUNDS, "viewBox: The box must be inside the array.");
+        MultidimArrayView<T> v = viewImage(n);
+        v.data += (z0 - STARTINGZ(*this)) * v.zstride + (y0 - STARTINGY(*this)) * v.ystride +
+                  (x0 - STARTINGX(*this));
+        v.zdim = zF - z0 + 1;
+        v.ydim = yF - y0 + 1;
+        v.xdim = xF - x0 + 1;
+        v.zinit = z0;
+        v.yinit = y0;
+        v.xinit = x0;
+        return v;
+    }
+
+    /** View of a box of an image.
+     *
+     * As the 3D version, for the rectangle from (y0, x0) to (yF, xF).
+     */
+    MultidimArrayView<T> viewBox(int y0, int x0, int yF, int xF, size_t n = 0) const
+    {
+        return viewBox(STARTINGZ(*this), y0, x0, FINISHINGZ(*this), yF, xF, n);
+    }
+
+    /** View of a slice of a volume.
+     *
+     * The slice k (logical index) perpendicular to the given axis of the
+     * n-th volume. As in getSlice, a 'Y' slice has the Z axis along its
+     * rows and the X axis along its columns, and an 'X' slice has the Y axis
+     * along its rows and the Z axis along its columns.
+     *
+     * @code
+     * MultidimArrayView<double> S = V.viewSlice(0, 'X');
+     * @endcode
+     */
+    MultidimArrayView<T> viewSlice(int k, char axis = 'Z', size_t n = 0) const
+    {
+        MultidimArrayView<T> v = viewImage(n);
+        size_t zstride = v.zstride;
+        switch (axis)
+        {
+        case 'Z':
+            if (k < STARTINGZ(*this) || k > FINISHINGZ(*this))
+                REPORT_ERROR(ERR_INDEX_OUTOFBOUNDS, "viewSlice: Multidim subscript (k) out of range");
+            v.data += (k - STARTINGZ(*this)) * zstride;
+            break;
+        case 'Y':
+            if (k < STARTINGY(*this) || k > FINISHINGY(*this))
+                REPORT_ERROR(ERR_INDEX_OUTOFBOUNDS, "viewSlice: Multidim subscript (i) out of range");
+            v.data += (k - STARTINGY(*this)) * v.ystride;
+            v.ydim = ZSIZE(*this);
+            v.ystride = zstride;
+            v.yinit = STARTINGZ(*this);
+            break;
+        case 'X':
+            if (k < STARTINGX(*this) || k > FINISHINGX(*this))
+                REPORT_ERROR(ERR_INDEX_OUTOFBOUNDS, "viewSlice: Multidim subscript (j) out of range");
+            v.data += (k - STARTINGX(*this));
+            v.xdim = ZSIZE(*this);
+            v.xstride = zstride;
+            v.xinit = STARTINGZ(*this);
+            break;
+        default:
+            REPORT_ERROR(ERR_VALUE_INCORRECT,
+                         formatString("viewSlice: not supported axis %c", axis));
+        }
+        v.zdim = 1;
+        v.zinit = 0;
+        return v;
+    }
+
 
 
     //@}
@@ -1548,19 +2178,52 @@ public:
      */
     void resize(size_t Ndim, size_t Zdim, size_t Ydim, size_t Xdim, bool copy=true)
     {
-        if (Ndim*Zdim*Ydim*Xdim == nzyxdimAlloc && data != NULL)
-        {
-            ndim = Ndim;
-            xdim = Xdim;
-            ydim = Ydim;
-            zdim = Zdim;
-            yxdim = Ydim * Xdim;
-            zyxdim = Zdim * yxdim;
-            nzyxdim = Ndim * zyxdim;
-            return;
-        }
-        else if (!destroyData)
-            REPORT_ERROR(ERR_MULTIDIM_SIZE, "Cannot resize array when accessing through alias.");
+        resizeData(Ndim, Zdim, Ydim, Xdim, copy, true);
+    }
+
+    /** Resize without initializing the values.
+     *
+     * Like resizeNoCopy, but if new memory is needed its values are left
+     * uninitialized instead of set to 0. Use it for arrays that are going
+     * to be completely overwritten.
+     */
+    void resizeUninitialized(size_t Ndim, size_t Zdim, size_t Ydim, size_t Xdim)
+    {
+        resizeData(Ndim, Zdim, Ydim, Xdim, false, false);
+    }
+
+    /** Resize according to a pattern without initializing the values.
+     */
+    template<typename T1>
+    void resizeUninitialized(const MultidimArray<T1> &v)
+    {
+        if (NSIZE(*this) != NSIZE(v) || XSIZE(*this) != XSIZE(v) ||
+            YSIZE(*this) != YSIZE(v) || ZSIZE(*this) != ZSIZE(v) || data==NULL)
+            resizeData(NSIZE(v), ZSIZE(v), YSIZE(v), XSIZE(v), false, false);
+
+        STARTINGX(*this) = STARTINGX(v);
+        STARTINGY(*this) = STARTINGY(v);
+        STARTINGZ(*this) = STARTINGZ(v);
+    }
+
+    /** Resize, copying the old values if copy is set.
+     * New values are set to 0 if zero is set, otherwise left uninitialized.
+     */
+    void resizeData(size_t Ndim, size_t Zdim, size_t Ydim, size_t Xdim, bool copy, bool zero)
+    {
+        if (Ndim*Zdim*Ydim*Xdim == nzyxdimAlloc && data != NULL)
+        {
+            ndim = Ndim;
+            xdim = Xdim;
+            ydim = Ydim;
+            zdim = Zdim;
+            yxdim = Ydim * Xdim;
+            zyxdim = Zdim * yxdim;
+            nzyxdim = Ndim * zyxdim;
+            return;
+        }
+        else if (!destroyData)
+            REPORT_ERROR(ERR_MULTIDIM_SIZE, "Cannot resize array when accessing through alias.");
 
         if (Xdim <= 0 || Ydim <= 0 || Zdim <= 0 || Ndim <= 0)
         {
@@ -1581,7 +2244,10 @@ public:
             zyxdim = Zdim * yxdim;
             nzyxdim = Ndim * zyxdim;
 
-            coreAllocate();
+            if (zero)
+                coreAllocate();
+            else
+                coreAllocateUninitialized();
             return;
         }
 
@@ -1597,17 +2263,19 @@ public:
         {
             if (mmapOn)
                 new_mFd = mmapFile(new_data, NZYXdim);
-            else
-                new_data = new T [NZYXdim];
+            else if ((new_data = (T*) askAlignedMemory(NZYXdim*sizeof(T))) == NULL)
+                throw std::bad_alloc();
 
-            memset(new_data,0,NZYXdim*sizeof(T));
+            // With copy all the values are written below
+            if (zero && !copy)
+                memset(new_data,0,NZYXdim*sizeof(T));
         }
         catch (std::bad_alloc &)
         {
             if (!mmapOn)
             {
                 setMmap(true);
-                resize(Ndim, Zdim, Ydim, Xdim, copy);
+                resizeData(Ndim, Zdim, Ydim, Xdim, copy, zero);
                 return;
             }
             else
@@ -1909,7 +2577,7 @@ public:
     }
 
     /** Make a patch with the input array in the given positions */
-    void patch(MultidimArray<T> patchArray, int x, int y)
+    void patch(const MultidimArray<T> &patchArray, int x, int y)
     {
         int n = XSIZE(patchArray)*sizeof(T);
 
@@ -3112,15 +3780,10 @@ public:
         if (NZYXSIZE(*this) <= 0)
             return static_cast< T >(0);
 
-        T maxval = data[0];
-
-        T* ptr=NULL;
-        size_t n;
-        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY_ptr(*this,n,ptr)
-        if (*ptr > maxval)
-            maxval = *ptr;
-
-        return maxval;
+        ReductionMinMax<T> result;
+        ReductionData<T, ReductionMinMax<T> > d(data, NZYXSIZE(*this), reduceMinMax<T>);
+        runReduction(d, result);
+        return result.maxval;
     }
 
     /** 1D Indices for the maximum element.
@@ -3143,15 +3806,10 @@ public:
         if (NZYXSIZE(*this) <= 0)
             return static_cast< T >(0);
 
-        T minval = data[0];
-
-        T* ptr=NULL;
-        size_t n;
-        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY_ptr(*this,n,ptr)
-        if (*ptr < minval)
-            minval = *ptr;
-
-        return minval;
+        ReductionMinMax<T> result;
+        ReductionData<T, ReductionMinMax<T> > d(data, NZYXSIZE(*this), reduceMinMax<T>);
+        runReduction(d, result);
+        return result.minval;
     }
 
     /** 4D Indices for the minimum element.
@@ -3263,25 +3921,16 @@ public:
         if (NZYXSIZE(*this) <= 0)
             return;
 
-        T* ptr=NULL;
-        size_t n;
-        T Tmin=DIRECT_MULTIDIM_ELEM(*this,0);
-        T Tmax=Tmin;
-        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY_ptr(*this,n,ptr)
-        {
-            T val=*ptr;
-            if (val < Tmin)
-                Tmin = val;
-            else if (val > Tmax)
-                Tmax = val;
-        }
-        minval = static_cast< double >(Tmin);
-        maxval = static_cast< double >(Tmax);
+        ReductionMinMax<T> result;
+        ReductionData<T, ReductionMinMax<T> > d(data, NZYXSIZE(*this), reduceMinMax<T>);
+        runReduction(d, result);
+        minval = static_cast< double >(result.minval);
+        maxval = static_cast< double >(result.maxval);
     }
 
     /** Minimum and maximum of the values in the array.
      *
-     * As doubles.
+     * As doubles. Only the elements from offset to size-1 are considered.
      */
     void computeDoubleMinMaxRange(double& minval, double& maxval,size_t offset, size_t size) const
     {
@@ -3289,19 +3938,14 @@ public:
             return;
 
         minval = maxval = static_cast< double >(data[offset]);
+        if (size <= offset)
+            return;
 
-        T* ptr=NULL;
-        T val;
-        size_t n;
-
-        for (n=offset,ptr=data+offset; n<size; ++n, ++ptr)
-        {
-            val = *ptr;
-            if (val < minval)
-                minval = static_cast< double >(val);
-            else if (val > maxval)
-                maxval = static_cast< double >(val);
-        }
+        ReductionMinMax<T> result;
+        ReductionData<T, ReductionMinMax<T> > d(data + offset, size - offset, reduceMinMax<T>);
+        runReduction(d, result);
+        minval = static_cast< double >(result.minval);
+        maxval = static_cast< double >(result.maxval);
     }
 
     /** Average of the values in the array.
@@ -3314,14 +3958,10 @@ public:
         if (NZYXSIZE(*this) <= 0)
             return 0;
 
-        double sum = 0;
-
-        T* ptr=NULL;
-        size_t n;
-        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY_ptr(*this,n,ptr)
-        sum += static_cast< double >(*ptr);
-
-        return sum / NZYXSIZE(*this);
+        ReductionSum result;
+        ReductionData<T, ReductionSum> d(data, NZYXSIZE(*this), reduceSum<T>);
+        runReduction(d, result);
+        return result.sum / NZYXSIZE(*this);
     }
 
     /** Standard deviation of the values in the array.
@@ -3335,25 +3975,10 @@ public:
         if (NZYXSIZE(*this) <= 1)
             return 0;
 
-        double avg = 0, stddev = 0;
-
-        T* ptr=NULL;
-        size_t n;
-        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY_ptr(*this,n,ptr)
-        {
-            double val=static_cast< double >(*ptr);
-            avg += val;
-            stddev += val * val;
-        }
-
-        avg /= NZYXSIZE(*this);
-        stddev = stddev / NZYXSIZE(*this) - avg * avg;
-        stddev *= NZYXSIZE(*this) / (NZYXSIZE(*this) - 1);
-
-        // Foreseeing numerical instabilities
-        stddev = sqrt(static_cast<double>((ABS(stddev))));
-
-        return stddev;
+        ReductionStats<T> result;
+        ReductionData<T, ReductionStats<T> > d(data, NZYXSIZE(*this), reduceStats<T>);
+        runReduction(d, result);
+        return sqrt(result.m2 / result.N);
     }
 
     /** Compute statistics.
@@ -3366,38 +3991,14 @@ public:
         if (NZYXSIZE(*this) <= 0)
             return;
 
-        avg = 0;
-        stddev = 0;
-
-        minval = maxval = data[0];
-
-        T* ptr=NULL;
-        size_t n;
-        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY_ptr(*this,n,ptr)
-        {
-            T Tval=*ptr;
-            double val=Tval;
-            avg += val;
-            stddev += val * val;
-
-            if (Tval > maxval)
-                maxval = Tval;
-            else if (Tval < minval)
-                minval = Tval;
-        }
-
-        avg /= NZYXSIZE(*this);
-
-        if (NZYXSIZE(*this) > 1)
-        {
-            stddev = stddev / NZYXSIZE(*this) - avg * avg;
-            stddev *= NZYXSIZE(*this) / (NZYXSIZE(*this) - 1);
+        ReductionStats<T> result;
+        ReductionData<T, ReductionStats<T> > d(data, NZYXSIZE(*this), reduceStats<T>);
+        runReduction(d, result);
 
-            // Foreseeing numerical instabilities
-            stddev = sqrt(static_cast< double >(ABS(stddev)));
-        }
-        else
-            stddev = 0;
+        avg = result.avg;
+        stddev = (result.N > 1) ? sqrt(result.m2 / result.N) : 0;
+        minval = result.minval;
+        maxval = result.maxval;
     }
 
     /** Compute statistics.
@@ -3414,28 +4015,12 @@ public:
         if (NZYXSIZE(*this) <= 0)
             return;
 
-        avg = 0;
-        stddev = 0;
+        ReductionStats<T> result;
+        ReductionData<T, ReductionStats<T> > d(data, NZYXSIZE(*this), reduceStats<T>);
+        runReduction(d, result);
 
-        for (size_t n = 0; n < nzyxdim; ++n)
-        {
-            U v = (U)data[n];
-            avg += v;
-            stddev += v * v;
-        }
-
-        avg /= NZYXSIZE(*this);
-
-        if (NZYXSIZE(*this) > 1)
-        {
-            stddev = stddev / NZYXSIZE(*this) - avg * avg;
-            stddev *= NZYXSIZE(*this) / (NZYXSIZE(*this) - 1);
-
-            // Foreseeing numerical instabilities
-            stddev = sqrt(fabs(stddev));
-        }
-        else
-            stddev = 0;
+        avg = (U)result.avg;
+        stddev = (result.N > 1) ? (U)sqrt(result.m2 / result.N) : 0;
     }
 
     /** Compute statistics in the active area
@@ -3446,28 +4031,69 @@ public:
     void computeAvgStdev_within_binary_mask(const MultidimArray< int >& mask,
                                             double& avg, double& stddev) const
     {
-        SPEED_UP_tempsInt;
-        double sum1 = 0;
-        double sum2 = 0;
-        int N = 0;
+        T minval, maxval;
+        computeStats_within_binary_mask(mask, avg, stddev, minval, maxval);
+    }
 
-        FOR_ALL_ELEMENTS_IN_COMMON_IN_ARRAY3D(mask, *this)
+    /** Compute statistics in the active area
+     *
+     * Average, standard deviation, minimum and maximum of the values where
+     * the mask is not 0, in a single pass. Only the overlapping between the
+     * mask and the first volume of the array is considered. The minimum and
+     * maximum are not set if the mask is empty.
+     */
+    void computeStats_within_binary_mask(const MultidimArray< int >& mask,
+                                         double& avg, double& stddev,
+                                         T& minval, T& maxval) const
+    {
+        ReductionStats<T> result;
+        if (XSIZE(mask) == XSIZE(*this) && YSIZE(mask) == YSIZE(*this) &&
+            ZSIZE(mask) == ZSIZE(*this) && STARTINGX(mask) == STARTINGX(*this) &&
+            STARTINGY(mask) == STARTINGY(*this) && STARTINGZ(mask) == STARTINGZ(*this))
         {
-            if (A3D_ELEM(mask, k, i, j) != 0)
+            ReductionData<T, ReductionStats<T> > d(data, ZYXSIZE(*this), reduceStats<T>,
+                                                   NULL, MULTIDIM_ARRAY(mask));
+            runReduction(d, result);
+        }
+        else
+        {
+            SPEED_UP_tempsInt;
+            double sum1 = 0;
+            double sum2 = 0;
+
+            FOR_ALL_ELEMENTS_IN_COMMON_IN_ARRAY3D(mask, *this)
             {
-                ++N;
-                double aux=A3D_ELEM(*this, k, i, j);
-                sum1 += aux;
-                sum2 += aux*aux;
+                if (A3D_ELEM(mask, k, i, j) != 0)
+                {
+                    T val = A3D_ELEM(*this, k, i, j);
+                    if (result.N == 0 || val < result.minval)
+                        result.minval = val;
+                    if (result.N == 0 || val > result.maxval)
+                        result.maxval = val;
+                    ++result.N;
+                    double aux = val;
+                    sum1 += aux;
+                    sum2 += aux*aux;
+                }
+            }
+            if (result.N > 0)
+            {
+                result.avg = sum1 / result.N;
+                result.m2 = fabs(sum2 - result.N * result.avg * result.avg);
             }
         }
 
         // average and standard deviation
-        avg  = sum1 / (double) N;
-        if (N > 1)
-            stddev = sqrt(fabs(sum2 / N - avg * avg) * N / (N - 1));
+        avg = result.avg;
+        if (result.N > 1)
+            stddev = sqrt(result.m2 / (result.N - 1));
         else
             stddev = 0;
+        if (result.N > 0)
+        {
+            minval = result.minval;
+            maxval = result.maxval;
+        }
     }
 
     /** Compute statistics within 2D region of 2D image.
@@ -3522,26 +4148,149 @@ public:
      */
     double computeMedian() const
     {
-        if (XSIZE(*this) == 0)
-            return 0;
+        return computePercentile(50);
+    }
 
-        if (XSIZE(*this) == 1)
-            return DIRECT_MULTIDIM_ELEM(*this,0);
+    /** Percentile
+     *
+     * Value below which the given percentage (0 to 100) of the elements
+     * is found, interpolating linearly between the two closest elements.
+     * The 50% percentile is the median. It is found by selection, in
+     * linear time.
+     *
+     * @code
+     * double p95 = v1.computePercentile(95);
+     * @endcode
+     */
+    double computePercentile(double p) const
+    {
+        std::vector<T> values(data, data + NZYXSIZE(*this));
+        double result;
+        selectPercentiles(values.data(), values.size(), &p, 1, &result);
+        return result;
+    }
 
-        // Initialise data
-        MultidimArray< double > temp(*this);
+    /** Several percentiles
+     *
+     * As computePercentile, for all the percentages in p with a single copy
+     * of the array.
+     *
+     * @code
+     * std::vector<double> p, range;
+     * p.push_back(2.5);
+     * p.push_back(97.5);
+     * v1.computePercentiles(p, range);
+     * @endcode
+     */
+    void computePercentiles(const std::vector<double> &p, std::vector<double> &result) const
+    {
+        std::vector<T> values(data, data + NZYXSIZE(*this));
+        result.resize(p.size());
+        selectPercentiles(values.data(), values.size(), p.data(), p.size(), result.data());
+    }
 
-        // Sort indexes
-        double* temp_array = MULTIDIM_ARRAY(temp)-1;
-        qcksrt(NZYXSIZE(*this), temp_array); //FIXME: Valgrind:: Invalid read of size 8: qcksrt(int, double*) (numerical_recipes.cpp:266)
+    /** Median in the active area
+     *
+     * Median of the values where the mask is not 0. Only the overlapping
+     * between the mask and the first volume of the array is considered.
+     */
+    double computeMedian_within_binary_mask(const MultidimArray< int >& mask) const
+    {
+        return computePercentile_within_binary_mask(mask, 50);
+    }
 
+    /** Percentile in the active area
+     *
+     * As computePercentile, for the values where the mask is not 0. Only
+     * the overlapping between the mask and the first volume of the array is
+     * considered.
+     */
+    double computePercentile_within_binary_mask(const MultidimArray< int >& mask, double p) const
+    {
+        std::vector<T> values;
+        if (XSIZE(mask) == XSIZE(*this) && YSIZE(mask) == YSIZE(*this) &&
+            ZSIZE(mask) == ZSIZE(*this) && STARTINGX(mask) == STARTINGX(*this) &&
+            STARTINGY(mask) == STARTINGY(*this) && STARTINGZ(mask) == STARTINGZ(*this))
+        {
+            const int * ptrMask = MULTIDIM_ARRAY(mask);
+            for (size_t n = 0; n < ZYXSIZE(*this); ++n)
+                if (ptrMask[n] != 0)
+                    values.push_back(data[n]);
+        }
+        else
+        {
+            SPEED_UP_tempsInt;
+            FOR_ALL_ELEMENTS_IN_COMMON_IN_ARRAY3D(mask, *this)
+            if (A3D_ELEM(mask, k, i, j) != 0)
+                values.push_back(A3D_ELEM(*this, k, i, j));
+        }
+        double result;
+        selectPercentiles(values.data(), values.size(), &p, 1, &result);
+        return result;
+    }
+
+    /** Median of each image
+     *
+     * The median of each of the NSIZE images (or volumes) of the array is
+     * returned in result. Large stacks are processed with the threads set
+     * with setReductionThreads.
+     */
+    void computeMedianPerImage(MultidimArray< double > &result) const
+    {
+        computePercentilePerImage(50, result);
+    }
 
-        // Get median
-        if (NZYXSIZE(*this)%2==0)
-            return 0.5*(DIRECT_MULTIDIM_ELEM(temp,NZYXSIZE(*this)/2-1)+
-                        DIRECT_MULTIDIM_ELEM(temp,NZYXSIZE(*this)/2  ));
+    /** Percentile of each image
+     *
+     * As computePercentile, for each of the NSIZE images (or volumes) of the
+     * array. Large stacks are processed with the threads set with
+     * setReductionThreads.
+     */
+    void computePercentilePerImage(double p, MultidimArray< double > &result) const
+    {
+        result.resizeNoCopy(NSIZE(*this));
+        PercentilePerImageData d;
+        d.array = this;
+        d.p = p;
+        d.result = MULTIDIM_ARRAY(result);
+        int nThreads = std::min(getReductionThreads(), (int)NSIZE(*this));
+        if (nThreads > 1 && NZYXSIZE(*this) >= REDUCTION_THREAD_MIN_SIZE)
+        {
+            ThreadManager thMgr(nThreads);
+            thMgr.run(threadPercentilePerImage, &d);
+        }
         else
-            return DIRECT_MULTIDIM_ELEM(temp,NZYXSIZE(*this)/2);
+            percentilePerImage(d, 0, NSIZE(*this));
+    }
+
+    /** Arguments of computePercentilePerImage */
+    struct PercentilePerImageData
+    {
+        const MultidimArray<T> * array;
+        double p;
+        double * result;
+    };
+
+    /** Percentile of the images from first to last-1 */
+    static void percentilePerImage(const PercentilePerImageData &d, size_t first, size_t last)
+    {
+        size_t imgSize = ZYXSIZE(*d.array);
+        std::vector<T> values(imgSize);
+        for (size_t n = first; n < last; ++n)
+        {
+            const T * ptr = MULTIDIM_ARRAY(*d.array) + n * imgSize;
+            std::copy(ptr, ptr + imgSize, values.begin());
+            selectPercentiles(values.data(), imgSize, &d.p, 1, d.result + n);
+        }
+    }
+
+    /** Thread function of computePercentilePerImage */
+    static void threadPercentilePerImage(ThreadArgument &thArg)
+    {
+        const PercentilePerImageData &d = *((PercentilePerImageData *) thArg.data);
+        size_t Ndim = NSIZE(*d.array);
+        percentilePerImage(d, Ndim * thArg.thread_id / thArg.threads,
+                           Ndim * (thArg.thread_id + 1) / thArg.threads);
     }
 
     /** Adjust the range of the array to a given one.
@@ -3892,7 +4641,7 @@ public:
             REPORT_ERROR(ERR_MULTIDIM_SIZE,
                          formatString("Array_by_array: different shapes (%c)", operation));
         if (result.data == NULL || !result.sameShape(op1))
-            result.resizeNoCopy(op1);
+            result.resizeUninitialized(op1);
         coreArrayByArray(op1, op2, result, operation);
     }
     /** Self Array by array
@@ -3982,24 +4731,10 @@ public:
     {
         if (!sameShape(op1))
             REPORT_ERROR(ERR_MULTIDIM_SIZE,"The two arrays for dot product are not of the same shape");
-        double dot=0;
-        size_t n;
-        T* ptrOp1=NULL;
-        T* ptrOp2=NULL;
-        const size_t unroll=4;
-        size_t nmax=unroll*(MULTIDIM_SIZE(*this)/unroll);
-        for (n=0, ptrOp1=data,ptrOp2=op1.data;
-             n<nmax; n+=unroll, ptrOp1+=unroll, ptrOp2+=unroll)
-        {
-            dot += *ptrOp1 * *ptrOp2;
-            dot += *(ptrOp1+1) * *(ptrOp2+1);
-            dot += *(ptrOp1+2) * *(ptrOp2+2);
-            dot += *(ptrOp1+3) * *(ptrOp2+3);
-        }
-        for (n=nmax, ptrOp1=data+nmax, ptrOp2=op1.data+nmax;
-             n<MULTIDIM_SIZE(*this); ++n, ++ptrOp1, ++ptrOp2)
-            dot += *ptrOp1 * *ptrOp2;
-        return dot;
+        ReductionSum result;
+        ReductionData<T, ReductionSum> d(data, MULTIDIM_SIZE(*this), reduceDot<T>, op1.data);
+        runReduction(d, result);
+        return result.sum;
     }
     //@}
 
@@ -4075,7 +4810,7 @@ public:
                                      char operation)
     {
         if (result.data == NULL || !result.sameShape(op1))
-            result.resizeNoCopy(op1);
+            result.resizeUninitialized(op1);
         coreArrayByScalar(op1, op2, result, operation);
     }
 
@@ -4299,7 +5034,7 @@ public:
     void initZeros(const MultidimArray<T1>& op)
     {
         if (data == NULL || !sameShape(op))
-            resizeNoCopy(op);
+            resizeUninitialized(op);
         memset(data,0,nzyxdim*sizeof(T));
     }
 
@@ -4322,7 +5057,7 @@ public:
     inline void initZeros(size_t Ndim, size_t Zdim, size_t Ydim, size_t Xdim)
     {
         if (xdim!=Xdim || ydim!=Ydim || zdim!=Zdim || ndim!=Ndim)
-            resize(Ndim, Zdim,Ydim,Xdim,false);
+            resizeUninitialized(Ndim, Zdim,Ydim,Xdim);
         memset(data,0,nzyxdim*sizeof(T));
     }
 
@@ -5032,7 +5767,7 @@ public:
         if (!v1.sameShape(v2))
             REPORT_ERROR(ERR_MULTIDIM_SIZE, "MAX: arrays of different shape");
 
-        result.resizeNoCopy(v1);
+        result.resizeUninitialized(v1);
         FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(result)
         DIRECT_MULTIDIM_ELEM(result,n) = XMIPP_MAX(
                                              DIRECT_MULTIDIM_ELEM(v1,n),
@@ -5051,7 +5786,7 @@ public:
         if (!v1.sameShape(v2))
             REPORT_ERROR(ERR_MULTIDIM_SIZE, "MIN: arrays of different shape");
 
-        result.resizeNoCopy(v1);
+        result.resizeUninitialized(v1);
         FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(result)
         DIRECT_MULTIDIM_ELEM(result,n) = XMIPP_MIN(
                                              DIRECT_MULTIDIM_ELEM(v1,n),
@@ -5346,12 +6081,91 @@ public:
         if (&op1 != this)
         {
             if (data == NULL || !sameShape(op1))
-                resizeNoCopy(op1);
+                resizeUninitialized(op1);
             memcpy(data,op1.data,MULTIDIM_SIZE(op1)*sizeof(T));
         }
         return *this;
     }
 
+    /** Assignment of a lazy expression.
+     *
+     * All the element-wise operations of the expression are done in a
+     * single loop, without temporary arrays (see lazy()). The array may
+     * appear itself in the expression.
+     *
+     * @code
+     * v1 = lazy(v2) * v3 + lazy(v4) * v5;
+     * @endcode
+     */
+    template<typename E>
+    MultidimArray<T>& operator=(const MultidimArrayExpr<T, E>& expr)
+    {
+        const E &e = expr.derived();
+        const MultidimArray<T> &pattern = *e.shape();
+        if (data == NULL || !sameShape(pattern))
+            resizeUninitialized(pattern);
+        T* ptr = data;
+        for (size_t n = 0; n < nzyxdim; ++n)
+            ptr[n] = e[n];
+        return *this;
+    }
+
+    /** v1 += lazy expression, in a single pass.
+     */
+    template<typename E>
+    void operator+=(const MultidimArrayExpr<T, E>& expr)
+    {
+        const E &e = expr.derived();
+        checkExprShape(*e.shape());
+        T* ptr = data;
+        for (size_t n = 0; n < nzyxdim; ++n)
+            ptr[n] += e[n];
+    }
+
+    /** v1 -= lazy expression, in a single pass.
+     */
+    template<typename E>
+    void operator-=(const MultidimArrayExpr<T, E>& expr)
+    {
+        const E &e = expr.derived();
+        checkExprShape(*e.shape());
+        T* ptr = data;
+        for (size_t n = 0; n < nzyxdim; ++n)
+            ptr[n] -= e[n];
+    }
+
+    /** v1 *= lazy expression, in a single pass.
+     */
+    template<typename E>
+    void operator*=(const MultidimArrayExpr<T, E>& expr)
+    {
+        const E &e = expr.derived();
+        checkExprShape(*e.shape());
+        T* ptr = data;
+        for (size_t n = 0; n < nzyxdim; ++n)
+            ptr[n] *= e[n];
+    }
+
+    /** v1 /= lazy expression, in a single pass.
+     */
+    template<typename E>
+    void operator/=(const MultidimArrayExpr<T, E>& expr)
+    {
+        const E &e = expr.derived();
+        checkExprShape(*e.shape());
+        T* ptr = data;
+        for (size_t n = 0; n < nzyxdim; ++n)
+            ptr[n] /= e[n];
+    }
+
+    /** Check that a lazy expression can be operated with this array.
+     */
+    void checkExprShape(const MultidimArray<T> &pattern) const
+    {
+        if (!sameShape(pattern))
+            REPORT_ERROR(ERR_MULTIDIM_SIZE, "Lazy expression: arrays of different shapes");
+    }
+
     /** Assignment.
      *
      * You can build as complex assignment expressions as you like. Multiple
@@ -5441,6 +6255,547 @@ public:
 
 
 
+/** @name Lazy expressions
+ *
+ * Element-wise arithmetic on MultidimArrays without temporaries. Wrapping
+ * an array with lazy() makes +, -, * and / build an expression instead of
+ * computing a new array. The expression is evaluated in a single loop when
+ * it is assigned to (or operated with +=, -=, *=, /= on) a MultidimArray.
+ * Arrays and scalars of the same type T can be mixed with the expressions.
+ * Operations between plain MultidimArrays keep computing their result
+ * immediately.
+ *
+ * @code
+ * MultidimArray<double> a, b, c, d, e;
+ * a = lazy(b) * c + lazy(d) * e; // One pass over memory, no temporaries
+ * a += 2.0 * lazy(b) - c;
+ * @endcode
+ *
+ * Expressions keep references to their arrays, so they must be evaluated
+ * before any of them is destroyed or resized.
+ */
+//@{
+/** Base class of the lazy expressions.
+ * E is the actual expression class (curiously recurring template).
+ */
+template<typename T, typename E>
+class MultidimArrayExpr
+{
+public:
+    typedef T Scalar;
+
+    /** The actual expression */
+    const E& derived() const
+    {
+        return static_cast<const E&>(*this);
+    }
+};
+
+/** Lazy expression of an array */
+template<typename T>
+class MultidimArrayTerm: public MultidimArrayExpr<T, MultidimArrayTerm<T> >
+{
+    const MultidimArray<T> * array;
+    const T * ptr;
+public:
+    explicit MultidimArrayTerm(const MultidimArray<T> &v): array(&v), ptr(MULTIDIM_ARRAY(v))
+    {}
+
+    T operator[](size_t n) const
+    {
+        return ptr[n];
+    }
+
+    /** Array giving the shape of the expression, NULL if none */
+    const MultidimArray<T> * shape() const
+    {
+        return array;
+    }
+};
+
+/** Lazy expression of a scalar */
+template<typename T>
+class MultidimArrayConstant: public MultidimArrayExpr<T, MultidimArrayConstant<T> >
+{
+    T value;
+public:
+    explicit MultidimArrayConstant(const T &v): value(v)
+    {}
+
+    T operator[](size_t) const
+    {
+        return value;
+    }
+
+    const MultidimArray<T> * shape() const
+    {
+        return NULL;
+    }
+};
+
+/** Lazy element-wise operation between two expressions */
+template<typename T, typename L, typename R, typename Op>
+class MultidimArrayBinaryExpr: public MultidimArrayExpr<T, MultidimArrayBinaryExpr<T, L, R, Op> >
+{
+    L left;
+    R right;
+    const MultidimArray<T> * pattern;
+public:
+    MultidimArrayBinaryExpr(const L &l, const R &r): left(l), right(r)
+    {
+        const MultidimArray<T> * shapeL = l.shape();
+        const MultidimArray<T> * shapeR = r.shape();
+        if (shapeL != NULL && shapeR != NULL && !shapeL->sameShape(*shapeR))
+            REPORT_ERROR(ERR_MULTIDIM_SIZE, "Lazy expression: arrays of different shapes");
+        pattern = (shapeL != NULL) ? shapeL : shapeR;
+    }
+
+    T operator[](size_t n) const
+    {
+        return Op::apply(left[n], right[n]);
+    }
+
+    const MultidimArray<T> * shape() const
+    {
+        return pattern;
+    }
+};
+
+/** Lazy element-wise negation of an expression */
+template<typename T, typename A>
+class MultidimArrayNegExpr: public MultidimArrayExpr<T, MultidimArrayNegExpr<T, A> >
+{
+    A arg;
+public:
+    explicit MultidimArrayNegExpr(const A &a): arg(a)
+    {}
+
+    T operator[](size_t n) const
+    {
+        return -arg[n];
+    }
+
+    const MultidimArray<T> * shape() const
+    {
+        return arg.shape();
+    }
+};
+
+/** Element-wise operations of the lazy expressions */
+struct MultidimArrayAddOp
+{
+    template<typename T>
+    static T apply(const T &a, const T &b)
+    {
+        return a + b;
+    }
+};
+struct MultidimArraySubOp
+{
+    template<typename T>
+    static T apply(const T &a, const T &b)
+    {
+        return a - b;
+    }
+};
+struct MultidimArrayMulOp
+{
+    template<typename T>
+    static T apply(const T &a, const T &b)
+    {
+        return a * b;
+    }
+};
+struct MultidimArrayDivOp
+{
+    template<typename T>
+    static T apply(const T &a, const T &b)
+    {
+        return a / b;
+    }
+};
+
+/** Start a lazy expression with an array.
+ *
+ * @code
+ * v1 = lazy(v2) + v3 * lazy(v4);
+ * @endcode
+ */
+template<typename T>
+MultidimArrayTerm<T> lazy(const MultidimArray<T> &v)
+{
+    return MultidimArrayTerm<T>(v);
+}
+
+/* Operators of the lazy expressions with other expressions, arrays and scalars */
+#define MULTIDIM_ARRAY_EXPR_OPERATOR(OP, OPCLASS) \
+template<typename T, typename E1, typename E2> \
+MultidimArrayBinaryExpr<T, E1, E2, OPCLASS> \
+operator OP(const MultidimArrayExpr<T, E1> &a, const MultidimArrayExpr<T, E2> &b) \
+{ \
+    return MultidimArrayBinaryExpr<T, E1, E2, OPCLASS>(a.derived(), b.derived()); \
+} \
+template<typename T, typename E> \
+MultidimArrayBinaryExpr<T, E, MultidimArrayTerm<T>, OPCLASS> \
+operator OP(const MultidimArrayExpr<T, E> &a, const MultidimArray<T> &b) \
+{ \
+    return MultidimArrayBinaryExpr<T, E, MultidimArrayTerm<T>, OPCLASS>(a.derived(), MultidimArrayTerm<T>(b)); \
+} \
+template<typename T, typename E> \
+MultidimArrayBinaryExpr<T, MultidimArrayTerm<T>, E, OPCLASS> \
+operator OP(const MultidimArray<T> &a, const MultidimArrayExpr<T, E> &b) \
+{ \
+    return MultidimArrayBinaryExpr<T, MultidimArrayTerm<T>, E, OPCLASS>(MultidimArrayTerm<T>(a), b.derived()); \
+} \
+template<typename T, typename E> \
+MultidimArrayBinaryExpr<T, E, MultidimArrayConstant<T>, OPCLASS> \
+operator OP(const MultidimArrayExpr<T, E> &a, const typename MultidimArrayExpr<T, E>::Scalar &b) \
+{ \
+    return MultidimArrayBinaryExpr<T, E, MultidimArrayConstant<T>, OPCLASS>(a.derived(), MultidimArrayConstant<T>(b)); \
+} \
+template<typename T, typename E> \
+MultidimArrayBinaryExpr<T, MultidimArrayConstant<T>, E, OPCLASS> \
+operator OP(const typename MultidimArrayExpr<T, E>::Scalar &a, const MultidimArrayExpr<T, E> &b) \
+{ \
+    return MultidimArrayBinaryExpr<T, MultidimArrayConstant<T>, E, OPCLASS>(MultidimArrayConstant<T>(a), b.derived()); \
+}
+
+MULTIDIM_ARRAY_EXPR_OPERATOR(+, MultidimArrayAddOp)
+MULTIDIM_ARRAY_EXPR_OPERATOR(-, MultidimArraySubOp)
+MULTIDIM_ARRAY_EXPR_OPERATOR(*, MultidimArrayMulOp)
+MULTIDIM_ARRAY_EXPR_OPERATOR(/, MultidimArrayDivOp)
+#undef MULTIDIM_ARRAY_EXPR_OPERATOR
+
+/** Negation of a lazy expression */
+template<typename T, typename E>
+MultidimArrayNegExpr<T, E> operator-(const MultidimArrayExpr<T, E> &a)
+{
+    return MultidimArrayNegExpr<T, E>(a.derived());
+}
+//@}
+
+/** Access to an element of a view with physical indexes */
+#define DIRECT_VIEW_ELEM(v, n, k, i, j) \
+    ((v).data[(n) * (v).nstride + (k) * (v).zstride + (i) * (v).ystride + (j) * (v).xstride])
+
+/** For all the elements of a view.
+ * n, k, i and j are the physical indexes of each element.
+ */
+#define FOR_ALL_ELEMENTS_IN_VIEW(v) \
+    for (size_t n = 0; n < (v).ndim; ++n) \
+        for (size_t k = 0; k < (v).zdim; ++k) \
+            for (size_t i = 0; i < (v).ydim; ++i) \
+                for (size_t j = 0; j < (v).xdim; ++j)
+
+/** Non-owning strided view of a MultidimArray.
+ *
+ * A view gives access to a part of a MultidimArray (a box, a slice along
+ * any axis, an image in a stack) without copying it. Each dimension has its
+ * own stride, in elements. Views are obtained with MultidimArray::view,
+ * viewImage, viewBox and viewSlice; they must not be used after the array
+ * is resized or destroyed. Views of a const array can modify its values,
+ * as the alias functions do.
+ *
+ * The values of a view can be read and written element by element, copied
+ * into a MultidimArray (whose memory is reused from call to call), operated
+ * element-wise with scalars and arrays, and its statistics computed.
+ *
+ * @code
+ * MultidimArray<double> box;
+ * for (size_t p = 0; p < particles.size(); ++p)
+ * {
+ *     MultidimArrayView<double> v = micrograph.viewBox(y[p] - r, x[p] - r, y[p] + r, x[p] + r);
+ *     v.computeAvgStdev(avg, stddev);
+ *     v.copyTo(box); // No allocation after the first box
+ * }
+ * @endcode
+ */
+template<typename T>
+class MultidimArrayView
+{
+public:
+    /// First element of the view
+    T * data;
+    /// Number of elements in each dimension
+    size_t ndim, zdim, ydim, xdim;
+    /// Distance in elements between consecutive elements of each dimension
+    size_t nstride, zstride, ystride, xstride;
+    /// Logical origin
+    int zinit, yinit, xinit;
+
+public:
+    /** Empty view */
+    MultidimArrayView(): data(NULL), ndim(0), zdim(0), ydim(0), xdim(0),
+            nstride(0), zstride(0), ystride(0), xstride(1), zinit(0), yinit(0), xinit(0)
+    {}
+
+    /** View of a whole array */
+    explicit MultidimArrayView(const MultidimArray<T> &v)
+    {
+        data = MULTIDIM_ARRAY(v);
+        ndim = NSIZE(v);
+        zdim = ZSIZE(v);
+        ydim = YSIZE(v);
+        xdim = XSIZE(v);
+        xstride = 1;
+        ystride = XSIZE(v);
+        zstride = YXSIZE(v);
+        nstride = ZYXSIZE(v);
+        zinit = STARTINGZ(v);
+        yinit = STARTINGY(v);
+        xinit = STARTINGX(v);
+    }
+
+    /** Number of elements of the view */
+    size_t size() const
+    {
+        return ndim * zdim * ydim * xdim;
+    }
+
+    /** True if the elements of the view are consecutive in memory */
+    bool isContiguous() const
+    {
+        return (xstride == 1 || xdim <= 1) &&
+               (ystride == xdim || ydim <= 1) &&
+               (zstride == ydim * xdim || zdim <= 1) &&
+               (nstride == zdim * ydim * xdim || ndim <= 1);
+    }
+
+    /** Same sizes in all dimensions */
+    template<typename T1>
+    bool sameShape(const MultidimArray<T1> &v) const
+    {
+        return ndim == NSIZE(v) && zdim == ZSIZE(v) && ydim == YSIZE(v) && xdim == XSIZE(v);
+    }
+
+    /** Element access with physical indexes */
+    T& directElem(size_t n, size_t k, size_t i, size_t j) const
+    {
+        return DIRECT_VIEW_ELEM(*this, n, k, i, j);
+    }
+
+    /** Volume element access with logical indexes (first volume) */
+    T& operator()(int k, int i, int j) const
+    {
+        return directElem(0, k - zinit, i - yinit, j - xinit);
+    }
+
+    /** Image element access with logical indexes (first image) */
+    T& operator()(int i, int j) const
+    {
+        return directElem(0, 0, i - yinit, j - xinit);
+    }
+
+    /** Copy the view into an array.
+     *
+     * The array is only resized if its shape is different, so copying
+     * views of the same size does not allocate memory. The logical origin
+     * of the view is kept.
+     */
+    template<typename T1>
+    void copyTo(MultidimArray<T1> &result) const
+    {
+        if (!sameShape(result))
+            result.resizeNoCopy(ndim, zdim, ydim, xdim);
+        T1 * ptrDest = MULTIDIM_ARRAY(result);
+        for (size_t n = 0; n < ndim; ++n)
+            for (size_t k = 0; k < zdim; ++k)
+                for (size_t i = 0; i < ydim; ++i, ptrDest += xdim)
+                {
+                    const T * ptr = &directElem(n, k, i, 0);
+                    if (xstride == 1)
+                        castPixelsRow(ptr, ptrDest);
+                    else
+                        for (size_t j = 0; j < xdim; ++j)
+                            ptrDest[j] = (T1) ptr[j * xstride];
+                }
+        STARTINGZ(result) = zinit;
+        STARTINGY(result) = yinit;
+        STARTINGX(result) = xinit;
+    }
+
+    /** Copy the values of an array of the same shape into the view */
+    template<typename T1>
+    void copyFrom(const MultidimArray<T1> &v) const
+    {
+        checkShape(v);
+        const T1 * ptrSrc = MULTIDIM_ARRAY(v);
+        FOR_ALL_ELEMENTS_IN_VIEW(*this)
+        DIRECT_VIEW_ELEM(*this, n, k, i, j) = (T) *ptrSrc++;
+    }
+
+    /** Set all the values of the view */
+    void initConstant(T val) const
+    {
+        FOR_ALL_ELEMENTS_IN_VIEW(*this)
+        DIRECT_VIEW_ELEM(*this, n, k, i, j) = val;
+    }
+
+    /** View += scalar */
+    void operator+=(T val) const
+    {
+        FOR_ALL_ELEMENTS_IN_VIEW(*this)
+        DIRECT_VIEW_ELEM(*this, n, k, i, j) += val;
+    }
+
+    /** View -= scalar */
+    void operator-=(T val) const
+    {
+        FOR_ALL_ELEMENTS_IN_VIEW(*this)
+        DIRECT_VIEW_ELEM(*this, n, k, i, j) -= val;
+    }
+
+    /** View *= scalar */
+    void operator*=(T val) const
+    {
+        FOR_ALL_ELEMENTS_IN_VIEW(*this)
+        DIRECT_VIEW_ELEM(*this, n, k, i, j) *= val;
+    }
+
+    /** View /= scalar */
+    void operator/=(T val) const
+    {
+        FOR_ALL_ELEMENTS_IN_VIEW(*this)
+        DIRECT_VIEW_ELEM(*this, n, k, i, j) /= val;
+    }
+
+    /** View += array of the same shape */
+    void operator+=(const MultidimArray<T> &v) const
+    {
+        checkShape(v);
+        const T * ptrSrc = MULTIDIM_ARRAY(v);
+        FOR_ALL_ELEMENTS_IN_VIEW(*this)
+        DIRECT_VIEW_ELEM(*this, n, k, i, j) += *ptrSrc++;
+    }
+
+    /** View -= array of the same shape */
+    void operator-=(const MultidimArray<T> &v) const
+    {
+        checkShape(v);
+        const T * ptrSrc = MULTIDIM_ARRAY(v);
+        FOR_ALL_ELEMENTS_IN_VIEW(*this)
+        DIRECT_VIEW_ELEM(*this, n, k, i, j) -= *ptrSrc++;
+    }
+
+    /** View *= array of the same shape */
+    void operator*=(const MultidimArray<T> &v) const
+    {
+        checkShape(v);
+        const T * ptrSrc = MULTIDIM_ARRAY(v);
+        FOR_ALL_ELEMENTS_IN_VIEW(*this)
+        DIRECT_VIEW_ELEM(*this, n, k, i, j) *= *ptrSrc++;
+    }
+
+    /** View /= array of the same shape */
+    void operator/=(const MultidimArray<T> &v) const
+    {
+        checkShape(v);
+        const T * ptrSrc = MULTIDIM_ARRAY(v);
+        FOR_ALL_ELEMENTS_IN_VIEW(*this)
+        DIRECT_VIEW_ELEM(*this, n, k, i, j) /= *ptrSrc++;
+    }
+
+    /** Average of the values of the view */
+    double computeAvg() const
+    {
+        size_t N = size();
+        if (N == 0)
+            return 0;
+        ReductionSum result;
+        reduceRows(reduceSum<T>, result);
+        return result.sum / N;
+    }
+
+    /** Minimum and maximum of the values of the view, as doubles */
+    void computeDoubleMinMax(double& minval, double& maxval) const
+    {
+        if (size() == 0)
+            return;
+        ReductionMinMax<T> result;
+        reduceRows(reduceMinMax<T>, result);
+        minval = static_cast< double >(result.minval);
+        maxval = static_cast< double >(result.maxval);
+    }
+
+    /** Statistics of the view, as MultidimArray::computeStats */
+    void computeStats(double& avg, double& stddev, T& minval, T& maxval) const
+    {
+        if (size() == 0)
+            return;
+        ReductionStats<T> result;
+        reduceRows(reduceStats<T>, result);
+        avg = result.avg;
+        stddev = (result.N > 1) ? sqrt(result.m2 / result.N) : 0;
+        minval = result.minval;
+        maxval = result.maxval;
+    }
+
+    /** Average and standard deviation of the view, as
+     * MultidimArray::computeAvgStdev
+     */
+    template<typename U>
+    void computeAvgStdev(U& avg, U& stddev) const
+    {
+        if (size() == 0)
+            return;
+        ReductionStats<T> result;
+        reduceRows(reduceStats<T>, result);
+        avg = (U)result.avg;
+        stddev = (result.N > 1) ? (U)sqrt(result.m2 / result.N) : 0;
+    }
+
+private:
+    /** Check that an array has the shape of the view */
+    template<typename T1>
+    void checkShape(const MultidimArray<T1> &v) const
+    {
+        if (!sameShape(v))
+            REPORT_ERROR(ERR_MULTIDIM_SIZE, "MultidimArrayView: the array and the view have different shapes");
+    }
+
+    /** Copy a row with consecutive elements */
+    template<typename T1>
+    void castPixelsRow(const T * ptr, T1 * ptrDest) const
+    {
+        for (size_t j = 0; j < xdim; ++j)
+            ptrDest[j] = (T1) ptr[j];
+    }
+
+    void castPixelsRow(const T * ptr, T * ptrDest) const
+    {
+        memcpy(ptrDest, ptr, xdim * sizeof(T));
+    }
+
+    /** Run a reduction kernel row by row.
+     * Rows whose elements are not consecutive are gathered first.
+     */
+    template<typename R>
+    void reduceRows(void (*kernel)(const ReductionData<T, R> &, size_t, size_t, R &), R &result) const
+    {
+        if (isContiguous())
+        {
+            ReductionData<T, R> d(data, size(), kernel);
+            runReduction(d, result);
+            return;
+        }
+        std::vector<T> row(xstride == 1 ? 0 : xdim);
+        for (size_t n = 0; n < ndim; ++n)
+            for (size_t k = 0; k < zdim; ++k)
+                for (size_t i = 0; i < ydim; ++i)
+                {
+                    const T * ptr = &directElem(n, k, i, 0);
+                    if (xstride != 1)
+                    {
+                        for (size_t j = 0; j < xdim; ++j)
+                            row[j] = ptr[j * xstride];
+                        ptr = row.data();
+                    }
+                    ReductionData<T, R> d(ptr, xdim, kernel);
+                    kernel(d, 0, xdim, result);
+                }
+    }
+};
+
 /// @name Functions for all multidimensional arrays
 /// @{
 
@@ -5689,6 +7044,25 @@ double correlationIndex(const MultidimArray< T >& x,
 
     long N = 0;
 
+    // Means, deviations and covariance in a single reduction. Stacks keep
+    // the loops below: their means and deviations cover all the images
+    // but the covariance only the first one.
+    if (mask == NULL && Contributions == NULL && NSIZE(x) == 1 && x.sameShape(y))
+    {
+        ReductionCovariance result;
+        ReductionData<T, ReductionCovariance> d(MULTIDIM_ARRAY(x), MULTIDIM_SIZE(x),
+                                                reduceCovariance<T>, MULTIDIM_ARRAY(y));
+        runReduction(d, result);
+        if (result.N <= 1)
+            return 0;
+        stddev_x = sqrt(result.m2x / result.N);
+        stddev_y = sqrt(result.m2y / result.N);
+        if (ABS(stddev_x)<XMIPP_EQUAL_ACCURACY ||
+            ABS(stddev_y)<XMIPP_EQUAL_ACCURACY)
+            return 0;
+        return result.cxy / ((stddev_x * stddev_y) * result.N);
+    }
+
     if (mask == NULL)
     {
         x.computeAvgStdev(mean_x, stddev_x);
@@ -5725,25 +7099,15 @@ double correlationIndex(const MultidimArray< T >& x,
     }
     else
     {
-        if (mask==NULL && x.sameShape(y))
-        {
-            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(x)
-                retval += DIRECT_MULTIDIM_ELEM(x, n)*DIRECT_MULTIDIM_ELEM(y, n);
-            N=MULTIDIM_SIZE(x);
-            retval-=N*mean_x*mean_y;
-        }
-        else
+        FOR_ALL_ELEMENTS_IN_COMMON_IN_ARRAY3D(x, y)
         {
-            FOR_ALL_ELEMENTS_IN_COMMON_IN_ARRAY3D(x, y)
-            {
-                if (mask != NULL)
-                    if (!A3D_ELEM(*mask,k, i, j))
-                        continue;
+            if (mask != NULL)
+                if (!A3D_ELEM(*mask,k, i, j))
+                    continue;
 
-                retval += (A3D_ELEM(x, k, i, j) - mean_x) *
-                          (A3D_ELEM(y, k, i, j) - mean_y);
-                ++N;
-            }
+            retval += (A3D_ELEM(x, k, i, j) - mean_x) *
+                      (A3D_ELEM(y, k, i, j) - mean_y);
+            ++N;
         }
     }
 
@@ -5776,6 +7140,16 @@ template<>
 void MultidimArray< std::complex< double > >::getReal(MultidimArray<double> & realImg) const;
 template<>
 void MultidimArray< std::complex< double > >::getImag(MultidimArray<double> & imagImg) const;
+template<>
+void MultidimArray< std::complex< float > >::computeDoubleMinMax(double& minval, double& maxval) const;
+template<>
+void MultidimArray< std::complex< float > >::computeDoubleMinMaxRange(double& minval, double& maxval, size_t pos, size_t size) const;
+template<>
+void MultidimArray< std::complex< float > >::rangeAdjust(std::complex< float > minF, std::complex< float > maxF);
+template<>
+double MultidimArray< std::complex< float > >::computeAvg() const;
+template<>
+void MultidimArray< std::complex< float > >::maxIndex(size_t &lmax, int& kmax, int& imax, int& jmax) const;
 
 //@}
 #endif
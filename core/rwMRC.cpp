@@ -87,7 +87,7 @@ struct MRChead
     int nx;              //  0   0       image size
     int ny;              //  1   4
     int nz;              //  2   8
-    int mode;            //  3           0=char,1=short,2=float,6=uint16
+    int mode;            //  3           0=char,1=short,2=float,6=uint16,12=half
     int nxStart;         //  4           unit cell offset
     int nyStart;         //  5
     int nzStart;         //  6
@@ -214,6 +214,9 @@ int ImageBase::readMRC(size_t select_img, bool isStack)
     case 6:
         datatype = DT_UShort;
         break;
+    case 12:
+        datatype = DT_HalfFloat;
+        break;
     case 101:
         datatype = DT_UHalfByte;
         break;
@@ -388,6 +391,9 @@ int ImageBase::writeMRC(size_t select_img, bool isStack, int mode, const String
         case DT_Short:
             header->mode = 1;
             break;
+        case DT_HalfFloat:
+            header->mode = 12;
+            break;
         case DT_CFloat:
         case DT_CDouble:
             header->mode = 4;
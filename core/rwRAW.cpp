@@ -44,6 +44,8 @@ DataType ImageBase::datatypeRAW(String strDT)
         datatype = DT_Int;
     else if (strDT=="long")
         datatype = DT_Long;
+    else if (strDT=="half")
+        datatype = DT_HalfFloat;
     else if (strDT=="float")
         datatype = DT_Float;
     else if (strDT=="double")
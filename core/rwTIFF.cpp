@@ -24,6 +24,92 @@
  ***************************************************************************/
 
 #include "xmipp_image_base.h"
+#include <sys/stat.h>
+
+/* Maximum number of files whose directory index is kept */
+#define TIFF_DIR_INDEX_CACHE_SIZE 256
+
+std::map<String, ImageBase::TIFFDirIndex> ImageBase::tiffDirIndexCache;
+Mutex ImageBase::tiffDirIndexMutex;
+
+/* Walk all the directories of an open TIFF file */
+void ImageBase::scanTIFFDirectories(TIFF * tif, TIFFDirIndex &index)
+{
+    TIFFDirHead dhRef;
+
+    TIFFSetDirectory(tif, 0);
+    do
+    {
+        dhRef.imageSampleFormat = SAMPLEFORMAT_VOID;
+        if (TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE,  &dhRef.bitsPerSample) == 0)
+            REPORT_ERROR(ERR_IO_NOREAD,"rwTIFF: Error reading TIFFTAG_BITSPERSAMPLE");
+        if (TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL,&dhRef.samplesPerPixel) == 0)
+            dhRef.samplesPerPixel = 1;
+
+        if (TIFFGetField(tif, TIFFTAG_IMAGEWIDTH,     &dhRef.imageWidth) == 0)
+            REPORT_ERROR(ERR_IO_NOREAD,"rwTIFF: Error reading TIFFTAG_IMAGEWIDTH");
+        if (TIFFGetField(tif, TIFFTAG_IMAGELENGTH,    &dhRef.imageLength) == 0)
+            REPORT_ERROR(ERR_IO_NOREAD,"rwTIFF: Error reading TIFFTAG_IMAGELENGTH");
+        if (TIFFGetField(tif, TIFFTAG_SUBFILETYPE,    &dhRef.subFileType) == 0)
+            dhRef.subFileType = 0; // Some scanners does not provide this label. So, we set this to zero
+        TIFFGetField(tif, TIFFTAG_SAMPLEFORMAT,   &dhRef.imageSampleFormat);
+        TIFFGetField(tif, TIFFTAG_RESOLUTIONUNIT, &dhRef.resUnit);
+        TIFFGetField(tif, TIFFTAG_XRESOLUTION,    &dhRef.xTiffRes);
+        TIFFGetField(tif, TIFFTAG_YRESOLUTION,    &dhRef.yTiffRes);
+        TIFFGetField(tif, TIFFTAG_PAGENUMBER,     &dhRef.pNumber, &dhRef.pTotal);
+
+        if ((dhRef.subFileType & 0x00000001) != 0x00000001) //add image if not a thumbnail
+        {
+            index.dirHead.push_back(dhRef);
+            index.dirOffset.push_back(TIFFCurrentDirOffset(tif));
+        }
+    }
+    while(TIFFReadDirectory(tif));
+}
+
+/* Get the directory index of an open TIFF file, from the cache if the file did not change */
+void ImageBase::getTIFFDirIndex(TIFF * tif, const String &fileName, TIFFDirIndex &index)
+{
+    struct stat info;
+    bool statOk = (stat(fileName.c_str(), &info) == 0);
+
+    if (statOk)
+    {
+        tiffDirIndexMutex.lock();
+        std::map<String, TIFFDirIndex>::const_iterator it = tiffDirIndexCache.find(fileName);
+        bool found = (it != tiffDirIndexCache.end() && it->second.mtime == info.st_mtime &&
+                      it->second.mtimeNsec == info.st_mtim.tv_nsec && it->second.size == info.st_size);
+        if (found)
+            index = it->second;
+        tiffDirIndexMutex.unlock();
+        if (found)
+            return;
+    }
+
+    index.dirHead.clear();
+    index.dirOffset.clear();
+    scanTIFFDirectories(tif, index);
+
+    if (statOk)
+    {
+        index.mtime = info.st_mtime;
+        index.mtimeNsec = info.st_mtim.tv_nsec;
+        index.size = info.st_size;
+        tiffDirIndexMutex.lock();
+        if (tiffDirIndexCache.size() >= TIFF_DIR_INDEX_CACHE_SIZE)
+            tiffDirIndexCache.clear();
+        tiffDirIndexCache[fileName] = index;
+        tiffDirIndexMutex.unlock();
+    }
+}
+
+/* Forget the cached directory index of a file that is being written */
+void ImageBase::forgetTIFFDirIndex(const String &fileName)
+{
+    tiffDirIndexMutex.lock();
+    tiffDirIndexCache.erase(fileName);
+    tiffDirIndexMutex.unlock();
+}
 
 /**
  * castTiffTile2T
@@ -137,35 +223,11 @@ int ImageBase::readTIFF(size_t select_img, bool isStack)
     //    TIFFSetWarningHandler(NULL); // Switch off warning messages
 
     char*  tif_buf = NULL;
-    std::vector<TIFFDirHead> dirHead;
-    TIFFDirHead dhRef;
-
-    /* Get TIFF image properties */
-    do
-    {
-        dhRef.imageSampleFormat = SAMPLEFORMAT_VOID;
-        if (TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE,  &dhRef.bitsPerSample) == 0)
-            REPORT_ERROR(ERR_IO_NOREAD,"rwTIFF: Error reading TIFFTAG_BITSPERSAMPLE");
-        if (TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL,&dhRef.samplesPerPixel) == 0)
-            dhRef.samplesPerPixel = 1;
 
-        if (TIFFGetField(tif, TIFFTAG_IMAGEWIDTH,     &dhRef.imageWidth) == 0)
-            REPORT_ERROR(ERR_IO_NOREAD,"rwTIFF: Error reading TIFFTAG_IMAGEWIDTH");
-        if (TIFFGetField(tif, TIFFTAG_IMAGELENGTH,    &dhRef.imageLength) == 0)
-            REPORT_ERROR(ERR_IO_NOREAD,"rwTIFF: Error reading TIFFTAG_IMAGELENGTH");
-        if (TIFFGetField(tif, TIFFTAG_SUBFILETYPE,    &dhRef.subFileType) == 0)
-            dhRef.subFileType = 0; // Some scanners does not provide this label. So, we set this to zero
-        //            REPORT_ERROR(ERR_IO_NOREAD,"rwTIFF: Error reading TIFFTAG_SUBFILETYPE");
-        TIFFGetField(tif, TIFFTAG_SAMPLEFORMAT,   &dhRef.imageSampleFormat);
-        TIFFGetField(tif, TIFFTAG_RESOLUTIONUNIT, &dhRef.resUnit);
-        TIFFGetField(tif, TIFFTAG_XRESOLUTION,    &dhRef.xTiffRes);
-        TIFFGetField(tif, TIFFTAG_YRESOLUTION,    &dhRef.yTiffRes);
-        TIFFGetField(tif, TIFFTAG_PAGENUMBER,     &dhRef.pNumber, &dhRef.pTotal);
-
-        if ((dhRef.subFileType & 0x00000001) != 0x00000001) //add image if not a thumbnail
-            dirHead.push_back(dhRef);
-    }
-    while(TIFFReadDirectory(tif));
+    /* Get TIFF image properties, from the cached directory index when the file did not change */
+    TIFFDirIndex dirIndex;
+    getTIFFDirIndex(tif, dataFName, dirIndex);
+    std::vector<TIFFDirHead> &dirHead = dirIndex.dirHead;
 
     swap = TIFFIsByteSwapped(tif);
 
@@ -266,7 +328,8 @@ int ImageBase::readTIFF(size_t select_img, bool isStack)
 
     for (size_t i = imgStart; i < imgEnd; ++i)
     {
-        TIFFSetDirectory(tif,(tdir_t) i);
+        // Jump straight to the page directory, thumbnails are not counted in dirHead
+        TIFFSetSubDirectory(tif, dirIndex.dirOffset[i]);
 
         // If samplesPerPixel is higher than 3 it means there are extra samples, as associated alpha data
         // Greyscale images are usually samplesPerPixel=1
@@ -528,6 +591,7 @@ int ImageBase::writeTIFF(size_t select_img, bool isStack, int mode, String bitDe
     }
 
     _TIFFfree(tif_buf);
+    forgetTIFFDirIndex(dataFName);
     return(0);
 }
 //@}
@@ -52,6 +52,38 @@ struct TIFFDirHead
     }
 };
 
+/** TIFF directory index
+ * Header and directory offset of every page that is not a thumbnail,
+ * together with the modification time and size of the file it was built from.
+ */
+struct TIFFDirIndex
+{
+    time_t mtime;
+    long mtimeNsec;
+    off_t size;
+    std::vector<TIFFDirHead> dirHead;
+    std::vector<toff_t> dirOffset;
+};
+
+/** Directory indexes of the TIFF files already read, by file name */
+static std::map<String, TIFFDirIndex> tiffDirIndexCache;
+static Mutex tiffDirIndexMutex;
+
+/** Walk all the directories of an open TIFF file.
+  */
+static void scanTIFFDirectories(TIFF * tif, TIFFDirIndex &index);
+
+/** Get the directory index of an open TIFF file.
+  * The index is cached per file name and rebuilt when the file
+  * modification time or size change, so opening a file again
+  * does not scan all its directories.
+  */
+static void getTIFFDirIndex(TIFF * tif, const String &fileName, TIFFDirIndex &index);
+
+/** Forget the cached directory index of a file that has been written.
+  */
+static void forgetTIFFDirIndex(const String &fileName);
+
 /** castTiffTile2T
   * write the content of a tile from a TIFF file to an image array
   */
@@ -42,6 +42,7 @@ size_t gettypesize(DataType type)
         break;
     case DT_UShort:
     case DT_Short:
+    case DT_HalfFloat:
         size = sizeof(short);
         break;
     case DT_UInt:
@@ -101,6 +102,8 @@ DataType str2Datatype(const std::string & str)
         datatype = DT_Int;
     else if (str=="long")
         datatype = DT_Long;
+    else if (str=="half")
+        datatype = DT_HalfFloat;
     else if (str=="float")
         datatype = DT_Float;
     else if (str=="double")
@@ -142,6 +145,8 @@ std::string datatype2Str(DataType datatype)
         return "int32";
     case DT_Long:
         return "int64";
+    case DT_HalfFloat:
+        return "half";
     case DT_Float:
         return "float";
     case DT_Double:
@@ -189,6 +194,9 @@ std::string datatype2StrLong(DataType datatype)
     case DT_Long:
         return "Signed integer (4 or 8 byte, depending on system)";
         break;
+    case DT_HalfFloat:
+        return "Half precision floating point (2-byte)";
+        break;
     case DT_Float:
         return "Floating point (4-byte)";
         break;
@@ -27,6 +27,8 @@
 #define CORE_DATATYPE_H_
 
 #include <string>
+#include <cstring>
+#include <stdint.h>
 /** @defgroup Datatypes Datatypes for MultidimArrays
  *  @ingroup DataLibrary
 */
@@ -54,10 +56,72 @@ typedef enum
     DT_CDouble = 14,     // Complex floating point (16-byte)
     DT_Bool = 15,              // Boolean (1-byte?)
     DT_UHalfByte = 16,        // For 4-bit format (e.g. mrc 4bit file)
-    DT_LastEntry = 17          // This must be the last entry
+    DT_HalfFloat = 17,        // Half precision floating point (2-byte, e.g. mrc mode 12)
+    DT_LastEntry = 18          // This must be the last entry
 } DataType;
 
 
+/** Convert an IEEE 754 half precision value (DT_HalfFloat) to float.
+ * Subnormals, infinities and NaNs are preserved.
+ */
+inline float half2float(uint16_t h)
+{
+    const uint32_t shiftedExp = 0x7c00 << 13; // exponent mask after shift
+    uint32_t bits = (uint32_t)(h & 0x7fff) << 13;
+    uint32_t exp = bits & shiftedExp;
+    bits += (127 - 15) << 23; // exponent adjust
+    if (exp == shiftedExp) // Inf/NaN
+        bits += (128 - 16) << 23;
+    else if (exp == 0) // Zero/subnormal, renormalize through a float subtraction
+    {
+        const uint32_t magicBits = 113 << 23;
+        float f, magic;
+        bits += 1 << 23;
+        memcpy(&f, &bits, sizeof(float));
+        memcpy(&magic, &magicBits, sizeof(float));
+        f -= magic;
+        memcpy(&bits, &f, sizeof(float));
+    }
+    bits |= (uint32_t)(h & 0x8000) << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+}
+
+/** Convert a float to IEEE 754 half precision (DT_HalfFloat).
+ * Rounds to nearest even. Values out of range become infinity.
+ */
+inline uint16_t float2half(float f)
+{
+    const uint32_t f32Infty = 255 << 23;
+    const uint32_t f16Max = (127 + 16) << 23;
+    const uint32_t denormMagicBits = ((127 - 15) + (23 - 10) + 1) << 23;
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(float));
+    uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+    uint16_t h;
+    if (bits >= f16Max) // Overflow, Inf or NaN
+        h = (bits > f32Infty) ? 0x7e00 : 0x7c00;
+    else if (bits < (113 << 23)) // Subnormal or zero, let the float addition round
+    {
+        float denormMagic, a;
+        memcpy(&denormMagic, &denormMagicBits, sizeof(float));
+        memcpy(&a, &bits, sizeof(float));
+        a += denormMagic;
+        memcpy(&bits, &a, sizeof(float));
+        h = (uint16_t)(bits - denormMagicBits);
+    }
+    else
+    {
+        uint32_t mantOdd = (bits >> 13) & 1;
+        bits += ((uint32_t)(15 - 127) << 23) + 0xfff;
+        bits += mantOdd;
+        h = (uint16_t)(bits >> 13);
+    }
+    return h | (uint16_t)(sign >> 16);
+}
+
 /// Returns memory size of datatype
 size_t gettypesize(DataType type);
 
@@ -273,32 +273,12 @@ void InverseFourierTransformHalf(const MultidimArray< std::complex<double> > &in
     out.setXmippOrigin();
 }
 
-void centerFFT2(MultidimArray<double> &v)
+template<typename T>
+static void centerFFT2T(MultidimArray<T> &v)
 {
     if (v.getDim() == 2)
     {
-        //Just separe the even and odd dimensions case
-        if (XSIZE(v) % 2 == 0 && YSIZE(v) % 2 == 0)
-        {
-            int xsize = XSIZE(v);
-            int xhalf = xsize / 2;
-            int yhalf = YSIZE(v) / 2;
-            double * posA = MULTIDIM_ARRAY(v);
-            double * posB = posA + xhalf;
-            double * posC = posA + xsize * yhalf;
-            double * posD = posC + xhalf;
-            double * buffer=new double[xhalf];
-            size_t bytes = xhalf * sizeof(double);
-
-            for (int i = 0; i < yhalf; ++i,
-                 posA += xsize, posB += xsize, posC += xsize, posD += xsize)
-            {
-                SWAP_ARRAY(posA, posD, bytes);
-                SWAP_ARRAY(posB, posC, bytes);
-            }
-            delete []buffer;
-        }
-        else
+        if (!centerFFTEven(v))
         {
             //todo: implementation for the odd case needed
             CenterFFT(v, true);
@@ -307,79 +287,94 @@ void centerFFT2(MultidimArray<double> &v)
     else
         std::cerr <<"bad dim: " << v.getDim() << std::endl;
 }
-/* FFT shifts ------------------------------------------------------------ */
-void ShiftFFT(MultidimArray< std::complex< double > > & v,
-              double xshift)
+
+void centerFFT2(MultidimArray<double> &v)
 {
-    v.checkDimension(1);
-    double dotp, a, b, c, d, ac, bd, ab_cd;
-    double xxshift = xshift / (double)XSIZE(v);
-    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(v)
-    {
-        dotp = -2 * PI * ((double)(i) * xxshift);
-        a = cos(dotp);
-        b = sin(dotp);
-        c = DIRECT_A1D_ELEM(v,i).real();
-        d = DIRECT_A1D_ELEM(v,i).imag();
-        ac = a * c;
-        bd = b * d;
-        ab_cd = (a + b) * (c + d); // (ab_cd-ac-bd = ad+bc : but needs 4 multiplications)
-        DIRECT_A1D_ELEM(v,i) = std::complex<double>(ac - bd, ab_cd - ac - bd);
-    }
+    centerFFT2T(v);
 }
 
-void ShiftFFT(MultidimArray< std::complex< double > > & v,
-              double xshift, double yshift)
+void centerFFT2(MultidimArray<float> &v)
 {
-    v.checkDimension(2);
-    double dotp, a, b, c, d, ac, bd, ab_cd;
-    double xxshift = xshift / (double)XSIZE(v);
-    double yyshift = yshift / (double)YSIZE(v);
-    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(v)
-    {
-        dotp = -2 * PI * ((double)(j) * xxshift + (double)(i) * yyshift);
-        a = cos(dotp);
-        b = sin(dotp);
-        c = DIRECT_A2D_ELEM(v,i,j).real();
-        d = DIRECT_A2D_ELEM(v,i,j).imag();
-        ac = a * c;
-        bd = b * d;
-        ab_cd = (a + b) * (c + d);
-        DIRECT_A2D_ELEM(v,i,j) = std::complex<double>(ac - bd, ab_cd - ac - bd);
-    }
+    centerFFT2T(v);
 }
 
-void ShiftFFT(MultidimArray< std::complex< double > > & v,
-              double xshift, double yshift, double zshift)
+/* FFT shifts ------------------------------------------------------------ */
+/* The phase ramp exp(-2 pi i (j*xshift/X + i*yshift/Y + k*zshift/Z)) is
+   computed once per row and then advanced along X with a complex rotation,
+   instead of evaluating sin and cos for every coefficient. */
+template<typename T>
+static void shiftFFT3D(MultidimArray< std::complex< T > > & v,
+                       double xshift, double yshift, double zshift)
 {
-    v.checkDimension(3);
-    double dotp, a, b, c, d, ac, bd, ab_cd;
     double xxshift = -2 * PI * xshift / (double)XSIZE(v);
     double yyshift = -2 * PI * yshift / (double)YSIZE(v);
     double zzshift = -2 * PI * zshift / (double)ZSIZE(v);
+    double stepCos, stepSin;
+    sincos(xxshift,&stepSin,&stepCos);
     for (size_t k=0; k<ZSIZE(v); ++k)
     {
-    	double zdot=(double)(k) * zzshift;
+        double zdot=(double)(k) * zzshift;
         for (size_t i=0; i<YSIZE(v); ++i)
         {
-        	double zydot=zdot+(double)(i) * yyshift;
-            for (size_t j=0; j<XSIZE(v); ++j)
+            double a, b, c, d, aux;
+            sincos(zdot+(double)(i) * yyshift,&b,&a);
+            T *ptrv_ki=(T *)&DIRECT_A3D_ELEM(v,k,i,0);
+            for (size_t j=0; j<XSIZE(v); ++j, ptrv_ki+=2)
             {
-            	double *ptrv_kij=(double *)&DIRECT_A3D_ELEM(v,k,i,j);
-                dotp = (double)(j) * xxshift + zydot;
-                sincos(dotp,&b,&a);
-                c = *ptrv_kij;
-                d = *(ptrv_kij+1);
-                ac = a * c;
-                bd = b * d;
-                ab_cd = (a + b) * (c + d);
-                *ptrv_kij = ac - bd;
-                *(ptrv_kij+1) = ab_cd - ac - bd;
+                c = *ptrv_ki;
+                d = *(ptrv_ki+1);
+                *ptrv_ki = a * c - b * d;
+                *(ptrv_ki+1) = a * d + b * c;
+
+                // Rotate the phase to the next coefficient
+                aux = a * stepCos - b * stepSin;
+                b = a * stepSin + b * stepCos;
+                a = aux;
             }
         }
     }
 }
 
+void ShiftFFT(MultidimArray< std::complex< double > > & v,
+              double xshift)
+{
+    v.checkDimension(1);
+    shiftFFT3D(v, xshift, 0., 0.);
+}
+
+void ShiftFFT(MultidimArray< std::complex< double > > & v,
+              double xshift, double yshift)
+{
+    v.checkDimension(2);
+    shiftFFT3D(v, xshift, yshift, 0.);
+}
+
+void ShiftFFT(MultidimArray< std::complex< double > > & v,
+              double xshift, double yshift, double zshift)
+{
+    v.checkDimension(3);
+    shiftFFT3D(v, xshift, yshift, zshift);
+}
+
+void ShiftFFT(MultidimArray< std::complex< float > > & v, double xshift)
+{
+    v.checkDimension(1);
+    shiftFFT3D(v, xshift, 0., 0.);
+}
+
+void ShiftFFT(MultidimArray< std::complex< float > > & v, double xshift, double yshift)
+{
+    v.checkDimension(2);
+    shiftFFT3D(v, xshift, yshift, 0.);
+}
+
+void ShiftFFT(MultidimArray< std::complex< float > > & v,
+              double xshift, double yshift, double zshift)
+{
+    v.checkDimension(3);
+    shiftFFT3D(v, xshift, yshift, zshift);
+}
+
 /* Position origin at center ----------------------------------------------- */
 void CenterOriginFFT(MultidimArray< std::complex< double > > & v, bool forward)
 {
@@ -27,6 +27,7 @@
 #define CORE_FFT_H
 
 #include <complex>
+#include <algorithm>
 
 #include "multidim_array.h"
 #include "xmipp_funcs.h"
@@ -281,8 +282,43 @@ void InverseFourierTransformHalf(const MultidimArray< std::complex< double > > &
  * The function is optimized for the particular case of 2D.
  */
 void centerFFT2(MultidimArray<double> &v);
+void centerFFT2(MultidimArray<float> &v);
 
 
+/** CenterFFT of arrays whose sizes are all even.
+ * Forward and backward centering are the same exchange of the halves of
+ * each dimension, which is done in place swapping every row with its
+ * symmetric one. Returns false, without modifying v, if a size is odd.
+ */
+template <typename T>
+bool centerFFTEven(MultidimArray< T >& v)
+{
+    size_t xdim=XSIZE(v), ydim=YSIZE(v), zdim=ZSIZE(v);
+    if (xdim%2!=0 || (ydim>1 && ydim%2!=0) || (zdim>1 && zdim%2!=0))
+        return false;
+
+    size_t xhalf=xdim/2, yhalf=ydim/2, zhalf=zdim/2;
+    T *data=MULTIDIM_ARRAY(v);
+    if (ydim==1 && zdim==1)
+    {
+        std::swap_ranges(data, data+xhalf, data+xhalf);
+        return true;
+    }
+
+    // Rows in the first half of the volume (or image) and their symmetric ones
+    size_t kmax=(zdim>1) ? zhalf : 1;
+    size_t imax=(zdim>1) ? ydim : yhalf;
+    for (size_t k=0; k<kmax; ++k)
+        for (size_t i=0; i<imax; ++i)
+        {
+            T *rowA=data+(k*ydim+i)*xdim;
+            T *rowB=data+(((k+zhalf)%zdim)*ydim+(i+yhalf)%ydim)*xdim;
+            std::swap_ranges(rowA, rowA+xhalf, rowB+xhalf);
+            std::swap_ranges(rowA+xhalf, rowA+xdim, rowB);
+        }
+    return true;
+}
+
 /** CenterFFT
  * Relation with Matlab fftshift: forward true is equals to fftshift and forward false
  * equals to ifftshift
@@ -292,6 +328,9 @@ void CenterFFT(MultidimArray< T >& v, bool forward)
 {
 	bool firstTime=true;						// First time executing inner loops.
 
+    if (v.getDim() > 0 && v.getDim() <= 3 && centerFFTEven(v))
+        return;
+
 	// Check dimension is between 1 and 3 inclusive.
     if ( v.getDim() > 0 && v.getDim() <= 3)
     {
@@ -575,6 +614,16 @@ void ShiftFFT(MultidimArray< std::complex< double > > & v,
               double yshift,
               double zshift);
 
+/** Single precision FFT shifts.
+ * Phases are computed in double precision.
+ */
+void ShiftFFT(MultidimArray< std::complex< float > > & v, double xshift);
+void ShiftFFT(MultidimArray< std::complex< float > > & v, double xshift, double yshift);
+void ShiftFFT(MultidimArray< std::complex< float > > & v,
+              double xshift,
+              double yshift,
+              double zshift);
+
 /** Place the origin of the FFT at the center of the vector and back
  *
  * Changes the real and the fourier space origin
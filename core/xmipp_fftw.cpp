@@ -29,44 +29,326 @@
 #include "transformations.h"
 #include <string.h>
 #include <pthread.h>
+#include "xmipp_threads.h"
+
+#include <map>
 
 static pthread_mutex_t fftw_plan_mutex = PTHREAD_MUTEX_INITIALIZER;
-bool	planCreated=false;
-int		nInstances=0;
 
-// Constructors and destructors --------------------------------------------
-FourierTransformer::FourierTransformer()
+/** Sizes of the dimensions of an array, as FFTW expects them */
+template<typename T>
+static int fftwDimensions(const MultidimArray<T> &v, int *N)
 {
-    init();
+    if (ZSIZE(v)!=1)
+    {
+        N[0]=ZSIZE(v);
+        N[1]=YSIZE(v);
+        N[2]=XSIZE(v);
+        return 3;
+    }
+    if (YSIZE(v)!=1)
+    {
+        N[0]=YSIZE(v);
+        N[1]=XSIZE(v);
+        return 2;
+    }
+    N[0]=XSIZE(v);
+    return 1;
+}
+
+/** Alias n consecutive images of a stack, starting at first */
+template<typename T>
+static void aliasImages(const MultidimArray<T> &m, size_t first, size_t n, MultidimArray<T> &V)
+{
+    V.alias(m);
+    V.setDimensions(XSIZE(m), YSIZE(m), ZSIZE(m), n);
+    V.data+=first*m.zyxdim;
+    V.nzyxdimAlloc=V.nzyxdim;
+}
+
+// Plan cache --------------------------------------------------------------
+// All of them protected by fftw_plan_mutex
+static std::map<FFTWPlanKey, fftw_plan> planCache;
+static std::map<FFTWPlanKey, fftwf_plan> planCacheFloat;
+static unsigned planningRigor=FFTW_ESTIMATE;
+static int planCacheGeneration=0;
+static bool threadsInitialized=false, threadsInitializedFloat=false;
+
+FFTWPlanKey::FFTWPlanKey()
+{
+    realData=true;
+    sign=FFTW_FORWARD;
+    ndim=0;
+    N[0]=N[1]=N[2]=0;
+    howmany=1;
     nthreads=1;
+    rigor=FFTW_ESTIMATE;
+    aligned=true;
+}
+
+bool FFTWPlanKey::operator<(const FFTWPlanKey &other) const
+{
+    if (realData!=other.realData)
+        return realData<other.realData;
+    if (sign!=other.sign)
+        return sign<other.sign;
+    if (ndim!=other.ndim)
+        return ndim<other.ndim;
+    for (int i=0; i<ndim; ++i)
+        if (N[i]!=other.N[i])
+            return N[i]<other.N[i];
+    if (howmany!=other.howmany)
+        return howmany<other.howmany;
+    if (nthreads!=other.nthreads)
+        return nthreads<other.nthreads;
+    if (rigor!=other.rigor)
+        return rigor<other.rigor;
+    return aligned<other.aligned;
+}
+
+bool FFTWPlanKey::operator==(const FFTWPlanKey &other) const
+{
+    return !(*this<other) && !(other<*this);
+}
+
+/** Number of elements of the input and output arrays of a plan */
+static void planArraySizes(const FFTWPlanKey &key, size_t &inSize, size_t &outSize)
+{
+    size_t n=key.howmany;
+    for (int i=0; i<key.ndim-1; ++i)
+        n*=key.N[i];
+    size_t nReal=n*key.N[key.ndim-1];
+    size_t nHalf=n*(key.N[key.ndim-1]/2+1);
+    if (!key.realData)
+        inSize=outSize=nReal;
+    else if (key.sign==FFTW_FORWARD)
+    {
+        inSize=nReal;
+        outSize=nHalf;
+    }
+    else
+    {
+        inSize=nHalf;
+        outSize=nReal;
+    }
+}
+
+/** Distance between consecutive arrays of a batched plan */
+static void planArrayDistances(const FFTWPlanKey &key, int &realDist, int &halfDist)
+{
+    int n=1;
+    for (int i=0; i<key.ndim-1; ++i)
+        n*=key.N[i];
+    realDist=n*key.N[key.ndim-1];
+    halfDist=n*(key.N[key.ndim-1]/2+1);
+}
+
+/** Flags of the FFTW planner for a key */
+static unsigned planFlags(const FFTWPlanKey &key)
+{
+    return key.aligned ? key.rigor : (key.rigor | FFTW_UNALIGNED);
+}
+
+void FFTWPlanCache::setPlanningRigor(unsigned rigor)
+{
+    if (rigor!=FFTW_ESTIMATE && rigor!=FFTW_MEASURE && rigor!=FFTW_PATIENT)
+        REPORT_ERROR(ERR_ARG_INCORRECT, "FFTW planning rigor must be FFTW_ESTIMATE, FFTW_MEASURE or FFTW_PATIENT");
     pthread_mutex_lock(&fftw_plan_mutex);
-    nInstances++;
+    planningRigor=rigor;
     pthread_mutex_unlock(&fftw_plan_mutex);
+}
+
+unsigned FFTWPlanCache::getPlanningRigor()
+{
+    return planningRigor;
+}
+
+int FFTWPlanCache::generation()
+{
+    return planCacheGeneration;
+}
+
+fftw_plan FFTWPlanCache::getPlan(const FFTWPlanKey &key, void *in, void *out)
+{
+    pthread_mutex_lock(&fftw_plan_mutex);
+    std::map<FFTWPlanKey, fftw_plan>::iterator it=planCache.find(key);
+    if (it!=planCache.end())
+    {
+        fftw_plan plan=it->second;
+        pthread_mutex_unlock(&fftw_plan_mutex);
+        return plan;
+    }
+
+    if (key.nthreads>1 && !threadsInitialized)
+        threadsInitialized=fftw_init_threads()!=0;
+    if (threadsInitialized)
+        fftw_plan_with_nthreads(key.nthreads);
+
+    // Measuring overwrites the arrays
+    size_t inSize, outSize;
+    planArraySizes(key, inSize, outSize);
+    bool scratch=key.rigor!=FFTW_ESTIMATE;
+    if (scratch)
+    {
+        in=fftw_malloc(inSize*(key.realData && key.sign==FFTW_FORWARD ? sizeof(double) : sizeof(fftw_complex)));
+        out=fftw_malloc(outSize*(key.realData && key.sign==FFTW_BACKWARD ? sizeof(double) : sizeof(fftw_complex)));
+    }
+
+    fftw_plan plan=NULL;
+    unsigned flags=planFlags(key);
+    int realDist, halfDist;
+    planArrayDistances(key, realDist, halfDist);
+    if (!key.realData)
+        plan=fftw_plan_many_dft(key.ndim, key.N, key.howmany, (fftw_complex*)in, NULL, 1, realDist,
+                                (fftw_complex*)out, NULL, 1, realDist, key.sign, flags);
+    else if (key.sign==FFTW_FORWARD)
+        plan=fftw_plan_many_dft_r2c(key.ndim, key.N, key.howmany, (double*)in, NULL, 1, realDist,
+                                    (fftw_complex*)out, NULL, 1, halfDist, flags);
+    else
+        plan=fftw_plan_many_dft_c2r(key.ndim, key.N, key.howmany, (fftw_complex*)in, NULL, 1, halfDist,
+                                    (double*)out, NULL, 1, realDist, flags);
+
+    if (scratch)
+    {
+        fftw_free(in);
+        fftw_free(out);
+    }
+    if (plan==NULL)
+    {
+        pthread_mutex_unlock(&fftw_plan_mutex);
+        REPORT_ERROR(ERR_PLANS_NOCREATE, "FFTW plans cannot be created");
+    }
+    planCache[key]=plan;
+    pthread_mutex_unlock(&fftw_plan_mutex);
+    return plan;
+}
+
+fftwf_plan FFTWPlanCache::getPlanFloat(const FFTWPlanKey &key, void *in, void *out)
+{
+    pthread_mutex_lock(&fftw_plan_mutex);
+    std::map<FFTWPlanKey, fftwf_plan>::iterator it=planCacheFloat.find(key);
+    if (it!=planCacheFloat.end())
+    {
+        fftwf_plan plan=it->second;
+        pthread_mutex_unlock(&fftw_plan_mutex);
+        return plan;
+    }
+
+    if (key.nthreads>1 && !threadsInitializedFloat)
+        threadsInitializedFloat=fftwf_init_threads()!=0;
+    if (threadsInitializedFloat)
+        fftwf_plan_with_nthreads(key.nthreads);
+
+    size_t inSize, outSize;
+    planArraySizes(key, inSize, outSize);
+    bool scratch=key.rigor!=FFTW_ESTIMATE;
+    if (scratch)
+    {
+        in=fftwf_malloc(inSize*(key.realData && key.sign==FFTW_FORWARD ? sizeof(float) : sizeof(fftwf_complex)));
+        out=fftwf_malloc(outSize*(key.realData && key.sign==FFTW_BACKWARD ? sizeof(float) : sizeof(fftwf_complex)));
+    }
+
+    fftwf_plan plan=NULL;
+    unsigned flags=planFlags(key);
+    int realDist, halfDist;
+    planArrayDistances(key, realDist, halfDist);
+    if (!key.realData)
+        plan=fftwf_plan_many_dft(key.ndim, key.N, key.howmany, (fftwf_complex*)in, NULL, 1, realDist,
+                                 (fftwf_complex*)out, NULL, 1, realDist, key.sign, flags);
+    else if (key.sign==FFTW_FORWARD)
+        plan=fftwf_plan_many_dft_r2c(key.ndim, key.N, key.howmany, (float*)in, NULL, 1, realDist,
+                                     (fftwf_complex*)out, NULL, 1, halfDist, flags);
+    else
+        plan=fftwf_plan_many_dft_c2r(key.ndim, key.N, key.howmany, (fftwf_complex*)in, NULL, 1, halfDist,
+                                     (float*)out, NULL, 1, realDist, flags);
+
+    if (scratch)
+    {
+        fftwf_free(in);
+        fftwf_free(out);
+    }
+    if (plan==NULL)
+    {
+        pthread_mutex_unlock(&fftw_plan_mutex);
+        REPORT_ERROR(ERR_PLANS_NOCREATE, "FFTW plans cannot be created");
+    }
+    planCacheFloat[key]=plan;
+    pthread_mutex_unlock(&fftw_plan_mutex);
+    return plan;
+}
+
+void FFTWPlanCache::clear()
+{
+    pthread_mutex_lock(&fftw_plan_mutex);
+    for (std::map<FFTWPlanKey, fftw_plan>::iterator it=planCache.begin(); it!=planCache.end(); ++it)
+        fftw_destroy_plan(it->second);
+    planCache.clear();
+    for (std::map<FFTWPlanKey, fftwf_plan>::iterator it=planCacheFloat.begin(); it!=planCacheFloat.end(); ++it)
+        fftwf_destroy_plan(it->second);
+    planCacheFloat.clear();
+    if (threadsInitialized)
+        fftw_cleanup_threads();
+    if (threadsInitializedFloat)
+        fftwf_cleanup_threads();
+    threadsInitialized=threadsInitializedFloat=false;
+    fftw_cleanup();
+    fftwf_cleanup();
+    planCacheGeneration++;
+    pthread_mutex_unlock(&fftw_plan_mutex);
+}
+
+bool FFTWPlanCache::importWisdom(const FileName &fn)
+{
+    pthread_mutex_lock(&fftw_plan_mutex);
+    bool imported=fftw_import_wisdom_from_filename(fn.c_str())!=0;
+    imported=(fftwf_import_wisdom_from_filename((fn+".float").c_str())!=0) || imported;
+    pthread_mutex_unlock(&fftw_plan_mutex);
+    return imported;
+}
+
+void FFTWPlanCache::exportWisdom(const FileName &fn)
+{
+    pthread_mutex_lock(&fftw_plan_mutex);
+    bool exported=fftw_export_wisdom_to_filename(fn.c_str())!=0 &&
+                  fftwf_export_wisdom_to_filename((fn+".float").c_str())!=0;
+    pthread_mutex_unlock(&fftw_plan_mutex);
+    if (!exported)
+        REPORT_ERROR(ERR_IO_NOWRITE, "Cannot write FFTW wisdom to "+fn);
+}
+
+// Constructors and destructors --------------------------------------------
+template<typename Real>
+FourierTransformerT<Real>::FourierTransformerT()
+{
+    init();
+    nthreads=1;
     threadsSetOn=false;
     normSign = FFTW_FORWARD;
 }
 
-FourierTransformer::FourierTransformer(int _normSign)
+template<typename Real>
+FourierTransformerT<Real>::FourierTransformerT(int _normSign)
 {
     init();
-    pthread_mutex_lock(&fftw_plan_mutex);
-    nInstances++;
-    pthread_mutex_unlock(&fftw_plan_mutex);
     nthreads=1;
     threadsSetOn=false;
     normSign = _normSign;
 }
 
-FourierTransformer::FourierTransformer(const FourierTransformer& fTransform)
+template<typename Real>
+FourierTransformerT<Real>::FourierTransformerT(const FourierTransformerT<Real>& fTransform)
 {
     REPORT_ERROR(ERR_UNCLASSIFIED,"Fourier transformers should not be copied");
 }
 
-FourierTransformer & FourierTransformer::operator= (const FourierTransformer & other)
+template<typename Real>
+FourierTransformerT<Real> & FourierTransformerT<Real>::operator= (const FourierTransformerT<Real> & other)
 {
     REPORT_ERROR(ERR_UNCLASSIFIED,"Fourier transformers should not be copied");
 }
-void FourierTransformer::init()
+
+template<typename Real>
+void FourierTransformerT<Real>::init()
 {
     fReal=NULL;
     fComplex=NULL;
@@ -74,187 +356,131 @@ void FourierTransformer::init()
     fPlanBackward    = NULL;
     dataPtr          = NULL;
     complexDataPtr   = NULL;
+    planKey          = FFTWPlanKey();
+    planGeneration   = -1;
 }
 
-void FourierTransformer::clear()
+template<typename Real>
+void FourierTransformerT<Real>::clear()
 {
+    // The plans belong to the plan cache
     fFourier.clear();
-    // Anything to do with plans has to be protected for threads!
-    pthread_mutex_lock(&fftw_plan_mutex);
-    if (fPlanForward !=NULL)
-        fftw_destroy_plan(fPlanForward);
-    if (fPlanBackward!=NULL)
-        fftw_destroy_plan(fPlanBackward);
-    pthread_mutex_unlock(&fftw_plan_mutex);
-
+    fRealView.clear();
     init();
 }
 
-FourierTransformer::~FourierTransformer()
+template<typename Real>
+FourierTransformerT<Real>::~FourierTransformerT()
 {
     clear();
-
-    pthread_mutex_lock(&fftw_plan_mutex);
-    nInstances--;
-
-    // Check if a plan was already created.
-    if (planCreated)
-    {
-    	// Check if this is last instance of a FFT.
-        if (nInstances == 0)
-        {
-        	destroyThreads();
-        	planCreated = false;
-        	cleanup();
-        }
-    }
-    pthread_mutex_unlock(&fftw_plan_mutex);
 }
 
 // Initialization ----------------------------------------------------------
-const MultidimArray<double> &FourierTransformer::getReal() const
+template<typename Real>
+const MultidimArray<Real> &FourierTransformerT<Real>::getReal() const
 {
     return (*fReal);
 }
 
-const MultidimArray<std::complex<double> > &FourierTransformer::getComplex() const
+template<typename Real>
+const MultidimArray<std::complex<Real> > &FourierTransformerT<Real>::getComplex() const
 {
     return (*fComplex);
 }
 
 
-void FourierTransformer::setReal(MultidimArray<double> &input)
+template<typename Real>
+void FourierTransformerT<Real>::setReal(MultidimArray<Real> &input)
 {
-    bool updatePlan=false;
-    if (fReal==NULL)
-    	updatePlan=true;
-    else if (dataPtr!=MULTIDIM_ARRAY(input))
-    	updatePlan=true;
-    else
-    	updatePlan=!(fReal->sameShape(input));
     fFourier.resizeNoCopy(ZSIZE(input),YSIZE(input),XSIZE(input)/2+1);
     fReal=&input;
+    fComplex=NULL;
+    updatePlans();
+}
 
-    if (updatePlan)
-    {
-        recomputePlanR2C();
-    }
-}
-
-void FourierTransformer::recomputePlanR2C()
-{
-	int ndim=3;
-	if (ZSIZE(*fReal)==1)
-	{
-		ndim=2;
-		if (YSIZE(*fReal)==1)
-			ndim=1;
-	}
-	int N[3];
-	switch (ndim)
-	{
-	case 1:
-		N[0]=XSIZE(*fReal);
-		break;
-	case 2:
-		N[0]=YSIZE(*fReal);
-		N[1]=XSIZE(*fReal);
-		break;
-	case 3:
-		N[0]=ZSIZE(*fReal);
-		N[1]=YSIZE(*fReal);
-		N[2]=XSIZE(*fReal);
-		break;
-	}
-
-	pthread_mutex_lock(&fftw_plan_mutex);
-	if (fPlanForward!=NULL)
-		fftw_destroy_plan(fPlanForward);
-	fPlanForward=NULL;
-	fPlanForward = fftw_plan_dft_r2c(ndim, N, MULTIDIM_ARRAY(*fReal),
-									 (fftw_complex*) MULTIDIM_ARRAY(fFourier), FFTW_ESTIMATE);
-	if (fPlanBackward!=NULL)
-		fftw_destroy_plan(fPlanBackward);
-	fPlanBackward=NULL;
-	fPlanBackward = fftw_plan_dft_c2r(ndim, N,
-									  (fftw_complex*) MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fReal),
-									  FFTW_ESTIMATE);
-	if (fPlanForward == NULL || fPlanBackward == NULL)
-		REPORT_ERROR(ERR_PLANS_NOCREATE, "FFTW plans cannot be created");
-	dataPtr=MULTIDIM_ARRAY(*fReal);
-	planCreated = true;
-	pthread_mutex_unlock(&fftw_plan_mutex);
-}
-
-void FourierTransformer::setReal(MultidimArray<std::complex<double> > &input)
-{
-    bool recomputePlan=false;
-    if (fComplex==NULL)
-        recomputePlan=true;
-    else if (complexDataPtr!=MULTIDIM_ARRAY(input))
-        recomputePlan=true;
-    else
-        recomputePlan=!(fComplex->sameShape(input));
-    fFourier.resizeNoCopy(input);
-    fComplex=&input;
+template<typename Real>
+void FourierTransformerT<Real>::setReal(const MultidimArrayView<Real> &view)
+{
+    view.copyTo(fRealView);
+    setReal(fRealView);
+}
 
-    if (recomputePlan)
-    {
-        int ndim=3;
-        if (ZSIZE(input)==1)
-        {
-            ndim=2;
-            if (YSIZE(input)==1)
-                ndim=1;
-        }
-        int *N = new int[ndim];
-        switch (ndim)
-        {
-        case 1:
-            N[0]=XSIZE(input);
-            break;
-        case 2:
-            N[0]=YSIZE(input);
-            N[1]=XSIZE(input);
-            break;
-        case 3:
-            N[0]=ZSIZE(input);
-            N[1]=YSIZE(input);
-            N[2]=XSIZE(input);
-            break;
-        }
+template<typename Real>
+void FourierTransformerT<Real>::recomputePlanR2C()
+{
+    fComplex=NULL;
+    planGeneration=-1;
+    updatePlans();
+}
 
-        pthread_mutex_lock(&fftw_plan_mutex);
-        if (fPlanForward!=NULL)
-            fftw_destroy_plan(fPlanForward);
-        fPlanForward=NULL;
-        fPlanForward = fftw_plan_dft(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(*fComplex),
-                                     (fftw_complex*) MULTIDIM_ARRAY(fFourier), FFTW_FORWARD, FFTW_ESTIMATE);
-        if (fPlanBackward!=NULL)
-            fftw_destroy_plan(fPlanBackward);
-        fPlanBackward=NULL;
-        fPlanBackward = fftw_plan_dft(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(fFourier),
-                                      (fftw_complex*) MULTIDIM_ARRAY(*fComplex), FFTW_BACKWARD, FFTW_ESTIMATE);
-        if (fPlanForward == NULL || fPlanBackward == NULL)
-            REPORT_ERROR(ERR_PLANS_NOCREATE, "FFTW plans cannot be created");
-        delete [] N;
-        complexDataPtr=MULTIDIM_ARRAY(*fComplex);
-        pthread_mutex_unlock(&fftw_plan_mutex);
+template<typename Real>
+void FourierTransformerT<Real>::updatePlans()
+{
+    typedef FFTWPrecision<Real> Precision;
+    FFTWPlanKey key;
+    Real *in;
+    if (fReal!=NULL)
+    {
+        key.ndim=fftwDimensions(*fReal, key.N);
+        in=MULTIDIM_ARRAY(*fReal);
     }
+    else if (fComplex!=NULL)
+    {
+        key.realData=false;
+        key.ndim=fftwDimensions(*fComplex, key.N);
+        in=(Real*)MULTIDIM_ARRAY(*fComplex);
+    }
+    else
+        REPORT_ERROR(ERR_UNCLASSIFIED,"No complex nor real data defined");
+    Real *out=(Real*)MULTIDIM_ARRAY(fFourier);
+    key.nthreads=nthreads;
+    key.rigor=FFTWPlanCache::getPlanningRigor();
+    key.aligned=Precision::aligned(in, out);
+
+    // Plans are executed on the current arrays, so they are only
+    // changed if the shape or the alignment of the arrays change
+    if (planGeneration==FFTWPlanCache::generation() && key==planKey)
+        return;
+    fPlanForward=Precision::getPlan(key, in, out);
+    FFTWPlanKey keyBackward=key;
+    keyBackward.sign=FFTW_BACKWARD;
+    fPlanBackward=Precision::getPlan(keyBackward, out, in);
+    planKey=key;
+    planGeneration=FFTWPlanCache::generation();
+    if (fReal!=NULL)
+        dataPtr=in;
+    else
+        complexDataPtr=MULTIDIM_ARRAY(*fComplex);
+}
+
+template<typename Real>
+void FourierTransformerT<Real>::setReal(MultidimArray<std::complex<Real> > &input)
+{
+    fFourier.resizeNoCopy(input);
+    fComplex=&input;
+    fReal=NULL;
+    updatePlans();
 }
 
-void FourierTransformer::setFourier(const MultidimArray<std::complex<double> > &inputFourier)
+template<typename Real>
+void FourierTransformerT<Real>::setFourier(const MultidimArray<std::complex<Real> > &inputFourier)
 {
     memcpy(MULTIDIM_ARRAY(fFourier),MULTIDIM_ARRAY(inputFourier),
-           MULTIDIM_SIZE(inputFourier)*2*sizeof(double));
+           MULTIDIM_SIZE(inputFourier)*2*sizeof(Real));
 }
 
 // Transform ---------------------------------------------------------------
-void FourierTransformer::Transform(int sign)
+template<typename Real>
+void FourierTransformerT<Real>::Transform(int sign)
 {
+    typedef FFTWPrecision<Real> Precision;
+    updatePlans();
     if (sign == FFTW_FORWARD)
     {
-        fftw_execute(fPlanForward);
+        if (fReal!=NULL)
+            Precision::forward(fPlanForward, MULTIDIM_ARRAY(*fReal), MULTIDIM_ARRAY(fFourier));
+        else
+            Precision::execute(fPlanForward, MULTIDIM_ARRAY(*fComplex), MULTIDIM_ARRAY(fFourier));
 
         if (sign == normSign)
         {
@@ -266,8 +492,8 @@ void FourierTransformer::Transform(int sign)
             else
                 REPORT_ERROR(ERR_UNCLASSIFIED,"No complex nor real data defined");
 
-            double isize=1.0/size;
-            double *ptr=(double*)MULTIDIM_ARRAY(fFourier);
+            Real isize=1.0/size;
+            Real *ptr=(Real*)MULTIDIM_ARRAY(fFourier);
             size_t nmax=(fFourier.nzyxdim/4)*4;
             for (size_t n=0; n<nmax; n+=4)
             {
@@ -289,7 +515,10 @@ void FourierTransformer::Transform(int sign)
     }
     else if (sign == FFTW_BACKWARD)
     {
-        fftw_execute(fPlanBackward);
+        if (fReal!=NULL)
+            Precision::backward(fPlanBackward, MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fReal));
+        else
+            Precision::execute(fPlanBackward, MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fComplex));
 
         if (sign == normSign)
         {
@@ -297,15 +526,15 @@ void FourierTransformer::Transform(int sign)
             if(fReal!=NULL)
             {
                 size = MULTIDIM_SIZE(*fReal);
-                double isize=1.0/size;
+                Real isize=1.0/size;
                 FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(*fReal)
                 DIRECT_MULTIDIM_ELEM(*fReal,n) *= isize;
             }
             else if (fComplex!= NULL)
             {
                 size = MULTIDIM_SIZE(*fComplex);
-                double isize=1.0/size;
-                double *ptr=(double*)MULTIDIM_ARRAY(*fComplex);
+                Real isize=1.0/size;
+                Real *ptr=(Real*)MULTIDIM_ARRAY(*fComplex);
                 FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(*fComplex)
                 {
                     *ptr++ *= isize;
@@ -318,18 +547,21 @@ void FourierTransformer::Transform(int sign)
     }
 }
 
-void FourierTransformer::FourierTransform()
+template<typename Real>
+void FourierTransformerT<Real>::FourierTransform()
 {
     Transform(FFTW_FORWARD);
 }
 
-void FourierTransformer::inverseFourierTransform()
+template<typename Real>
+void FourierTransformerT<Real>::inverseFourierTransform()
 {
     Transform(FFTW_BACKWARD);
 }
 
 // Inforce Hermitian symmetry ---------------------------------------------
-void FourierTransformer::enforceHermitianSymmetry()
+template<typename Real>
+void FourierTransformerT<Real>::enforceHermitianSymmetry()
 {
     int ndim=3;
     int Zdim=ZSIZE(*fReal);
@@ -352,7 +584,7 @@ void FourierTransformer::enforceHermitianSymmetry()
         for (int i=1; i<=yHalf; i++)
         {
             int isym=intWRAP(-i,0,Ydim-1);
-            std::complex<double> mean=0.5*(
+            std::complex<Real> mean=(Real)0.5*(
                                           DIRECT_A2D_ELEM(fFourier,i,0)+
                                           conj(DIRECT_A2D_ELEM(fFourier,isym,0)));
             DIRECT_A2D_ELEM(fFourier,i,0)=mean;
@@ -366,7 +598,7 @@ void FourierTransformer::enforceHermitianSymmetry()
             for (int i=1; i<=yHalf; i++)
             {
                 int isym=intWRAP(-i,0,Ydim-1);
-                std::complex<double> mean=0.5*(
+                std::complex<Real> mean=(Real)0.5*(
                                               DIRECT_A3D_ELEM(fFourier,k,i,0)+
                                               conj(DIRECT_A3D_ELEM(fFourier,ksym,isym,0)));
                 DIRECT_A3D_ELEM(fFourier,k,i,0)=mean;
@@ -376,7 +608,7 @@ void FourierTransformer::enforceHermitianSymmetry()
         for (int k=1; k<=zHalf; k++)
         {
             int ksym=intWRAP(-k,0,Zdim-1);
-            std::complex<double> mean=0.5*(
+            std::complex<Real> mean=(Real)0.5*(
                                           DIRECT_A3D_ELEM(fFourier,k,0,0)+
                                           conj(DIRECT_A3D_ELEM(fFourier,ksym,0,0)));
             DIRECT_A3D_ELEM(fFourier,k,0,0)=mean;
@@ -386,18 +618,109 @@ void FourierTransformer::enforceHermitianSymmetry()
     }
 }
 
+// Both precisions are compiled in the library
+template class FourierTransformerT<double>;
+template class FourierTransformerT<float>;
+
+// Stack transformer -------------------------------------------------------
+FourierTransformerStack::FourierTransformerStack(int _normSign)
+{
+    fReal=NULL;
+    fPlanForward=NULL;
+    fPlanBackward=NULL;
+    nthreads=1;
+    normSign=_normSign;
+    planGeneration=-1;
+}
+
+void FourierTransformerStack::setReal(MultidimArray<double> &stack)
+{
+    fFourier.resizeNoCopy(NSIZE(stack),ZSIZE(stack),YSIZE(stack),XSIZE(stack)/2+1);
+    fReal=&stack;
+    updatePlans();
+}
+
+void FourierTransformerStack::updatePlans()
+{
+    if (fReal==NULL)
+        REPORT_ERROR(ERR_UNCLASSIFIED,"No real data defined");
+    FFTWPlanKey key;
+    key.ndim=fftwDimensions(*fReal, key.N);
+    key.howmany=NSIZE(*fReal);
+    key.nthreads=nthreads;
+    key.rigor=FFTWPlanCache::getPlanningRigor();
+    double *in=MULTIDIM_ARRAY(*fReal);
+    double *out=(double*)MULTIDIM_ARRAY(fFourier);
+    key.aligned=fftw_alignment_of(in)==0 && fftw_alignment_of(out)==0;
+
+    if (planGeneration==FFTWPlanCache::generation() && key==planKey)
+        return;
+    fPlanForward=FFTWPlanCache::getPlan(key, in, out);
+    FFTWPlanKey keyBackward=key;
+    keyBackward.sign=FFTW_BACKWARD;
+    fPlanBackward=FFTWPlanCache::getPlan(keyBackward, out, in);
+    planKey=key;
+    planGeneration=FFTWPlanCache::generation();
+}
+
+void FourierTransformerStack::getFourierImageAlias(size_t n, MultidimArray< std::complex<double> > &V)
+{
+    aliasImages(fFourier, n, 1, V);
+}
+
+void FourierTransformerStack::setFourier(const MultidimArray<std::complex<double> > &stackFourier)
+{
+    memcpy(MULTIDIM_ARRAY(fFourier),MULTIDIM_ARRAY(stackFourier),
+           MULTIDIM_SIZE(stackFourier)*2*sizeof(double));
+}
+
+void FourierTransformerStack::Transform(int sign)
+{
+    updatePlans();
+    double isize=1.0/fReal->zyxdim;
+    if (sign == FFTW_FORWARD)
+    {
+        fftw_execute_dft_r2c(fPlanForward, MULTIDIM_ARRAY(*fReal),
+                             (fftw_complex*) MULTIDIM_ARRAY(fFourier));
+        if (sign == normSign)
+        {
+            double *ptr=(double*)MULTIDIM_ARRAY(fFourier);
+            for (size_t n=0, nmax=2*fFourier.nzyxdim; n<nmax; ++n)
+                ptr[n] *= isize;
+        }
+    }
+    else if (sign == FFTW_BACKWARD)
+    {
+        fftw_execute_dft_c2r(fPlanBackward, (fftw_complex*) MULTIDIM_ARRAY(fFourier),
+                             MULTIDIM_ARRAY(*fReal));
+        if (sign == normSign)
+            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(*fReal)
+            DIRECT_MULTIDIM_ELEM(*fReal,n) *= isize;
+    }
+}
+
+void FourierTransformerStack::FourierTransform()
+{
+    Transform(FFTW_FORWARD);
+}
+
+void FourierTransformerStack::inverseFourierTransform()
+{
+    Transform(FFTW_BACKWARD);
+}
+
 /* FFT Magnitude  ------------------------------------------------------- */
 void FFT_magnitude(const MultidimArray< std::complex<double> > &v,
                    MultidimArray<double> &mag)
 {
     mag.resizeNoCopy(v);
-    double * ptrv=(double *)MULTIDIM_ARRAY(v);
-    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(v)
+    const double * ptrv=(const double *)MULTIDIM_ARRAY(v);
+    double * ptrMag=MULTIDIM_ARRAY(mag);
+    for (size_t n=0, nmax=MULTIDIM_SIZE(v); n<nmax; ++n)
     {
-        double re=*ptrv;
-        double im=*(ptrv+1);
-        DIRECT_MULTIDIM_ELEM(mag, n) = sqrt(re*re+im*im);
-        ptrv+=2;
+        double re=ptrv[2*n];
+        double im=ptrv[2*n+1];
+        ptrMag[n] = sqrt(re*re+im*im);
     }
 }
 
@@ -406,21 +729,61 @@ void FFT_phase(const MultidimArray< std::complex<double> > &v,
                MultidimArray<double> &phase)
 {
     phase.resizeNoCopy(v);
-    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(v)
-    DIRECT_MULTIDIM_ELEM(phase, n) = atan2(DIRECT_MULTIDIM_ELEM(v,n).imag(), DIRECT_MULTIDIM_ELEM(v, n).real());
+    const double * ptrv=(const double *)MULTIDIM_ARRAY(v);
+    double * ptrPhase=MULTIDIM_ARRAY(phase);
+    for (size_t n=0, nmax=MULTIDIM_SIZE(v); n<nmax; ++n)
+        ptrPhase[n] = atan2(ptrv[2*n+1], ptrv[2*n]);
 }
 
 void radial_magnitude(const MultidimArray<double> & v, MultidimArray< std::complex< double > > &V,
                       MultidimArray< double >& radialMagnitude)
 {
 	FourierTransform(v,V);
-	MultidimArray<double> Vmag;
-	FFT_magnitude(V,Vmag);
-	CenterFFT(Vmag,true);
-	Vmag.setXmippOrigin();
-	MultidimArray<int> radialCount;
-	Matrix1D<int> center(3);
-	radialAverage(Vmag,center,radialMagnitude,radialCount);
+
+    // Magnitude, centering and radial average in a single pass over V.
+    // After CenterFFT and setXmippOrigin the physical index p of a
+    // dimension of size N is at the logical index p (p<N-N/2) or p-N
+    int zdim=ZSIZE(V), ydim=YSIZE(V), xdim=XSIZE(V);
+    int z0=zdim/2, y0=ydim/2, x0=xdim/2;
+    int dim=(int)floor(sqrt((double)(z0*z0+y0*y0+x0*x0)))+1;
+    MultidimArray<int> radialCount;
+    radialMagnitude.initZeros(dim);
+    radialCount.initZeros(dim);
+
+    std::vector<double> fx2(xdim), mag(xdim);
+    for (int j=0; j<xdim; ++j)
+    {
+        int fx=(j<xdim-x0) ? j : j-xdim;
+        fx2[j]=fx*fx;
+    }
+    double * ptrMean=MULTIDIM_ARRAY(radialMagnitude);
+    int * ptrCount=MULTIDIM_ARRAY(radialCount);
+    const double * ptrV=(const double *)MULTIDIM_ARRAY(V);
+    for (int k=0; k<zdim; ++k)
+    {
+        int fz=(k<zdim-z0) ? k : k-zdim;
+        for (int i=0; i<ydim; ++i, ptrV+=2*xdim)
+        {
+            int fy=(i<ydim-y0) ? i : i-ydim;
+            double r2=fz*fz+fy*fy;
+            for (int j=0; j<xdim; ++j)
+            {
+                double re=ptrV[2*j];
+                double im=ptrV[2*j+1];
+                mag[j]=sqrt(re*re+im*im);
+            }
+            for (int j=0; j<xdim; ++j)
+            {
+                int distance=(int)floor(sqrt(r2+fx2[j]));
+                ptrMean[distance]+=mag[j];
+                ptrCount[distance]++;
+            }
+        }
+    }
+
+    for (int d=0; d<dim; ++d)
+        if (ptrCount[d]>0)
+            ptrMean[d]/=ptrCount[d];
 }
 
 void convolutionFFTStack(const MultidimArray<double> &img,
@@ -430,25 +793,30 @@ void convolutionFFTStack(const MultidimArray<double> &img,
     if (&result != &img)
         result = img;
 
-    MultidimArray<double> imgTemp;
-    MultidimArray< std::complex< double> > FFTIm, FFTK;
-    FourierTransformer transformer1(FFTW_BACKWARD), transformer2(FFTW_BACKWARD);
-
+    MultidimArray< std::complex< double> > FFTK;
+    FourierTransformer transformer2(FFTW_BACKWARD);
     transformer2.FourierTransform((MultidimArray<double> &)kernel, FFTK, false);
 
-    for (size_t n = 0; n < ZSIZE(result); n++)
-    {
-        imgTemp.aliasSlice(result, n);
-        transformer1.FourierTransform(imgTemp, FFTIm, false);
+    // The slices of result are transformed at once as a stack of images
+    MultidimArray<double> stack, imgTemp;
+    stack.alias(result);
+    stack.setDimensions(XSIZE(result), YSIZE(result), 1, ZSIZE(result));
+    FourierTransformerStack transformer1(FFTW_BACKWARD);
+    transformer1.setReal(stack);
+    transformer1.FourierTransform();
 
-        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(FFTIm)
-        DIRECT_MULTIDIM_ELEM(FFTIm,n) *= DIRECT_MULTIDIM_ELEM(FFTK,n);
+    std::complex<double> *ptrFFTIm=MULTIDIM_ARRAY(transformer1.fFourier);
+    for (size_t k = 0; k < ZSIZE(result); k++, ptrFFTIm+=MULTIDIM_SIZE(FFTK))
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(FFTK)
+        ptrFFTIm[n] *= DIRECT_MULTIDIM_ELEM(FFTK,n);
 
-        transformer1.inverseFourierTransform();
+    transformer1.inverseFourierTransform();
 
+    for (size_t n = 0; n < ZSIZE(result); n++)
+    {
+        imgTemp.aliasSlice(result, n);
         CenterFFT(imgTemp, false);
     }
-
 }
 
 void convolutionFFT(MultidimArray<double> &img,
@@ -483,8 +851,166 @@ void convolutionFFT(MultidimArray<double> &img,
     CenterFFT(result, false);
 }
 
+// Fourier shells ----------------------------------------------------------
+FourierShells::FourierShells(size_t _Zdim, size_t _Ydim, size_t _Xdim)
+{
+    Zdim=_Zdim;
+    Ydim=_Ydim;
+    Xdim=_Xdim;
+    size_t XdimFT=Xdim/2+1;
+    fz2.resizeNoCopy(Zdim);
+    fy2.resizeNoCopy(Ydim);
+    fx2.resizeNoCopy(XdimFT);
+    double f;
+    for (size_t k=0; k<Zdim; ++k)
+    {
+        FFT_IDX2DIGFREQ(k,Zdim,f);
+        DIRECT_A1D_ELEM(fz2,k)=f*f;
+    }
+    for (size_t i=0; i<Ydim; ++i)
+    {
+        FFT_IDX2DIGFREQ(i,Ydim,f);
+        DIRECT_A1D_ELEM(fy2,i)=f*f;
+    }
+    for (size_t j=0; j<XdimFT; ++j)
+    {
+        FFT_IDX2DIGFREQ(j,Xdim,f);
+        DIRECT_A1D_ELEM(fx2,j)=f*f;
+    }
+
+    shell.resizeNoCopy(Zdim,Ydim,XdimFT);
+    int *ptrShell=MULTIDIM_ARRAY(shell);
+    nShells=0;
+    for (size_t k=0; k<Zdim; ++k)
+        for (size_t i=0; i<Ydim; ++i)
+        {
+            double fzy2=DIRECT_A1D_ELEM(fz2,k)+DIRECT_A1D_ELEM(fy2,i);
+            for (size_t j=0; j<XdimFT; ++j, ++ptrShell)
+            {
+                int idx=(int)round(sqrt(fzy2+DIRECT_A1D_ELEM(fx2,j))*Xdim);
+                *ptrShell=idx;
+                nShells=XMIPP_MAX(nShells,idx+1);
+            }
+        }
+}
+
+static pthread_mutex_t fourierShellsMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::shared_ptr<const FourierShells> lastShells;
+
+std::shared_ptr<const FourierShells> FourierShells::getShells(size_t Zdim, size_t Ydim, size_t Xdim)
+{
+    pthread_mutex_lock(&fourierShellsMutex);
+    std::shared_ptr<const FourierShells> shells=lastShells;
+    pthread_mutex_unlock(&fourierShellsMutex);
+    if (shells && shells->Zdim==Zdim && shells->Ydim==Ydim && shells->Xdim==Xdim)
+        return shells;
+
+    shells=std::make_shared<const FourierShells>(Zdim,Ydim,Xdim);
+    pthread_mutex_lock(&fourierShellsMutex);
+    lastShells=shells;
+    pthread_mutex_unlock(&fourierShellsMutex);
+    return shells;
+}
+
+/** Run a function over the rows of a Fourier transform in nThreads threads */
+static void runFourierRows(int nThreads, ThreadFunction function, void *data)
+{
+    if (nThreads<=1)
+    {
+        ThreadArgument thArg;
+        thArg.thread_id=0;
+        thArg.threads=1;
+        thArg.data=data;
+        function(thArg);
+    }
+    else
+    {
+        ThreadManager thMgr(nThreads);
+        thMgr.run(function,data);
+    }
+}
+
+/** Rows [r0,r1) of a Fourier transform with nRows rows processed by a thread */
+static void fourierRowsOfThread(const ThreadArgument &thArg, size_t nRows, size_t &r0, size_t &r1)
+{
+    size_t rowsPerThread=(nRows+thArg.threads-1)/thArg.threads;
+    r0=XMIPP_MIN(thArg.thread_id*rowsPerThread,nRows);
+    r1=XMIPP_MIN(r0+rowsPerThread,nRows);
+}
+
 // Fourier ring correlation -----------------------------------------------
-//#define SAVE_REAL_PART
+// Sums of each shell accumulated by frc_dpr
+enum { FRC_NUM, FRC_DEN1, FRC_DEN2, FRC_ERROR_L2, FRC_DPR, FRC_DEN_DPR, FRC_COUNT,
+       FRC_RFACTOR_NUM, FRC_RFACTOR_DEN, FRC_NSUMS };
+
+struct FRCThreadData
+{
+    const MultidimArray< std::complex<double> > *FT1, *FT2;
+    const FourierShells *shells;
+    double minFreq2, maxFreq2;
+    bool dodpr;
+    int nShells;
+    // FRC_NSUMS sums of nShells values for each thread
+    std::vector<double> sums;
+};
+
+static void threadFRC(ThreadArgument &thArg)
+{
+    FRCThreadData &data=*((FRCThreadData *)thArg.data);
+    const FourierShells &shells=*data.shells;
+    size_t YdimFT=YSIZE(shells.shell), XdimFT=XSIZE(shells.shell);
+    size_t r0, r1;
+    fourierRowsOfThread(thArg, ZSIZE(shells.shell)*YdimFT, r0, r1);
+
+    int nShells=data.nShells;
+    double *sums=&data.sums[thArg.thread_id*FRC_NSUMS*nShells];
+    double *num=sums+FRC_NUM*nShells, *den1=sums+FRC_DEN1*nShells, *den2=sums+FRC_DEN2*nShells;
+    double *errorL2=sums+FRC_ERROR_L2*nShells, *count=sums+FRC_COUNT*nShells;
+    double *dpr=sums+FRC_DPR*nShells, *denDpr=sums+FRC_DEN_DPR*nShells;
+    double rFactorNumerator=0, rFactorDenominator=0;
+    const double *fx2=MULTIDIM_ARRAY(shells.fx2);
+    for (size_t r=r0; r<r1; ++r)
+    {
+        size_t k=r/YdimFT, i=r%YdimFT;
+        double fzy2=DIRECT_A1D_ELEM(shells.fz2,k)+DIRECT_A1D_ELEM(shells.fy2,i);
+        const int *ptrShell=&DIRECT_A3D_ELEM(shells.shell,k,i,0);
+        const std::complex<double> *ptrFT1=&DIRECT_A3D_ELEM(*data.FT1,k,i,0);
+        const std::complex<double> *ptrFT2=&DIRECT_A3D_ELEM(*data.FT2,k,i,0);
+        for (size_t j=0; j<XdimFT; ++j)
+        {
+            double R2=fzy2+fx2[j];
+            int idx=ptrShell[j];
+            if (R2>data.maxFreq2 || idx>=nShells)
+                continue;
+
+            const std::complex<double> &z1=ptrFT1[j];
+            const std::complex<double> &z2=ptrFT2[j];
+            double absz1=abs(z1);
+            double absz2=abs(z2);
+            num[idx] += real(conj(z1) * z2);
+            den1[idx] += absz1*absz1;
+            den2[idx] += absz2*absz2;
+            errorL2[idx] += abs(z1-z2);
+            count[idx] += 1;
+            if (R2>data.minFreq2 && R2<data.maxFreq2)
+            {
+                rFactorNumerator += fabs(absz1 - absz2);
+                rFactorDenominator += absz1;
+            }
+            if (data.dodpr)
+            {
+                double phaseDiff=atan2(z1.imag(),z1.real()) - atan2(z2.imag(),z2.real());
+                phaseDiff = RAD2DEG(phaseDiff);
+                phaseDiff = realWRAP(phaseDiff,-180, 180);
+                dpr[idx] += ((absz1+absz2)*phaseDiff*phaseDiff);
+                denDpr[idx] += (absz1+absz2);
+            }
+        }
+    }
+    sums[FRC_RFACTOR_NUM*nShells]=rFactorNumerator;
+    sums[FRC_RFACTOR_DEN*nShells]=rFactorDenominator;
+}
+
 void frc_dpr(MultidimArray< double > & m1,
              MultidimArray< double > & m2,
              double sampling_rate,
@@ -497,226 +1023,207 @@ void frc_dpr(MultidimArray< double > & m1,
 			 bool doRfactor,
 			 double minFreq,
 			 double maxFreq,
-                         double * rFactor)
+                         double * rFactor,
+                         int nThreads)
 {
     if (!m1.sameShape(m2))
         REPORT_ERROR(ERR_MULTIDIM_SIZE,"MultidimArrays have different shapes!");
 
     int m1sizeX = XSIZE(m1), m1sizeY = YSIZE(m1), m1sizeZ = ZSIZE(m1);
+    std::shared_ptr<const FourierShells> shells=FourierShells::getShells(m1sizeZ,m1sizeY,m1sizeX);
 
     MultidimArray< std::complex< double > > FT1;
     FourierTransformer transformer1(FFTW_BACKWARD);
+    transformer1.setThreadsNumber(nThreads);
     transformer1.FourierTransform(m1, FT1, false);
-
-//#define DEBUG
-#ifdef DEBUG
-     std::cerr << "FT1" << FT1 << std::endl; 
-#endif
-#undef DEBUG
-
-
     m1.clear(); // Free memory
 
     MultidimArray< std::complex< double > > FT2;
     FourierTransformer transformer2(FFTW_BACKWARD);
+    transformer2.setThreadsNumber(nThreads);
     transformer2.FourierTransform(m2, FT2, false);
     m2.clear(); // Free memory
 
-    MultidimArray< int > radial_count(m1sizeX/2+1);
-    MultidimArray<double> num, den1, den2, den_dpr;
-    Matrix1D<double> f(3);
-    //to calculate r-factor
-    double rFactorNumerator=0;
-    double rFactorDenominator=0;
-
-
-    num.initZeros(radial_count);
-    den1.initZeros(radial_count);
-    den2.initZeros(radial_count);
-
-    //dpr calculation takes for ever in large volumes
-    //since atan2 is called many times
-    //until atan2 is changed by a table let us make dpr an option
-    if (dodpr)
-    {
-        dpr.initZeros(radial_count);
-        den_dpr.initZeros(radial_count);
-    }
-    freq.initZeros(radial_count);
-    frc.initZeros(radial_count);
-    frc_noise.initZeros(radial_count);
-    error_l2.initZeros(radial_count);
-#ifdef SAVE_REAL_PART
-
-    std::vector<double> *realPart=
-        new std::vector<double>[XSIZE(radial_count)];
-#endif
-
-    int sizeZ_2 = m1sizeZ/2;
-    if (sizeZ_2==0)
-        sizeZ_2=1;
-    double isizeZ = 1.0/m1sizeZ;
-    int sizeY_2 = m1sizeY/2;
-    double iysize = 1.0/m1sizeY;
-    int sizeX_2 = m1sizeX/2;
-    double ixsize = 1.0/m1sizeX;
-    double R;
-
-    int ZdimFT1=(int)ZSIZE(FT1);
-    int YdimFT1=(int)YSIZE(FT1);
-    int XdimFT1=(int)XSIZE(FT1);
-
-    double maxFreq_2 =0.;
-    maxFreq_2 = maxFreq * maxFreq;
-    for (int k=0; k<ZdimFT1; k++)
-    {
-        FFT_IDX2DIGFREQ_FAST(k,m1sizeZ,sizeZ_2,isizeZ,ZZ(f));
-        double fz2=ZZ(f)*ZZ(f);
-        for (int i=0; i<YdimFT1; i++)
-        {
-            FFT_IDX2DIGFREQ_FAST(i,YSIZE(m1),sizeY_2, iysize, YY(f));
-            double fz2_fy2=fz2 + YY(f)*YY(f);
-            for (int j=0; j<XdimFT1; j++)
-            {
-                FFT_IDX2DIGFREQ_FAST(j,m1sizeX, sizeX_2, ixsize, XX(f));
-
-                double R2 =fz2_fy2 + XX(f)*XX(f);
-                if (R2>maxFreq_2)
-                    continue;
-
-                R = sqrt(R2);
-                int idx = (int)round(R * m1sizeX);
-                std::complex<double> &z1 = dAkij(FT1, k, i, j);
-                std::complex<double> &z2 = dAkij(FT2, k, i, j);
-                double absz1 = abs(z1);
-                double absz2 = abs(z2);
-                dAi(num,idx) += real(conj(z1) * z2);
-                dAi(den1,idx) += absz1*absz1;
-                dAi(den2,idx) += absz2*absz2;
-                dAi(error_l2,idx) += abs(z1-z2);
-                //for calculating r-factor
-                if ( R > minFreq && R < maxFreq)
-                {
-                	rFactorNumerator += fabs(absz1 - absz2);
-                	rFactorDenominator += absz1;
-                }
-
-                if (dodpr) //this takes to long for a huge volume
-                {
-                    double phaseDiff=atan2(z1.imag(),z1.real()) - atan2(z2.imag(),z2.real());
-                    phaseDiff = RAD2DEG(phaseDiff);
-                    phaseDiff = realWRAP(phaseDiff,-180, 180);
-                    dAi(dpr,idx) += ((absz1+absz2)*phaseDiff*phaseDiff);
-                    dAi(den_dpr,idx) += (absz1+absz2);
-#ifdef SAVE_REAL_PART
+    // All the sums are accumulated in a single pass
+    FRCThreadData data;
+    data.FT1=&FT1;
+    data.FT2=&FT2;
+    data.shells=shells.get();
+    data.minFreq2=(minFreq<0) ? -1 : minFreq*minFreq;
+    data.maxFreq2=maxFreq*maxFreq;
+    data.dodpr=dodpr;
+    data.nShells=m1sizeX/2+1;
+    int nShells=data.nShells;
+    nThreads=XMIPP_MAX(nThreads,1);
+    data.sums.assign(nThreads*FRC_NSUMS*nShells,0.);
+    runFourierRows(nThreads,&threadFRC,&data);
+    for (int thread=1; thread<nThreads; ++thread)
+        for (int n=0; n<FRC_NSUMS*nShells; ++n)
+            data.sums[n]+=data.sums[thread*FRC_NSUMS*nShells+n];
+    const double *sums=&data.sums[0];
 
-                    realPart[idx].push_back(z1.real());
-#endif
-
-                }
-                dAi(radial_count,idx)++;
-            }
-        }
-    }
     //to calculate r-factor
     if (doRfactor)
-    {
-    	//std::cout << "rFactorNumerator = " << rFactorNumerator << std::endl;
-    	//std::cout << "rFactorDenominator = " << rFactorDenominator << std::endl;
-    	*rFactor = rFactorNumerator / rFactorDenominator;
-        
-        //std::cout << "R-factor = " << rFactorValue << std::endl;
-        //*rFactor = rFactorValue;
-        //std::cout << "R-rFactor = " << *rFactor << std::endl;
-    }
+    	*rFactor = sums[FRC_RFACTOR_NUM*nShells] / sums[FRC_RFACTOR_DEN*nShells];
 
+    freq.initZeros(nShells);
+    frc.initZeros(nShells);
+    frc_noise.initZeros(nShells);
+    error_l2.initZeros(nShells);
+    if (dodpr)
+        dpr.initZeros(nShells);
     FOR_ALL_ELEMENTS_IN_ARRAY1D(freq)
     {
+        double count=sums[FRC_COUNT*nShells+i];
         dAi(freq,i) = (double) i / (m1sizeX * sampling_rate);
-        dAi(frc,i) = dAi(num,i)/sqrt(dAi(den1,i)*dAi(den2,i));
-        dAi(frc_noise,i) = 2 / sqrt((double) dAi(radial_count,i));
-        dAi(error_l2,i) /= dAi(radial_count,i);
+        dAi(frc,i) = sums[FRC_NUM*nShells+i]/sqrt(sums[FRC_DEN1*nShells+i]*sums[FRC_DEN2*nShells+i]);
+        dAi(frc_noise,i) = 2 / sqrt(count);
+        dAi(error_l2,i) = sums[FRC_ERROR_L2*nShells+i] / count;
 
         if (dodpr)
-            dAi(dpr,i) = sqrt(dAi(dpr,i) / dAi(den_dpr,i));
-#ifdef SAVE_REAL_PART
-
-        std::ofstream fhOut;
-        fhOut.open(((std::string)"PPP_RealPart_"+integerToString(i)+".txt").
-                   c_str());
-        for (int j=0; j<realPart[i].size(); j++)
-            fhOut << realPart[i][j] << std::endl;
-        fhOut.close();
-#endif
-
+            dAi(dpr,i) = sqrt(sums[FRC_DPR*nShells+i] / sums[FRC_DEN_DPR*nShells+i]);
     }
 }
 
-void scaleToSizeFourier(int Zdim, int Ydim, int Xdim, MultidimArray<double> &mdaIn, MultidimArray<double> &mdaOut, int nThreads)
+/** Copy the half Fourier transform of a Zin x Yin array into the one of a
+ * Zout x Yout array, cropping or padding with zeros the high frequencies,
+ * and multiplying by scale.
+ */
+template<typename T>
+static void cropPadFourier(const std::complex<T> *in, size_t Zin, size_t Yin, size_t XinFT,
+                           std::complex<T> *out, size_t Zout, size_t Yout, size_t XoutFT, T scale)
 {
-	//Mmem = *this
-    //memory for fourier transform output
-    MultidimArray<std::complex<double> > MmemFourier;
-    // Perform the Fourier transform
-    FourierTransformer transformerM;
-    transformerM.setThreadsNumber(nThreads);
-    transformerM.FourierTransform(mdaIn, MmemFourier, false);
+    size_t xsize = std::min(XinFT,XoutFT);
+    size_t yhalf = std::min(std::min(Yin/2,Yout/2),Yin-1);
+    size_t zhalf = std::min(std::min(Zin/2,Zout/2),Zin-1);
 
-    // Create space for the downsampled image and its Fourier transform
-    mdaOut.resizeNoCopy(Zdim, Ydim, Xdim);
-    MultidimArray<std::complex<double> > MpmemFourier;
-    FourierTransformer transformerMp;
-    transformerMp.setReal(mdaOut);
-    transformerMp.getFourierAlias(MpmemFourier);
+    size_t kpF=zhalf;
+    size_t ipF=yhalf;
+    size_t km0=Zin>=Zout?(kpF+1):(Zout-(Zin-(zhalf+1)));
+    size_t im0=Yin>=Yout?(ipF+1):(Yout-(Yin-(yhalf+1)));
 
-    scaleToSizeFourier(mdaIn, mdaOut, MmemFourier, MpmemFourier);
+    //Init with zero
+    std::fill(out, out + Zout*Yout*XoutFT, std::complex<T>());
 
-    // Transform data
-    transformerMp.inverseFourierTransform();
+    for (size_t k = 0; k<Zout; ++k)
+    {
+        size_t kp;
+        if (k<=kpF)
+            kp = k;
+        else if (k>=km0)
+            kp = k + Zin - Zout;
+        else
+            continue;
+        for (size_t i = 0; i<Yout; ++i)
+        {
+            size_t ip;
+            if (i<=ipF)
+                ip = i;
+            else if (i>=im0)
+                ip = i + Yin - Yout;
+            else
+                continue;
+            const std::complex<T> *ptrIn = in + (kp*Yin + ip)*XinFT;
+            std::complex<T> *ptrOut = out + (k*Yout + i)*XoutFT;
+            if (scale == 1)
+                memcpy(ptrOut, ptrIn, xsize*sizeof(std::complex<T>));
+            else
+                for (size_t j = 0; j<xsize; ++j)
+                    ptrOut[j] = ptrIn[j]*scale;
+        }
+    }
 }
 
-template void scaleToSizeFourier<double>(MultidimArray<double> &mdaIn, MultidimArray<double> &mdaOut,
-        MultidimArray<std::complex<double> > &inFourier, MultidimArray<std::complex<double> > &outFourier);
-
 template<typename T>
 void scaleToSizeFourier(MultidimArray<T> &mdaIn, MultidimArray<T> &mdaOut,
         MultidimArray<std::complex<T> > &inFourier, MultidimArray<std::complex<T> > &outFourier) {
-    size_t xsize = std::min(XSIZE(inFourier),XSIZE(outFourier))*sizeof(std::complex<T>);
-    size_t yhalf = std::min(std::min(YSIZE(mdaIn)/2,YSIZE(mdaOut)/2),YSIZE(mdaIn)-1);
-    size_t zhalf = std::min(std::min(ZSIZE(mdaIn)/2,ZSIZE(mdaOut)/2),ZSIZE(mdaIn)-1);
+    cropPadFourier(MULTIDIM_ARRAY(inFourier), ZSIZE(mdaIn), YSIZE(mdaIn), XSIZE(inFourier),
+                   MULTIDIM_ARRAY(outFourier), ZSIZE(mdaOut), YSIZE(mdaOut), XSIZE(outFourier), (T)1);
+}
 
-    size_t kp0=0;
-    size_t kpF=zhalf;
-    size_t ip0=0;
-    size_t ipF=yhalf;
-    size_t km0=ZSIZE(inFourier)>=ZSIZE(outFourier)?(kpF+1):(ZSIZE(outFourier)-(ZSIZE(inFourier)-(zhalf+1)));
-    size_t kmF=ZSIZE(outFourier)-1;
-    size_t im0=YSIZE(inFourier)>=YSIZE(outFourier)?(ipF+1):(YSIZE(outFourier)-(YSIZE(inFourier)-(yhalf+1)));
-    size_t imF=YSIZE(outFourier)-1;
+template void scaleToSizeFourier<double>(MultidimArray<double> &mdaIn, MultidimArray<double> &mdaOut,
+        MultidimArray<std::complex<double> > &inFourier, MultidimArray<std::complex<double> > &outFourier);
 
-    //Init with zero
-    outFourier.initZeros();
+template<typename T>
+static void fourierResize(const MultidimArray<T> &in, MultidimArray<T> &out,
+                          size_t Zdim, size_t Ydim, size_t Xdim, int nThreads, size_t batchSize,
+                          MultidimArray< std::complex<T> > &inFourier,
+                          MultidimArray< std::complex<T> > &outFourier)
+{
+    typedef FFTWPrecision<T> Precision;
+    if (&in == &out)
+    {
+        MultidimArray<T> aux(in);
+        fourierResize(aux, out, Zdim, Ydim, Xdim, nThreads, batchSize, inFourier, outFourier);
+        return;
+    }
 
-    for (size_t k = kp0; k<=kpF; ++k)
+    size_t N=NSIZE(in);
+    out.resizeNoCopy(N, Zdim, Ydim, Xdim);
+    if (ZSIZE(in)==Zdim && YSIZE(in)==Ydim && XSIZE(in)==Xdim)
     {
-        for (size_t i=ip0; i<=ipF; ++i)
-            memcpy(&dAkij(outFourier,k,i,0),&dAkij(inFourier,k,i,0),xsize);
-        for (size_t i=im0; i<=imF; ++i) {
-            size_t ip = i + YSIZE(inFourier)-YSIZE(outFourier) ;
-            memcpy(&dAkij(outFourier,k,i,0),&dAkij(inFourier,k,ip,0),xsize);
-        }
+        memcpy(MULTIDIM_ARRAY(out), MULTIDIM_ARRAY(in), MULTIDIM_SIZE(in)*sizeof(T));
+        return;
     }
-    for (size_t k = km0; k<=kmF; ++k) {
-        size_t kp = k + ZSIZE(inFourier)-ZSIZE(outFourier) ;
-        for (size_t i=ip0; i<=ipF; ++i)
-            memcpy(&dAkij(outFourier,k,i,0),&dAkij(inFourier,kp,i,0),xsize);
-        for (size_t i=im0; i<=imF; ++i) {
-            size_t ip = i + YSIZE(inFourier)-YSIZE(outFourier) ;
-            memcpy(&dAkij(outFourier,k,i,0),&dAkij(inFourier,kp,ip,0),xsize);
-        }
+
+    FFTWPlanKey keyIn, keyOut;
+    keyIn.ndim=fftwDimensions(in, keyIn.N);
+    keyOut.ndim=fftwDimensions(out, keyOut.N);
+    keyOut.sign=FFTW_BACKWARD;
+    keyIn.nthreads=keyOut.nthreads=nThreads;
+    keyIn.rigor=keyOut.rigor=FFTWPlanCache::getPlanningRigor();
+    size_t XinFT=XSIZE(in)/2+1, XoutFT=Xdim/2+1;
+    size_t inFourierSize=ZSIZE(in)*YSIZE(in)*XinFT, outFourierSize=Zdim*Ydim*XoutFT;
+    // The forward transform is normalized while cropping
+    T scale=(T)(1.0/in.zyxdim);
+
+    batchSize=XMIPP_MAX(batchSize,1);
+    for (size_t n0=0; n0<N; n0+=batchSize)
+    {
+        size_t n=XMIPP_MIN(batchSize, N-n0);
+        inFourier.resizeNoCopy(n, ZSIZE(in), YSIZE(in), XinFT);
+        outFourier.resizeNoCopy(n, Zdim, Ydim, XoutFT);
+        T *ptrIn=(T*)MULTIDIM_ARRAY(in)+n0*in.zyxdim;
+        T *ptrOut=MULTIDIM_ARRAY(out)+n0*out.zyxdim;
+
+        keyIn.howmany=keyOut.howmany=n;
+        keyIn.aligned=Precision::aligned(ptrIn, MULTIDIM_ARRAY(inFourier));
+        keyOut.aligned=Precision::aligned(MULTIDIM_ARRAY(outFourier), ptrOut);
+        typename Precision::Plan planForward=Precision::getPlan(keyIn, ptrIn, MULTIDIM_ARRAY(inFourier));
+        typename Precision::Plan planBackward=Precision::getPlan(keyOut, MULTIDIM_ARRAY(outFourier), ptrOut);
+
+        Precision::forward(planForward, ptrIn, MULTIDIM_ARRAY(inFourier));
+        for (size_t i=0; i<n; ++i)
+            cropPadFourier(MULTIDIM_ARRAY(inFourier)+i*inFourierSize, ZSIZE(in), YSIZE(in), XinFT,
+                           MULTIDIM_ARRAY(outFourier)+i*outFourierSize, Zdim, Ydim, XoutFT, scale);
+        Precision::backward(planBackward, MULTIDIM_ARRAY(outFourier), ptrOut);
     }
 }
 
+FourierResizer::FourierResizer(int _nThreads, size_t _batchSize)
+{
+    nThreads=_nThreads;
+    batchSize=_batchSize;
+}
+
+void FourierResizer::resize(const MultidimArray<double> &in, MultidimArray<double> &out,
+                            size_t Zdim, size_t Ydim, size_t Xdim)
+{
+    fourierResize(in, out, Zdim, Ydim, Xdim, nThreads, batchSize, inFourier, outFourier);
+}
+
+void FourierResizer::resize(const MultidimArray<float> &in, MultidimArray<float> &out,
+                            size_t Zdim, size_t Ydim, size_t Xdim)
+{
+    fourierResize(in, out, Zdim, Ydim, Xdim, nThreads, batchSize, inFourierFloat, outFourierFloat);
+}
+
+void scaleToSizeFourier(int Zdim, int Ydim, int Xdim, MultidimArray<double> &mdaIn, MultidimArray<double> &mdaOut, int nThreads)
+{
+    FourierResizer resizer(nThreads);
+    resizer.resize(mdaIn, mdaOut, Zdim, Ydim, Xdim);
+}
+
 void selfScaleToSizeFourier(int Zdim, int Ydim, int Xdim, MultidimArray<double> &mda, int nThreads)
 {
   MultidimArray<double> aux;
@@ -746,45 +1253,83 @@ void selfScaleToSizeFourier(int Ydim, int Xdim, MultidimArrayGeneric &Mpmem, int
     Mpmem.setImage(aux);
 }
 
+struct SpectrumThreadData
+{
+    MultidimArray< std::complex<double> > *F;
+    const FourierShells *shells;
+    // Spectrum: type and sum and count of each shell for each thread
+    int spectrum_type;
+    std::vector<double> sums;
+    // Multiplication by a spectrum
+    const MultidimArray<double> *spectrum;
+    double factor;
+};
+
+static void threadGetSpectrum(ThreadArgument &thArg)
+{
+    SpectrumThreadData &data=*((SpectrumThreadData *)thArg.data);
+    const FourierShells &shells=*data.shells;
+    size_t YdimFT=YSIZE(shells.shell), XdimFT=XSIZE(shells.shell);
+    size_t r0, r1;
+    fourierRowsOfThread(thArg, ZSIZE(shells.shell)*YdimFT, r0, r1);
+
+    int nShells=shells.Xdim;
+    double *sum=&data.sums[thArg.thread_id*2*nShells];
+    double *count=sum+nShells;
+    const int *ptrShell=MULTIDIM_ARRAY(shells.shell)+r0*XdimFT;
+    const std::complex<double> *ptrF=MULTIDIM_ARRAY(*data.F)+r0*XdimFT;
+    for (size_t n=r0*XdimFT; n<r1*XdimFT; ++n, ++ptrShell, ++ptrF)
+    {
+        int idx=*ptrShell;
+        if (idx>=nShells)
+            continue;
+        double F=abs(*ptrF);
+        if (data.spectrum_type == AMPLITUDE_SPECTRUM)
+            sum[idx] += F;
+        else
+            sum[idx] += F*F;
+        count[idx] += 1.;
+    }
+}
+
 void getSpectrum(MultidimArray<double> &Min,
                  MultidimArray<double> &spectrum,
-                 int spectrum_type)
+                 int spectrum_type,
+                 int nThreads)
 {
     MultidimArray<std::complex<double> > Faux;
     int xsize = XSIZE(Min);
-    Matrix1D<double> f(3);
-    MultidimArray<double> count(xsize);
     FourierTransformer transformer;
+    transformer.setThreadsNumber(nThreads);
+    transformer.FourierTransform(Min, Faux, false);
+    std::shared_ptr<const FourierShells> shells=FourierShells::getShells(ZSIZE(Min),YSIZE(Min),XSIZE(Min));
+
+    SpectrumThreadData data;
+    data.F=&Faux;
+    data.shells=shells.get();
+    data.spectrum_type=spectrum_type;
+    nThreads=XMIPP_MAX(nThreads,1);
+    data.sums.assign(nThreads*2*xsize,0.);
+    runFourierRows(nThreads,&threadGetSpectrum,&data);
 
     spectrum.initZeros(xsize);
-    count.initZeros();
-    transformer.FourierTransform(Min, Faux, false);
-    if (ZSIZE(Faux)==1)
-    	ZZ(f)=0;
-    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(Faux)
-    {
-        FFT_IDX2DIGFREQ(j,xsize,XX(f));
-        FFT_IDX2DIGFREQ(i,YSIZE(Faux),YY(f));
-        if (ZSIZE(Faux)>1)
-        	FFT_IDX2DIGFREQ(k,ZSIZE(Faux),ZZ(f));
-        double R=f.module();
-        //if (R>0.5) continue;
-        int idx = round(R*xsize);
-        double F=abs(dAkij(Faux, k, i, j));
-        if (spectrum_type == AMPLITUDE_SPECTRUM)
-            A1D_ELEM(spectrum,idx) += F;
-        else
-            A1D_ELEM(spectrum,idx) += F*F;
-        A1D_ELEM(count,idx) += 1.;
-    }
     for (int i = 0; i < xsize; i++)
-        if (A1D_ELEM(count,i) > 0.)
-            A1D_ELEM(spectrum,i) /= A1D_ELEM(count,i);
+    {
+        double sum=0., count=0.;
+        for (int thread=0; thread<nThreads; ++thread)
+        {
+            sum += data.sums[thread*2*xsize+i];
+            count += data.sums[thread*2*xsize+xsize+i];
+        }
+        if (count > 0.)
+            A1D_ELEM(spectrum,i) = sum/count;
+    }
 }
 
 void divideBySpectrum(MultidimArray<double> &Min,
                       MultidimArray<double> &spectrum,
-                      bool leave_origin_intact)
+                      bool leave_origin_intact,
+                      int nThreads)
 {
 
     Min.checkDimension(3);
@@ -797,49 +1342,70 @@ void divideBySpectrum(MultidimArray<double> &Min,
         else
             dAi(div_spec,i) = 1.;
     }
-    multiplyBySpectrum(Min,div_spec,leave_origin_intact);
+    multiplyBySpectrum(Min,div_spec,leave_origin_intact,nThreads);
+}
+
+static void threadMultiplyBySpectrum(ThreadArgument &thArg)
+{
+    SpectrumThreadData &data=*((SpectrumThreadData *)thArg.data);
+    const FourierShells &shells=*data.shells;
+    size_t XdimFT=XSIZE(shells.shell);
+    size_t r0, r1;
+    fourierRowsOfThread(thArg, ZSIZE(shells.shell)*YSIZE(shells.shell), r0, r1);
+
+    const MultidimArray<double> &spectrum=*data.spectrum;
+    int nShells=XSIZE(spectrum);
+    const int *ptrShell=MULTIDIM_ARRAY(shells.shell)+r0*XdimFT;
+    std::complex<double> *ptrF=MULTIDIM_ARRAY(*data.F)+r0*XdimFT;
+    for (size_t n=r0*XdimFT; n<r1*XdimFT; ++n, ++ptrShell, ++ptrF)
+    {
+        int idx=*ptrShell;
+        if (idx>=nShells)
+            continue;
+        *ptrF *= A1D_ELEM(spectrum,idx) * data.factor;
+    }
 }
 
 void multiplyBySpectrum(MultidimArray<double> &Min,
                         MultidimArray<double> &spectrum,
-                        bool leave_origin_intact)
+                        bool leave_origin_intact,
+                        int nThreads)
 {
     Min.checkDimension(3);
 
     MultidimArray<std::complex<double> > Faux;
-    Matrix1D<double> f(3);
     MultidimArray<double> lspectrum;
     FourierTransformer transformer;
+    transformer.setThreadsNumber(nThreads);
     double dim3 = XSIZE(Min)*YSIZE(Min)*ZSIZE(Min);
 
     transformer.FourierTransform(Min, Faux, false);
     lspectrum=spectrum;
     if (leave_origin_intact)
         lspectrum(0)=1.;
-    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(Faux)
-    {
-        FFT_IDX2DIGFREQ(j,XSIZE(Min), XX(f));
-        FFT_IDX2DIGFREQ(i,YSIZE(Faux),YY(f));
-        FFT_IDX2DIGFREQ(k,ZSIZE(Faux),ZZ(f));
-        double R=f.module();
-        //if (R > 0.5) continue;
-        int idx=ROUND(R*XSIZE(Min));
-        dAkij(Faux, k, i, j) *=  lspectrum(idx) * dim3;
-    }
+    std::shared_ptr<const FourierShells> shells=FourierShells::getShells(ZSIZE(Min),YSIZE(Min),XSIZE(Min));
+
+    SpectrumThreadData data;
+    data.F=&Faux;
+    data.shells=shells.get();
+    data.spectrum=&lspectrum;
+    data.factor=dim3;
+    runFourierRows(nThreads,&threadMultiplyBySpectrum,&data);
     transformer.inverseFourierTransform();
 }
 
 void whitenSpectrum(MultidimArray<double> &Min,
                     MultidimArray<double> &Mout,
                     int spectrum_type,
-                    bool leave_origin_intact)
+                    bool leave_origin_intact,
+                    int nThreads)
 {
     Min.checkDimension(3);
 
     MultidimArray<double> spectrum;
-    getSpectrum(Min,spectrum,spectrum_type);
+    getSpectrum(Min,spectrum,spectrum_type,nThreads);
     Mout=Min;
-    divideBySpectrum(Mout,spectrum,leave_origin_intact);
+    divideBySpectrum(Mout,spectrum,leave_origin_intact,nThreads);
 
 }
 
@@ -847,39 +1413,31 @@ void adaptSpectrum(MultidimArray<double> &Min,
                    MultidimArray<double> &Mout,
                    const MultidimArray<double> &spectrum_ref,
                    int spectrum_type,
-                   bool leave_origin_intact)
+                   bool leave_origin_intact,
+                   int nThreads)
 {
 
     Min.checkDimension(3);
 
     MultidimArray<double> spectrum;
-    getSpectrum(Min,spectrum,spectrum_type);
+    getSpectrum(Min,spectrum,spectrum_type,nThreads);
     FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(spectrum)
     {
         dAi(spectrum, i) = (dAi(spectrum, i) > 0.) ? dAi(spectrum_ref,i)/ dAi(spectrum, i) : 1.;
     }
     Mout=Min;
-    multiplyBySpectrum(Mout,spectrum,leave_origin_intact);
+    multiplyBySpectrum(Mout,spectrum,leave_origin_intact,nThreads);
 
 }
 
-void correlation_matrix(const MultidimArray<double> & m1,
-                        const MultidimArray<double> & m2,
-                        MultidimArray< double >& R,
-                        CorrelationAux &aux,
-                        bool center)
-{
-    aux.transformer1.FourierTransform((MultidimArray<double> &)m1, aux.FFT1, false);
-    correlation_matrix(aux.FFT1,m2,R,aux,center);
-}
-
-void correlationInFourier(const MultidimArray< std::complex< double > > & FF1, MultidimArray< std::complex< double > > & FF2, double dSize)
+template<typename Real>
+static void correlationInFourier(const MultidimArray< std::complex< Real > > & FF1, MultidimArray< std::complex< Real > > & FF2, Real dSize)
 {
     // Multiply FFT1 * FFT2'
-    double mdSize=-dSize;
-    double a, b, c, d; // a+bi, c+di
-    double *ptrFFT2=(double*)MULTIDIM_ARRAY(FF2);
-    double *ptrFFT1=(double*)MULTIDIM_ARRAY(FF1);
+    Real mdSize=-dSize;
+    Real a, b, c, d; // a+bi, c+di
+    Real *ptrFFT2=(Real*)MULTIDIM_ARRAY(FF2);
+    const Real *ptrFFT1=(const Real*)MULTIDIM_ARRAY(FF1);
     FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(FF1)
     {
         a=*ptrFFT1++;
@@ -891,6 +1449,45 @@ void correlationInFourier(const MultidimArray< std::complex< double > > & FF1, M
     }
 }
 
+template<typename Real>
+static void correlationMatrix(const MultidimArray< std::complex< Real > > & FF1,
+                              const MultidimArray<Real> & m2,
+                              MultidimArray<Real>& R,
+                              CorrelationAuxT<Real> &aux,
+                              bool center)
+{
+    R=m2;
+    aux.transformer2.FourierTransform(R, aux.FFT2, false);
+    correlationInFourier(FF1,aux.FFT2,(Real)MULTIDIM_SIZE(R));
+    aux.transformer2.inverseFourierTransform();
+    if (center)
+        CenterFFT(R, true);
+}
+
+template<typename Real>
+static void correlationMatrix(const MultidimArray< std::complex< Real > > & FFT1,
+                              const MultidimArray< std::complex< Real > > & FFT2,
+                              MultidimArray<Real>& R,
+                              CorrelationAuxT<Real> &aux,
+                              bool center)
+{
+	aux.transformer2.setReal(R);
+	aux.transformer2.setFourier(FFT2);
+    correlationInFourier(FFT1,aux.transformer2.fFourier,(Real)MULTIDIM_SIZE(R));
+    aux.transformer2.inverseFourierTransform();
+    if (center)
+        CenterFFT(R, true);
+}
+
+void correlation_matrix(const MultidimArray<double> & m1,
+                        const MultidimArray<double> & m2,
+                        MultidimArray< double >& R,
+                        CorrelationAux &aux,
+                        bool center)
+{
+    aux.transformer1.FourierTransform((MultidimArray<double> &)m1, aux.FFT1, false);
+    correlationMatrix(aux.FFT1,m2,R,aux,center);
+}
 
 void correlation_matrix(const MultidimArray< std::complex< double > > & FF1,
                         const MultidimArray<double> & m2,
@@ -898,12 +1495,7 @@ void correlation_matrix(const MultidimArray< std::complex< double > > & FF1,
                         CorrelationAux &aux,
                         bool center)
 {
-    R=m2;
-    aux.transformer2.FourierTransform(R, aux.FFT2, false);
-    correlationInFourier(FF1,aux.FFT2,MULTIDIM_SIZE(R));
-    aux.transformer2.inverseFourierTransform();
-    if (center)
-        CenterFFT(R, true);
+    correlationMatrix(FF1,m2,R,aux,center);
 }
 
 void correlation_matrix(const MultidimArray< std::complex< double > > & FFT1,
@@ -912,12 +1504,35 @@ void correlation_matrix(const MultidimArray< std::complex< double > > & FFT1,
                         CorrelationAux &aux,
                         bool center)
 {
-	aux.transformer2.setReal(R);
-	aux.transformer2.setFourier(FFT2);
-    correlationInFourier(FFT1,aux.transformer2.fFourier,MULTIDIM_SIZE(R));
-    aux.transformer2.inverseFourierTransform();
-    if (center)
-        CenterFFT(R, true);
+    correlationMatrix(FFT1,FFT2,R,aux,center);
+}
+
+void correlation_matrix(const MultidimArray<float> & m1,
+                        const MultidimArray<float> & m2,
+                        MultidimArray<float>& R,
+                        CorrelationAuxFloat &aux,
+                        bool center)
+{
+    aux.transformer1.FourierTransform((MultidimArray<float> &)m1, aux.FFT1, false);
+    correlationMatrix(aux.FFT1,m2,R,aux,center);
+}
+
+void correlation_matrix(const MultidimArray< std::complex< float > > & FF1,
+                        const MultidimArray<float> & m2,
+                        MultidimArray<float>& R,
+                        CorrelationAuxFloat &aux,
+                        bool center)
+{
+    correlationMatrix(FF1,m2,R,aux,center);
+}
+
+void correlation_matrix(const MultidimArray< std::complex< float > > & FFT1,
+                        const MultidimArray< std::complex< float > > & FFT2,
+                        MultidimArray<float>& R,
+                        CorrelationAuxFloat &aux,
+                        bool center)
+{
+    correlationMatrix(FFT1,FFT2,R,aux,center);
 }
 
 void fast_correlation_vector(const MultidimArray< std::complex<double> > & FFT1,
@@ -951,19 +1566,160 @@ void fast_correlation_vector(const MultidimArray< std::complex<double> > & FFT1,
 }
 
 /** Fast autocorrelation matrix */
-void auto_correlation_matrix(const MultidimArray<double> & Img, MultidimArray< double >& R, CorrelationAux &aux)
+// Correlation engine ------------------------------------------------------
+// Number of Fourier coefficients of an image multiplied by all the
+// references before moving to the next ones
+#define CORRELATION_BLOCK 1024
+
+/** Logical index of i after centering an array of size n */
+static inline int centeredIndex(size_t i, size_t n)
+{
+    return (int)((i + n/2) % n) - (int)(n/2);
+}
+
+FourierCorrelationEngine::FourierCorrelationEngine():
+        imgTransformer(FFTW_FORWARD), corrTransformer(FFTW_FORWARD)
+{
+    nthreads=1;
+}
+
+void FourierCorrelationEngine::setThreadsNumber(int tNumber)
+{
+    nthreads=tNumber;
+    imgTransformer.setThreadsNumber(tNumber);
+    corrTransformer.setThreadsNumber(tNumber);
+}
+
+void FourierCorrelationEngine::setReferences(const MultidimArray<double> &refs)
+{
+    // The real to complex transform does not modify its input
+    FourierTransformerStack transformer;
+    transformer.setThreadsNumber(nthreads);
+    transformer.FourierTransform((MultidimArray<double> &)refs, refFourier, true);
+    conjImg.resizeNoCopy(ZSIZE(refFourier), YSIZE(refFourier), XSIZE(refFourier));
+    corrStack.resizeNoCopy(NSIZE(refs), ZSIZE(refs), YSIZE(refs), XSIZE(refs));
+}
+
+void FourierCorrelationEngine::transformImages(const MultidimArray<double> &imgs)
+{
+    if (NSIZE(refFourier)==0)
+        REPORT_ERROR(ERR_VALUE_EMPTY, "FourierCorrelationEngine: references have not been set");
+    if (XSIZE(imgs)!=XSIZE(corrStack) || YSIZE(imgs)!=YSIZE(corrStack) || ZSIZE(imgs)!=ZSIZE(corrStack))
+        REPORT_ERROR(ERR_MULTIDIM_SIZE, "FourierCorrelationEngine: images and references have different sizes");
+    imgTransformer.setReal((MultidimArray<double> &)imgs);
+    imgTransformer.FourierTransform();
+}
+
+void FourierCorrelationEngine::multiplyReferences(const std::complex<double> *imgFourier, double dSize,
+        std::complex<double> *result)
+{
+    size_t L=refFourier.zyxdim;
+    size_t M=NSIZE(refFourier);
+
+    // Conjugate of the image, scaled as in correlationInFourier
+    const double *ptrImg=(const double*)imgFourier;
+    double *ptrConj=(double*)MULTIDIM_ARRAY(conjImg);
+    for (size_t l=0; l<2*L; l+=2)
+    {
+        ptrConj[l]=ptrImg[l]*dSize;
+        ptrConj[l+1]=-ptrImg[l+1]*dSize;
+    }
+
+    // Each block of the image is multiplied by all the references while it is in cache
+    const double *ptrRefs=(const double*)MULTIDIM_ARRAY(refFourier);
+    double *ptrResult=(double*)result;
+    for (size_t l0=0; l0<L; l0+=CORRELATION_BLOCK)
+    {
+        size_t l1=XMIPP_MIN(l0+CORRELATION_BLOCK, L);
+        for (size_t m=0; m<M; ++m)
+        {
+            const double *ptrRef=ptrRefs+2*m*L;
+            double *ptrOut=ptrResult+2*m*L;
+            for (size_t l=2*l0; l<2*l1; l+=2)
+            {
+                double a=ptrRef[l];
+                double b=ptrRef[l+1];
+                double c=ptrConj[l];
+                double d=ptrConj[l+1];
+                ptrOut[l]  =a*c-b*d;
+                ptrOut[l+1]=b*c+a*d;
+            }
+        }
+    }
+}
+
+void FourierCorrelationEngine::correlate(const MultidimArray<double> &imgs, MultidimArray<double> &R,
+        bool center)
+{
+    transformImages(imgs);
+    size_t N=NSIZE(imgs);
+    size_t M=size();
+    R.resizeNoCopy(N*M, ZSIZE(imgs), YSIZE(imgs), XSIZE(imgs));
+
+    MultidimArray<double> Rn, map;
+    const std::complex<double> *ptrImgFourier=MULTIDIM_ARRAY(imgTransformer.fFourier);
+    for (size_t n=0; n<N; ++n, ptrImgFourier+=refFourier.zyxdim)
+    {
+        aliasImages(R, n*M, M, Rn);
+        corrTransformer.setReal(Rn);
+        multiplyReferences(ptrImgFourier, imgs.zyxdim, MULTIDIM_ARRAY(corrTransformer.fFourier));
+        corrTransformer.inverseFourierTransform();
+        if (center)
+            for (size_t m=0; m<M; ++m)
+            {
+                aliasImages(Rn, m, 1, map);
+                CenterFFT(map, true);
+            }
+    }
+}
+
+void FourierCorrelationEngine::correlationPeaks(const MultidimArray<double> &imgs,
+        std::vector<CorrelationPeak> &peaks)
+{
+    transformImages(imgs);
+    size_t N=NSIZE(imgs);
+    size_t M=size();
+    peaks.resize(N*M);
+
+    size_t xdim=XSIZE(imgs), ydim=YSIZE(imgs), zdim=ZSIZE(imgs), yxdim=ydim*xdim;
+    const std::complex<double> *ptrImgFourier=MULTIDIM_ARRAY(imgTransformer.fFourier);
+    for (size_t n=0; n<N; ++n, ptrImgFourier+=refFourier.zyxdim)
+    {
+        corrTransformer.setReal(corrStack);
+        multiplyReferences(ptrImgFourier, imgs.zyxdim, MULTIDIM_ARRAY(corrTransformer.fFourier));
+        corrTransformer.inverseFourierTransform();
+
+        // The maximum is searched in the uncentered map
+        const double *ptrMap=MULTIDIM_ARRAY(corrStack);
+        for (size_t m=0; m<M; ++m, ptrMap+=corrStack.zyxdim)
+        {
+            size_t imax=0;
+            for (size_t l=1; l<corrStack.zyxdim; ++l)
+                if (ptrMap[l]>ptrMap[imax])
+                    imax=l;
+            CorrelationPeak &peak=peaks[n*M+m];
+            peak.value=ptrMap[imax];
+            peak.shiftZ=centeredIndex(imax/yxdim, zdim);
+            peak.shiftY=centeredIndex((imax%yxdim)/xdim, ydim);
+            peak.shiftX=centeredIndex(imax%xdim, xdim);
+        }
+    }
+}
+
+template<typename Real>
+static void autoCorrelationMatrix(const MultidimArray<Real> & Img, MultidimArray<Real>& R, CorrelationAuxT<Real> &aux)
 {
     // Compute the Fourier Transform
     R=Img;
     aux.transformer1.FourierTransform(R, aux.FFT1, false);
 
     // Multiply FFT1 * FFT1'
-    double dSize=MULTIDIM_SIZE(Img);
+    Real dSize=MULTIDIM_SIZE(Img);
     FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(aux.FFT1)
     {
-        double *ptr=(double*)&DIRECT_MULTIDIM_ELEM(aux.FFT1,n);
-        double &realPart=*ptr;
-        double &imagPart=*(ptr+1);
+        Real *ptr=(Real*)&DIRECT_MULTIDIM_ELEM(aux.FFT1,n);
+        Real &realPart=*ptr;
+        Real &imagPart=*(ptr+1);
         realPart=dSize*(realPart*realPart+imagPart*imagPart);
         imagPart=0;
     }
@@ -975,6 +1731,16 @@ void auto_correlation_matrix(const MultidimArray<double> & Img, MultidimArray< d
     CenterFFT(R, true);
 }
 
+void auto_correlation_matrix(const MultidimArray<double> & Img, MultidimArray< double >& R, CorrelationAux &aux)
+{
+    autoCorrelationMatrix(Img, R, aux);
+}
+
+void auto_correlation_matrix(const MultidimArray<float> & Img, MultidimArray< float >& R, CorrelationAuxFloat &aux)
+{
+    autoCorrelationMatrix(Img, R, aux);
+}
+
 void randomizePhases(MultidimArray<double> &Min, double wRandom)
 {
 	FourierTransformer transformer;
@@ -28,10 +28,12 @@
 #define _CORE__XmippFFTW_H
 
 #include <complex>
+#include <memory>
 #include "fftw3.h"
 #include "multidim_array.h"
 #include "multidim_array_generic.h"
 #include "xmipp_fft.h"
+#include "xmipp_filename.h"
 
 
 /** @defgroup FourierW FFTW Fourier transforms
@@ -39,41 +41,225 @@
   *@{
   */
 
-/** Fourier Transformer class.
+/** Description of a plan in the FFTW plan cache.
+ * @ingroup FourierW
+ */
+struct FFTWPlanKey
+{
+    /* Real to complex (or complex to real) transform, otherwise complex to complex */
+    bool realData;
+
+    /* FFTW_FORWARD or FFTW_BACKWARD */
+    int sign;
+
+    /* Dimensions as given to FFTW, the slowest one first */
+    int ndim;
+    int N[3];
+
+    /* Number of arrays transformed at once, stored one after the other */
+    int howmany;
+
+    /* Number of threads of the plan */
+    int nthreads;
+
+    /* FFTW_ESTIMATE, FFTW_MEASURE or FFTW_PATIENT */
+    unsigned rigor;
+
+    /* Input and output arrays aligned as fftw_malloc aligns them */
+    bool aligned;
+
+    /** Empty key */
+    FFTWPlanKey();
+
+    /** Order of the keys in the cache */
+    bool operator<(const FFTWPlanKey &other) const;
+
+    /** Same key */
+    bool operator==(const FFTWPlanKey &other) const;
+};
+
+/** Process wide cache of FFTW plans.
+ * @ingroup FourierW
+ *
+ * A plan is created once for each shape, direction, precision, number of
+ * threads and alignment, and it is executed with the new-array execute
+ * functions of FFTW on the arrays of each transformer. Thus, all the
+ * transformers of the same size share their plans and a transformer does
+ * not replan when its input array changes.
+ *
+ * Plans are computed with FFTW_ESTIMATE unless a higher rigor is set.
+ * Measured plans are computed on scratch arrays, so the data of the caller
+ * is not overwritten. The wisdom accumulated by FFTW can be exported and
+ * imported, so that later jobs with the same sizes start with tuned plans.
+ *
+ * @code
+ * FFTWPlanCache::importWisdom("fftw.wisdom");
+ * FFTWPlanCache::setPlanningRigor(FFTW_MEASURE);
+ * ... Fourier transforms ...
+ * FFTWPlanCache::exportWisdom("fftw.wisdom");
+ * @endcode
+ */
+class FFTWPlanCache
+{
+public:
+    /** Planning rigor of the plans created from now on:
+     * FFTW_ESTIMATE (default), FFTW_MEASURE or FFTW_PATIENT.
+     */
+    static void setPlanningRigor(unsigned rigor);
+
+    /** Current planning rigor */
+    static unsigned getPlanningRigor();
+
+    /** Double precision plan for the key.
+     * in and out are only used to plan with FFTW_ESTIMATE,
+     * they are not modified.
+     */
+    static fftw_plan getPlan(const FFTWPlanKey &key, void *in, void *out);
+
+    /** Single precision plan for the key */
+    static fftwf_plan getPlanFloat(const FFTWPlanKey &key, void *in, void *out);
+
+    /** Destroy all the plans and reset FFTW to its initial state.
+     * Transformers obtain new plans in their next transform. No transform
+     * can be running while the cache is cleared.
+     */
+    static void clear();
+
+    /** Number of times the cache has been cleared.
+     * Plans obtained in a previous generation are no longer valid.
+     */
+    static int generation();
+
+    /** Load the wisdom of a previous job.
+     * The single precision wisdom is read from fn.float.
+     * Returns false if no wisdom could be read.
+     */
+    static bool importWisdom(const FileName &fn);
+
+    /** Save the accumulated wisdom, see importWisdom */
+    static void exportWisdom(const FileName &fn);
+}
+;//end of class FFTWPlanCache
+
+/** Plans and execution of FFTW in each precision.
+ * @ingroup FourierW
+ *
+ * FFTWPrecision<double> calls the fftw functions and FFTWPrecision<float>
+ * the fftwf ones, so that the transformers are written once for both.
+ */
+template<typename T>
+struct FFTWPrecision;
+
+template<>
+struct FFTWPrecision<double>
+{
+    typedef fftw_plan Plan;
+    static Plan getPlan(const FFTWPlanKey &key, void *in, void *out)
+    {
+        return FFTWPlanCache::getPlan(key, in, out);
+    }
+    static bool aligned(void *in, void *out)
+    {
+        return fftw_alignment_of((double*)in)==0 && fftw_alignment_of((double*)out)==0;
+    }
+    static void forward(Plan plan, double *in, std::complex<double> *out)
+    {
+        fftw_execute_dft_r2c(plan, in, (fftw_complex*)out);
+    }
+    static void backward(Plan plan, std::complex<double> *in, double *out)
+    {
+        fftw_execute_dft_c2r(plan, (fftw_complex*)in, out);
+    }
+    static void execute(Plan plan, std::complex<double> *in, std::complex<double> *out)
+    {
+        fftw_execute_dft(plan, (fftw_complex*)in, (fftw_complex*)out);
+    }
+    static int initThreads()
+    {
+        return fftw_init_threads();
+    }
+    static void planWithNthreads(int nthreads)
+    {
+        fftw_plan_with_nthreads(nthreads);
+    }
+};
+
+template<>
+struct FFTWPrecision<float>
+{
+    typedef fftwf_plan Plan;
+    static Plan getPlan(const FFTWPlanKey &key, void *in, void *out)
+    {
+        return FFTWPlanCache::getPlanFloat(key, in, out);
+    }
+    static bool aligned(void *in, void *out)
+    {
+        return fftwf_alignment_of((float*)in)==0 && fftwf_alignment_of((float*)out)==0;
+    }
+    static void forward(Plan plan, float *in, std::complex<float> *out)
+    {
+        fftwf_execute_dft_r2c(plan, in, (fftwf_complex*)out);
+    }
+    static void backward(Plan plan, std::complex<float> *in, float *out)
+    {
+        fftwf_execute_dft_c2r(plan, (fftwf_complex*)in, out);
+    }
+    static void execute(Plan plan, std::complex<float> *in, std::complex<float> *out)
+    {
+        fftwf_execute_dft(plan, (fftwf_complex*)in, (fftwf_complex*)out);
+    }
+    static int initThreads()
+    {
+        return fftwf_init_threads();
+    }
+    static void planWithNthreads(int nthreads)
+    {
+        fftwf_plan_with_nthreads(nthreads);
+    }
+};
+
+/** Fourier Transformer class, in double or single precision.
  * @ingroup FourierW
  *
  * The memory for the Fourier transform is handled by this object.
  * However, the memory for the real space image is handled externally
  * and this object only has a pointer to it.
  *
+ * Real is double (FourierTransformer) or float (FourierTransformerFloat).
+ * The plans are taken from FFTWPlanCache in the precision of Real.
+ *
  * Here you have an example of use
  * @code
  * FourierTransformer transformer;
- * MultidimArray< std::complex<double> > Vfft;
+ * MultidimArray< std::complex<Real> > Vfft;
  * transformer.FourierTransform(V(),Vfft,false);
- * MultidimArray<double> Vmag;
+ * MultidimArray<Real> Vmag;
  * Vmag.resize(Vfft);
  * FOR_ALL_ELEMENTS_IN_ARRAY3D(Vmag)
  *     Vmag(k,i,j)=20*log10(abs(Vfft(k,i,j)));
  * @endcode
  */
-class FourierTransformer
+template<typename Real>
+class FourierTransformerT
 {
 public:
     /** Real array, in fact a pointer to the user array is stored. */
-    MultidimArray<double> *fReal;
+    MultidimArray<Real> *fReal;
 
     /** Complex array, in fact a pointer to the user array is stored. */
-    MultidimArray<std::complex<double> > *fComplex;
+    MultidimArray<std::complex<Real> > *fComplex;
 
     /** Fourier array  */
-    MultidimArray< std::complex<double> > fFourier;
+    MultidimArray< std::complex<Real> > fFourier;
+
+    /** Copy of the view given as input, reused from call to call */
+    MultidimArray<Real> fRealView;
 
     /* fftw Forawrd plan */
-    fftw_plan fPlanForward;
+    typename FFTWPrecision<Real>::Plan fPlanForward;
 
     /* fftw Backward plan */
-    fftw_plan fPlanBackward;
+    typename FFTWPrecision<Real>::Plan fPlanBackward;
 
     /* number of threads*/
     int nthreads;
@@ -87,19 +273,19 @@ public:
     // Public methods
 public:
     /** Default constructor */
-    FourierTransformer();
+    FourierTransformerT();
 
     /** Copy constructor */
-    FourierTransformer(const FourierTransformer& fTransform);
+    FourierTransformerT(const FourierTransformerT& fTransform);
 
     /** Constructor setting the sign of normalization application*/
-    FourierTransformer(int _normSign);
+    FourierTransformerT(int _normSign);
 
     /** Assignment operator */
-    FourierTransformer & operator= (const FourierTransformer & other);
+    FourierTransformerT & operator= (const FourierTransformerT & other);
 
     /** Destructor */
-    ~FourierTransformer();
+    ~FourierTransformerT();
 
     /** Set Number of threads
      * This function, which should be called once, performs any
@@ -122,9 +308,9 @@ public:
         {
             threadsSetOn=true;
             nthreads = tNumber;
-            if(fftw_init_threads()==0)
+            if(FFTWPrecision<Real>::initThreads()==0)
                 REPORT_ERROR(ERR_THREADS_NOTINIT, (std::string)"FFTW cannot init threads (setThreadsNumber)");
-            fftw_plan_with_nthreads(nthreads);
+            FFTWPrecision<Real>::planWithNthreads(nthreads);
         }
     }
     /** Change Number of threads.
@@ -142,17 +328,16 @@ public:
     void changeThreadsNumber(int tNumber)
     {
         nthreads = tNumber;
-        fftw_plan_with_nthreads(nthreads);
+        FFTWPrecision<Real>::planWithNthreads(nthreads);
     }
 
-    /** Destroy Threads. Do not execute any previously created
-     *  plans after calling this function   */
+    /** Destroy Threads.
+     *  Plans of the transformer are created with one thread from now on.
+     *  The threads of FFTW are released by FFTWPlanCache::clear, since
+     *  the plans in the cache may still use them. */
     void destroyThreads(void )
     {
         nthreads = 1;
-        if(threadsSetOn)
-            fftw_cleanup_threads();
-
         threadsSetOn=false;
     }
 
@@ -224,7 +409,7 @@ public:
     {
         V.resizeNoCopy(fFourier);
         memcpy(MULTIDIM_ARRAY(V),MULTIDIM_ARRAY(fFourier),
-               MULTIDIM_SIZE(fFourier)*2*sizeof(double));
+               MULTIDIM_SIZE(fFourier)*2*sizeof(Real));
     }
 
 
@@ -241,23 +426,23 @@ public:
             if (YSIZE(*fReal)==1)
                 ndim=1;
         }
-        double *ptrSource=NULL;
-        double *ptrDest=NULL;
+        Real *ptrSource=NULL;
+        Real *ptrDest=NULL;
         switch (ndim)
         {
         case 1:
             FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(V)
             {
-                ptrDest=(double*)&DIRECT_A1D_ELEM(V,i);
+                ptrDest=(Real*)&DIRECT_A1D_ELEM(V,i);
                 if (i<XSIZE(fFourier))
                 {
-                    ptrSource=(double*)&DIRECT_A1D_ELEM(fFourier,i);
+                    ptrSource=(Real*)&DIRECT_A1D_ELEM(fFourier,i);
                     *ptrDest=*ptrSource;
                     *(ptrDest+1)=*(ptrSource+1);
                 }
                 else
                 {
-                    ptrSource=(double*)&DIRECT_A1D_ELEM(fFourier,XSIZE(*fReal)-i);
+                    ptrSource=(Real*)&DIRECT_A1D_ELEM(fFourier,XSIZE(*fReal)-i);
                     *ptrDest=*ptrSource;
                     *(ptrDest+1)=-(*(ptrSource+1));
                 }
@@ -266,16 +451,16 @@ public:
         case 2:
             FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(V)
             {
-                ptrDest=(double*)&DIRECT_A2D_ELEM(V,i,j);
+                ptrDest=(Real*)&DIRECT_A2D_ELEM(V,i,j);
                 if (j<XSIZE(fFourier))
                 {
-                    ptrSource=(double*)&DIRECT_A2D_ELEM(fFourier,i,j);
+                    ptrSource=(Real*)&DIRECT_A2D_ELEM(fFourier,i,j);
                     *ptrDest=*ptrSource;
                     *(ptrDest+1)=*(ptrSource+1);
                 }
                 else
                 {
-                    ptrSource=(double*)&DIRECT_A2D_ELEM(fFourier,
+                    ptrSource=(Real*)&DIRECT_A2D_ELEM(fFourier,
                                                         (YSIZE(*fReal)-i)%YSIZE(*fReal),
                                                         XSIZE(*fReal)-j);
                     *ptrDest=*ptrSource;
@@ -286,16 +471,16 @@ public:
         case 3:
             FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(V)
             {
-                ptrDest=(double*)&DIRECT_A3D_ELEM(V,k,i,j);
+                ptrDest=(Real*)&DIRECT_A3D_ELEM(V,k,i,j);
                 if (j<XSIZE(fFourier))
                 {
-                    ptrSource=(double*)&DIRECT_A3D_ELEM(fFourier,k,i,j);
+                    ptrSource=(Real*)&DIRECT_A3D_ELEM(fFourier,k,i,j);
                     *ptrDest=*ptrSource;
                     *(ptrDest+1)=*(ptrSource+1);
                 }
                 else
                 {
-                    ptrSource=(double*)&DIRECT_A3D_ELEM(fFourier,
+                    ptrSource=(Real*)&DIRECT_A3D_ELEM(fFourier,
                                                         (ZSIZE(*fReal)-k)%ZSIZE(*fReal),
                                                         (YSIZE(*fReal)-i)%YSIZE(*fReal),
                                                         XSIZE(*fReal)-j);
@@ -351,11 +536,17 @@ public:
 
     // Internal methods
 public:
-    /* Pointer to the array of doubles with which the plan was computed */
-    double * dataPtr;
+    /* Pointer to the array of reals with which the plan was computed */
+    Real * dataPtr;
+
+    /* Pointer to the array of complex<Real> with which the plan was computed */
+    std::complex<Real> * complexDataPtr;
 
-    /* Pointer to the array of complex<double> with which the plan was computed */
-    std::complex<double> * complexDataPtr;
+    /* Key of the forward plan in the plan cache */
+    FFTWPlanKey planKey;
+
+    /* Generation of the plan cache in which the plans were obtained */
+    int planGeneration;
 
     /* Init object*/
     void init();
@@ -365,11 +556,12 @@ public:
      * such as the accumulated wisdom and a list of algorithms available
      * in the current configuration. If you want to deallocate all of that
      * and reset FFTW to the pristine state it was in when
-     * you started your program, you can call:
+     * you started your program, you can call this function. The plans of
+     * all the transformers are cleared, see FFTWPlanCache::clear.
      */
     void cleanup(void)
     {
-        fftw_cleanup();
+        FFTWPlanCache::clear();
     }
 
     /** Recompute transformation plan. Call this method after setting real/fourier alias
@@ -377,6 +569,11 @@ public:
     */
     void recomputePlanR2C();
 
+    /** Take the plans for the current arrays from the plan cache,
+     * if the ones of the transformer do not fit them.
+     */
+    void updatePlans();
+
     /** Computes the transform, specified in Init() function
         If normalization=true the forward transform is normalized
         (no normalization is made in the inverse transform)
@@ -386,29 +583,36 @@ public:
     void Transform(int sign);
 
     /** Get the Multidimarray that is being used as input. */
-    const MultidimArray<double> &getReal() const;
-    const MultidimArray<std::complex<double> > &getComplex() const;
+    const MultidimArray<Real> &getReal() const;
+    const MultidimArray<std::complex<Real> > &getComplex() const;
 
     /** Set a Multidimarray for input.
         The data of img will be the one of fReal. In forward
         transforms it is not modified, but in backward transforms,
         the result will be stored in img. This means that the size
         of img cannot change between calls. */
-    void setReal(MultidimArray<double> &img);
+    void setReal(MultidimArray<Real> &img);
 
     /** Set a Multidimarray for input.
         The data of img will be the one of fComplex. In forward
         transforms it is not modified, but in backward transforms,
         the result will be stored in img. This means that the size
         of img cannot change between calls. */
-    void setReal(MultidimArray<std::complex<double> > &img);
+    void setReal(MultidimArray<std::complex<Real> > &img);
+
+    /** Set a view of a Multidimarray for input.
+        The values of the view are copied into an internal array, whose
+        memory is reused while the size of the views does not change.
+        Views are only meant as input of forward transforms: backward
+        transforms leave their result in the internal array. */
+    void setReal(const MultidimArrayView<Real> &view);
 
     /** Set a Multidimarray for the Fourier transform.
         The values of the input array are copied in the internal array.
         It is assumed that the container for the real image as well as
         the one for the Fourier array are already resized.
         No plan is updated. */
-    void setFourier(const MultidimArray<std::complex<double> > &imgFourier);
+    void setFourier(const MultidimArray<std::complex<Real> > &imgFourier);
 
     /* Set normalization sign.
      * It defines when the normalization must be applied, when doing
@@ -419,6 +623,151 @@ public:
     }
 
 };
+/** Double precision Fourier transformer, see FourierTransformerT.
+ * @ingroup FourierW
+ */
+typedef FourierTransformerT<double> FourierTransformer;
+
+/** Single precision Fourier transformer, see FourierTransformerT.
+ * @ingroup FourierW
+ *
+ * It works on MultidimArray<float> and std::complex<float> with the
+ * single precision FFTW library. It moves half the memory of the double
+ * precision transformer and FFTW can process twice as many values per
+ * SIMD instruction.
+ *
+ * @code
+ * FourierTransformerFloat transformer;
+ * MultidimArray< std::complex<float> > Ifft;
+ * transformer.FourierTransform(I,Ifft,false);
+ * ...
+ * transformer.inverseFourierTransform();
+ * @endcode
+ */
+typedef FourierTransformerT<float> FourierTransformerFloat;
+
+/** Fourier transformer of all the images of a stack at once.
+ * @ingroup FourierW
+ *
+ * The NSIZE images of the stack are transformed with a single batched
+ * FFTW plan (fftw_plan_many_dft_r2c/c2r), split among nthreads threads.
+ * Each image of the Fourier stack has the layout of the Fourier transform
+ * of FourierTransformer, and the normalization conventions are the same.
+ * As in FourierTransformer, the memory of the real stack is handled
+ * externally.
+ *
+ * @code
+ * FourierTransformerStack transformer;
+ * MultidimArray< std::complex<double> > Fstack;
+ * transformer.FourierTransform(stack, Fstack, false);
+ * ... filter each image of Fstack ...
+ * transformer.inverseFourierTransform();
+ * @endcode
+ */
+class FourierTransformerStack
+{
+public:
+    /** Real stack, in fact a pointer to the user array is stored. */
+    MultidimArray<double> *fReal;
+
+    /** Fourier transforms of the images, one after the other */
+    MultidimArray< std::complex<double> > fFourier;
+
+    /* fftw Forward plan */
+    fftw_plan fPlanForward;
+
+    /* fftw Backward plan */
+    fftw_plan fPlanBackward;
+
+    /* number of threads*/
+    int nthreads;
+
+    /* Sign where the normalization is applied */
+    int normSign;
+
+    /* Key of the forward plan in the plan cache */
+    FFTWPlanKey planKey;
+
+    /* Generation of the plan cache in which the plans were obtained */
+    int planGeneration;
+
+public:
+    /** Constructor setting the sign of normalization application*/
+    FourierTransformerStack(int _normSign=FFTW_FORWARD);
+
+    /** Set Number of threads used by each transform */
+    void setThreadsNumber(int tNumber)
+    {
+        nthreads = tNumber;
+    }
+
+    /** Compute the Fourier transform of all the images of a stack.
+        If getCopy is false, an alias to the transformed data is returned. */
+    template <typename T, typename T1>
+    void FourierTransform(T& v, T1& V, bool getCopy=true)
+    {
+        setReal(v);
+        Transform(FFTW_FORWARD);
+        if (getCopy)
+            getFourierCopy(V);
+        else
+            getFourierAlias(V);
+    }
+
+    /** Compute the Fourier transform of the stack set with setReal */
+    void FourierTransform();
+
+    /** Compute the inverse Fourier transform into the stack set with setReal */
+    void inverseFourierTransform();
+
+    /** Compute the inverse Fourier transform of V into v.
+        v must already have the right size. */
+    template <typename T, typename T1>
+    void inverseFourierTransform(T& V, T1& v)
+    {
+        setReal(v);
+        setFourier(V);
+        Transform(FFTW_BACKWARD);
+    }
+
+    /** Get Fourier coefficients. */
+    template <typename T>
+    void getFourierAlias(T& V)
+    {
+        V.alias(fFourier);
+    }
+
+    /** Get Fourier coefficients. */
+    template <typename T>
+    void getFourierCopy(T& V)
+    {
+        V.resizeNoCopy(fFourier);
+        memcpy(MULTIDIM_ARRAY(V),MULTIDIM_ARRAY(fFourier),
+               MULTIDIM_SIZE(fFourier)*2*sizeof(double));
+    }
+
+    /** Alias the Fourier transform of the n-th image (starting at 0) */
+    void getFourierImageAlias(size_t n, MultidimArray< std::complex<double> > &V);
+
+    /** Set the stack to transform.
+        Its images are the ones of fReal, in backward transforms
+        the result is stored in it. */
+    void setReal(MultidimArray<double> &stack);
+
+    /** Copy the values of the input array in the internal Fourier array */
+    void setFourier(const MultidimArray<std::complex<double> > &stackFourier);
+
+    /** Computes the transform, normalized in the normSign direction */
+    void Transform(int sign);
+
+    /** Take the plans for the current arrays from the plan cache */
+    void updatePlans();
+
+private:
+    /** Fourier transformers should not be copied */
+    FourierTransformerStack(const FourierTransformerStack& fTransform);
+    FourierTransformerStack & operator= (const FourierTransformerStack & other);
+};
 
 /** FFT Magnitude 1D
  * @ingroup FourierOperations
@@ -547,14 +896,21 @@ void correlation_vector_no_Fourier(const MultidimArray<T> &v1, const MultidimArr
     STARTINGX(result)=0;
 }
 
-/** Correlation auxiliary. */
-class CorrelationAux
+/** Correlation auxiliary, in double or single precision. */
+template<typename Real>
+class CorrelationAuxT
 {
 public:
-    MultidimArray< std::complex< double > > FFT1, FFT2;
-    FourierTransformer transformer1, transformer2;
+    MultidimArray< std::complex< Real > > FFT1, FFT2;
+    FourierTransformerT<Real> transformer1, transformer2;
 };
 
+/** Correlation auxiliary. */
+typedef CorrelationAuxT<double> CorrelationAux;
+
+/** Correlation auxiliary for single precision. */
+typedef CorrelationAuxT<float> CorrelationAuxFloat;
+
 /** Correlation of two nD images
  * @ingroup FourierOperations
  *
@@ -584,6 +940,110 @@ void correlation_matrix(const MultidimArray< std::complex< double > > & FFT1,
                         CorrelationAux &aux,
                         bool center=true);
 
+/** Single precision correlation of two nD images
+ * @ingroup FourierOperations
+ */
+void correlation_matrix(const MultidimArray<float> & m1,
+                        const MultidimArray<float> & m2,
+                        MultidimArray<float>& R,
+                        CorrelationAuxFloat &aux,
+                        bool center=true);
+
+void correlation_matrix(const MultidimArray< std::complex< float > > & FFT1,
+                        const MultidimArray<float> & m2,
+                        MultidimArray<float>& R,
+                        CorrelationAuxFloat &aux,
+                        bool center=true);
+
+/** Single precision correlation matrix.
+ * R must already be with the right size.
+ */
+void correlation_matrix(const MultidimArray< std::complex< float > > & FFT1,
+                        const MultidimArray< std::complex< float > > & FFT2,
+                        MultidimArray<float>& R,
+                        CorrelationAuxFloat &aux,
+                        bool center=true);
+
+/** Peak of a correlation map
+ * @ingroup FourierOperations
+ */
+struct CorrelationPeak
+{
+    /// Maximum of the correlation
+    double value;
+    /// Logical index of the maximum in the centered correlation map
+    int shiftX, shiftY, shiftZ;
+};
+
+/** Correlation of a set of references with many images
+ * @ingroup FourierOperations
+ *
+ * The Fourier transforms of the M references are computed once. Each set
+ * of N images is transformed at once, and the correlations of every image
+ * with all the references are computed with a blocked multiplication in
+ * Fourier space and a single batched inverse transform. The maps are the
+ * same as correlation_matrix(reference, image, R, aux, center).
+ *
+ * @code
+ * FourierCorrelationEngine engine;
+ * engine.setThreadsNumber(4);
+ * engine.setReferences(references);
+ * std::vector<CorrelationPeak> peaks;
+ * engine.correlationPeaks(images, peaks);
+ * // peaks[n*engine.size()+m] is the peak of image n with reference m
+ * @endcode
+ */
+class FourierCorrelationEngine
+{
+public:
+    /** Fourier transforms of the references, one after the other */
+    MultidimArray< std::complex<double> > refFourier;
+
+protected:
+    // Transformers of the images and of the correlations
+    FourierTransformerStack imgTransformer, corrTransformer;
+    // Conjugate of the transform of an image
+    MultidimArray< std::complex<double> > conjImg;
+    // Correlations of one image with all the references
+    MultidimArray<double> corrStack;
+    int nthreads;
+
+    /** Products of the conjugate of an image with all the references */
+    void multiplyReferences(const std::complex<double> *imgFourier, double dSize,
+                            std::complex<double> *result);
+
+    /** Transform the images and check their size */
+    void transformImages(const MultidimArray<double> &imgs);
+
+public:
+    /** Empty constructor */
+    FourierCorrelationEngine();
+
+    /** Number of threads of the Fourier transforms */
+    void setThreadsNumber(int tNumber);
+
+    /** Set the references, a stack with one reference per image */
+    void setReferences(const MultidimArray<double> &refs);
+
+    /** Number of references */
+    size_t size() const
+    {
+        return NSIZE(refFourier);
+    }
+
+    /** Correlation maps of a stack of images with all the references.
+     * R is resized to N*M maps, the correlation of the image n with
+     * the reference m is the map n*M+m.
+     */
+    void correlate(const MultidimArray<double> &imgs, MultidimArray<double> &R, bool center=true);
+
+    /** Peaks of the correlations of a stack of images with all the references.
+     * The peak of the image n with the reference m is peaks[n*M+m].
+     */
+    void correlationPeaks(const MultidimArray<double> &imgs, std::vector<CorrelationPeak> &peaks);
+}
+;//end of class FourierCorrelationEngine
+
 /** Autocorrelation function of an image
  * @ingroup FourierOperations
  *
@@ -620,6 +1080,9 @@ void auto_correlation_matrix(const MultidimArray< T > & Img, MultidimArray< doub
 /** Fast autocorrelation matrix */
 void auto_correlation_matrix(const MultidimArray<double> & Img, MultidimArray< double >& R, CorrelationAux &aux);
 
+/** Fast single precision autocorrelation matrix */
+void auto_correlation_matrix(const MultidimArray<float> & Img, MultidimArray< float >& R, CorrelationAuxFloat &aux);
+
 void convolutionFFTStack(const MultidimArray<double> &img,
                     const MultidimArray<double> &kernel,
                     MultidimArray<double> &result);
@@ -628,8 +1091,44 @@ void convolutionFFT(MultidimArray<double> &img,
                     MultidimArray<double> &kernel,
                     MultidimArray<double> &result);
 
+/** Radial shells of a Fourier transform
+ * @ingroup FourierOperations
+ *
+ * Shell of each coefficient of the Fourier transform computed by
+ * FourierTransformer for a Zdim x Ydim x Xdim array: a coefficient of
+ * digital frequency f is in the shell round(|f|*Xdim). The shells are
+ * computed once for each shape and shared by frc_dpr, getSpectrum and
+ * multiplyBySpectrum, which accumulate their sums in a single pass.
+ */
+class FourierShells
+{
+public:
+    /// Size of the array in real space
+    size_t Zdim, Ydim, Xdim;
+
+    /// Number of shells, all the shells are smaller
+    int nShells;
+
+    /// Shell of each Fourier coefficient
+    MultidimArray<int> shell;
+
+    /// Squared digital frequency of each plane, row and column of the Fourier transform
+    MultidimArray<double> fz2, fy2, fx2;
+
+    /** Shells of the transform of a Zdim x Ydim x Xdim array */
+    FourierShells(size_t Zdim, size_t Ydim, size_t Xdim);
+
+    /** Shells shared by all the callers.
+     * The shells of the last shape are kept, so that they are only
+     * computed again when the shape changes.
+     */
+    static std::shared_ptr<const FourierShells> getShells(size_t Zdim, size_t Ydim, size_t Xdim);
+}
+;//end of class FourierShells
+
 /** Fourier-Ring-Correlation between two multidimArrays using FFT
  * @ingroup FourierOperations
+ * The transforms and the sums of each shell are computed with nThreads threads.
  */
 void frc_dpr(MultidimArray< double > & m1,
              MultidimArray< double > & m2,
@@ -643,7 +1142,48 @@ void frc_dpr(MultidimArray< double > & m1,
 			 bool doRfactor = false,
 			 double minFreq = -1,
 			 double maxFreq = 0.5,
-                         double * rFactor= NULL);
+                         double * rFactor= NULL,
+                         int nThreads = 1);
+
+/** Resize images by cropping or padding their Fourier transforms
+ * @ingroup FourierOperations
+ *
+ * All the images of a stack are resized to Zdim x Ydim x Xdim, in batches
+ * of several images transformed with a single FFTW plan taken from the
+ * plan cache. The half Fourier transforms are cropped or padded while they
+ * are normalized, so the only arrays involved are the input, the output
+ * and the transforms of one batch, which are reused between calls.
+ * Double and single precision stacks are supported.
+ *
+ * @code
+ * FourierResizer resizer(4);
+ * MultidimArray<float> binned;
+ * resizer.resize(frames, binned, 1, YSIZE(frames)/2, XSIZE(frames)/2);
+ * @endcode
+ */
+class FourierResizer
+{
+protected:
+    int nThreads;
+    size_t batchSize;
+    MultidimArray< std::complex<double> > inFourier, outFourier;
+    MultidimArray< std::complex<float> > inFourierFloat, outFourierFloat;
+
+public:
+    /** Resizer with nThreads FFTW threads, transforming up to batchSize images at once */
+    FourierResizer(int nThreads=1, size_t batchSize=16);
+
+    /** Resize all the images of in into out.
+     * out is resized to NSIZE(in) images of Zdim x Ydim x Xdim.
+     */
+    void resize(const MultidimArray<double> &in, MultidimArray<double> &out,
+                size_t Zdim, size_t Ydim, size_t Xdim);
+
+    /** Resize all the images of a single precision stack */
+    void resize(const MultidimArray<float> &in, MultidimArray<float> &out,
+                size_t Zdim, size_t Ydim, size_t Xdim);
+}
+;//end of class FourierResizer
 
 /** Scale matrix using Fourier transform
  * @ingroup FourierOperations
@@ -670,11 +1210,13 @@ void selfScaleToSizeFourier(int Ydim, int Xdim, MultidimArrayGeneric &mda, int n
 
 /** Get the amplitude or power spectrum of the map in Fourier space.
  * @ingroup FourierOperations
-    i.e. the radial average of the (squared) amplitudes of all Fourier components
+    i.e. the radial average of the (squared) amplitudes of all Fourier components,
+    computed with nThreads threads
 */
 void getSpectrum(MultidimArray<double> &Min,
                  MultidimArray<double> &spectrum,
-                 int spectrum_type=AMPLITUDE_SPECTRUM);
+                 int spectrum_type=AMPLITUDE_SPECTRUM,
+                 int nThreads=1);
 
 /** Divide the input map in Fourier-space by the spectrum provided.
  * @ingroup FourierOperations
@@ -682,7 +1224,8 @@ void getSpectrum(MultidimArray<double> &Min,
 */
 void divideBySpectrum(MultidimArray<double> &Min,
                       MultidimArray<double> &spectrum,
-                      bool leave_origin_intact=false);
+                      bool leave_origin_intact=false,
+                      int nThreads=1);
 
 /** Multiply the input map in Fourier-space by the spectrum provided.
  * @ingroup FourierOperations
@@ -690,7 +1233,8 @@ void divideBySpectrum(MultidimArray<double> &Min,
 */
 void multiplyBySpectrum(MultidimArray<double> &Min,
                         MultidimArray<double> &spectrum,
-                        bool leave_origin_intact=false);
+                        bool leave_origin_intact=false,
+                        int nThreads=1);
 
 /** Perform a whitening of the amplitude/power spectrum of a 3D map
  * @ingroup FourierOperations
@@ -699,7 +1243,8 @@ void multiplyBySpectrum(MultidimArray<double> &Min,
 void whitenSpectrum(MultidimArray<double> &Min,
                     MultidimArray<double> &Mout,
                     int spectrum_type=AMPLITUDE_SPECTRUM,
-                    bool leave_origin_intact=false);
+                    bool leave_origin_intact=false,
+                    int nThreads=1);
 
 /** Adapts Min to have the same spectrum as spectrum_ref
  * @ingroup FourierOperations
@@ -709,7 +1254,8 @@ void adaptSpectrum(MultidimArray<double> &Min,
                    MultidimArray<double> &Mout,
                    const MultidimArray<double> &spectrum_ref,
                    int spectrum_type=AMPLITUDE_SPECTRUM,
-                   bool leave_origin_intact=false);
+                   bool leave_origin_intact=false,
+                   int nThreads=1);
 
 /** Randomize phases beyond a certain frequency
  * @ingroup FourierOperations
@@ -35,6 +35,12 @@
 #include "xmipp_image_generic.h"
 #include "xmipp_color.h"
 #include "multidim_array.h"
+#include "xmipp_threads.h"
+#include <stdint.h>
+#include <type_traits>
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
 
 /// @addtogroup Images
 //@{
@@ -42,6 +48,133 @@
 /** Size of the page used to read and write images from/to file */
 const size_t rw_max_page_size = 4194304; // 4Mb
 
+/** @name Page conversion kernels
+ * Pixel pages are converted between the file datatype and T with plain loops
+ * over non aliased pointers, so that the compiler vectorizes them for the
+ * instruction set the library is built for. The swapping variant reverses the
+ * bytes of the file pixels in the same pass, instead of a separate swapPage.
+ */
+//@{
+/** Unsigned integer of the same size as a pixel, used for byte swapping */
+template<size_t S>
+struct PageSwapWord;
+template<>
+struct PageSwapWord<1>
+{
+    typedef uint8_t type;
+    static inline uint8_t swap(uint8_t v)
+    {
+        return v;
+    }
+};
+template<>
+struct PageSwapWord<2>
+{
+    typedef uint16_t type;
+    static inline uint16_t swap(uint16_t v)
+    {
+        return __builtin_bswap16(v);
+    }
+};
+template<>
+struct PageSwapWord<4>
+{
+    typedef uint32_t type;
+    static inline uint32_t swap(uint32_t v)
+    {
+        return __builtin_bswap32(v);
+    }
+};
+template<>
+struct PageSwapWord<8>
+{
+    typedef uint64_t type;
+    static inline uint64_t swap(uint64_t v)
+    {
+        return __builtin_bswap64(v);
+    }
+};
+
+/** Reverse the byte order of a pixel value */
+template<typename V>
+inline V swapPixel(V v)
+{
+    typedef PageSwapWord<sizeof(V)> Word;
+    typename Word::type w;
+    memcpy(&w, &v, sizeof(V));
+    w = Word::swap(w);
+    memcpy(&v, &w, sizeof(V));
+    return v;
+}
+
+/** Cast n pixels from Src to Dst */
+template<typename Src, typename Dst>
+inline void castPixels(const Src * __restrict__ src, Dst * __restrict__ dst, size_t n)
+{
+    if (std::is_same<Src, Dst>::value)
+        memcpy(dst, src, n * sizeof(Src));
+    else
+        for (size_t i = 0; i < n; ++i)
+            dst[i] = (Dst) src[i];
+}
+
+/** Cast n pixels from Src to Dst, the source being in swapped byte order */
+template<typename Src, typename Dst>
+inline void castSwappedPixels(const Src * __restrict__ src, Dst * __restrict__ dst, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (Dst) swapPixel(src[i]);
+}
+
+/** Cast n half precision pixels (DT_HalfFloat) to Dst.
+ * Uses the F16C conversion instructions when the build enables them.
+ */
+template<typename Dst>
+inline void castHalfPixels(const uint16_t * __restrict__ src, Dst * __restrict__ dst, size_t n)
+{
+    size_t i = 0;
+#ifdef __F16C__
+    float buffer[8];
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(buffer, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (src + i))));
+        for (size_t k = 0; k < 8; ++k)
+            dst[i + k] = (Dst) buffer[k];
+    }
+#endif
+    for (; i < n; ++i)
+        dst[i] = (Dst) half2float(src[i]);
+}
+
+/** Cast n pixels from Src to half precision (DT_HalfFloat), rounding to nearest even */
+template<typename Src>
+inline void castPixelsToHalf(const Src * __restrict__ src, uint16_t * __restrict__ dst, size_t n)
+{
+    size_t i = 0;
+#ifdef __F16C__
+    float buffer[8];
+    for (; i + 8 <= n; i += 8)
+    {
+        for (size_t k = 0; k < 8; ++k)
+            buffer[k] = (float) src[i + k];
+        _mm_storeu_si128((__m128i *) (dst + i),
+                         _mm256_cvtps_ph(_mm256_loadu_ps(buffer), _MM_FROUND_TO_NEAREST_INT));
+    }
+#endif
+    for (; i < n; ++i)
+        dst[i] = float2half((float) src[i]);
+}
+
+/** Linear rescaling dst = minF + slope * (src - min0) of n pixels */
+template<typename Src, typename Dst>
+inline void scalePixels(const Src * __restrict__ src, Dst * __restrict__ dst, size_t n,
+                        double minF, double slope, double min0)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = static_cast<Dst>(minF + (slope * static_cast<double>(src[i] - min0)));
+}
+//@}
+
 /** Template class for images.
  * The image class is the general image handling class.
  */
@@ -186,129 +319,35 @@ public:
                 REPORT_ERROR(ERR_TYPE_INCORRECT, "ERROR: datatype is Unknown_Type");
             case DT_UHalfByte:
             case DT_UChar:
-            {
-                if (typeid(T) == typeid(unsigned char))
-                    memcpy(ptrDest, page, pageSize * sizeof(T));
-                else
-                {
-                    unsigned char * ptr = (unsigned char *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
-                }
+                castPixels((unsigned char *) page, ptrDest, pageSize);
                 break;
-            }
             case DT_SChar:
-            {
-                if (typeid(T) == typeid(signed char))
-                {
-                    memcpy(ptrDest, page, pageSize * sizeof(T));
-                }
-                else
-                {
-                    signed char * ptr = (signed char *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
-                }
+                castPixels((signed char *) page, ptrDest, pageSize);
                 break;
-            }
             case DT_UShort:
-            {
-                if (typeid(T) == typeid(unsigned short))
-                {
-                    memcpy(ptrDest, page, pageSize * sizeof(T));
-                }
-                else
-                {
-                    unsigned short * ptr = (unsigned short *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
-                }
+                castPixels((unsigned short *) page, ptrDest, pageSize);
                 break;
-            }
             case DT_Short:
-            {
-                if (typeid(T) == typeid(short))
-                {
-                    memcpy(ptrDest, page, pageSize * sizeof(T));
-                }
-                else
-                {
-                    short * ptr = (short *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
-                }
+                castPixels((short *) page, ptrDest, pageSize);
                 break;
-            }
             case DT_UInt:
-            {
-                if (typeid(T) == typeid(unsigned int))
-                {
-                    memcpy(ptrDest, page, pageSize * sizeof(T));
-                }
-                else
-                {
-                    unsigned int * ptr = (unsigned int *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
-                }
+                castPixels((unsigned int *) page, ptrDest, pageSize);
                 break;
-            }
             case DT_Int:
-            {
-                if (typeid(T) == typeid(int))
-                {
-                    memcpy(ptrDest, page, pageSize * sizeof(T));
-                }
-                else
-                {
-                    int * ptr = (int *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
-                }
+                castPixels((int *) page, ptrDest, pageSize);
                 break;
-            }
             case DT_Long:
-            {
-                if (typeid(T) == typeid(long))
-                {
-                    memcpy(ptrDest, page, pageSize * sizeof(T));
-                }
-                else
-                {
-                    long * ptr = (long *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
-                }
+                castPixels((long *) page, ptrDest, pageSize);
+                break;
+            case DT_HalfFloat:
+                castHalfPixels((uint16_t *) page, ptrDest, pageSize);
                 break;
-            }
             case DT_Float:
-            {
-                if (typeid(T) == typeid(float))
-                {
-                    memcpy(ptrDest, page, pageSize * sizeof(T));
-                }
-                else
-                {
-                    float * ptr = (float *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
-                }
+                castPixels((float *) page, ptrDest, pageSize);
                 break;
-            }
             case DT_Double:
-            {
-                if (typeid(T) == typeid(double))
-                {
-                    memcpy(ptrDest, page, pageSize * sizeof(T));
-                }
-                else
-                {
-                    double * ptr = (double *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        ptrDest[i] = (T) *ptr;
-                }
+                castPixels((double *) page, ptrDest, pageSize);
                 break;
-            }
             default:
             {
                 std::cerr << "Datatype= " << datatype << std::endl;
@@ -318,6 +357,48 @@ public:
 
     }
 
+    /** Swap and cast a page of data from type dataType to type Tdest
+     * Pages of real datatypes swapped element by element (swap = 1) are
+     * converted in a single pass. Otherwise the page is swapped in place
+     * with swapPage and then cast with castPage2T.
+     */
+    void
+    castSwapPage2T(char * page, T * ptrDest, DataType datatype, size_t pageSize, int swap)
+    {
+        if (swap == 1 && !isComplexT())
+        {
+            switch (datatype)
+            {
+                case DT_UShort:
+                    castSwappedPixels((unsigned short *) page, ptrDest, pageSize);
+                    return;
+                case DT_Short:
+                    castSwappedPixels((short *) page, ptrDest, pageSize);
+                    return;
+                case DT_UInt:
+                    castSwappedPixels((unsigned int *) page, ptrDest, pageSize);
+                    return;
+                case DT_Int:
+                    castSwappedPixels((int *) page, ptrDest, pageSize);
+                    return;
+                case DT_Long:
+                    castSwappedPixels((long *) page, ptrDest, pageSize);
+                    return;
+                case DT_Float:
+                    castSwappedPixels((float *) page, ptrDest, pageSize);
+                    return;
+                case DT_Double:
+                    castSwappedPixels((double *) page, ptrDest, pageSize);
+                    return;
+                default:
+                    break;
+            }
+        }
+        if (swap)
+            swapPage(page, pageSize * gettypesize(datatype), datatype, swap);
+        castPage2T(page, ptrDest, datatype, pageSize);
+    }
+
     /** Cast page from T to datatype
      *  input pointer char *
      */
@@ -328,90 +409,33 @@ public:
         switch (datatype)
         {
             case DT_Float:
-            {
-                if (typeid(T) == typeid(float))
-                {
-                    memcpy(page, srcPtr, pageSize * sizeof(T));
-                }
-                else
-                {
-                    float * ptr = (float *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        *ptr = (float) srcPtr[i];
-                }
+                castPixels(srcPtr, (float *) page, pageSize);
+                break;
+            case DT_HalfFloat:
+                castPixelsToHalf(srcPtr, (uint16_t *) page, pageSize);
                 break;
-            }
             case DT_Double:
-            {
-                if (typeid(T) == typeid(double))
-                {
-                    memcpy(page, srcPtr, pageSize * sizeof(T));
-                }
-                else
-                {
-                    double * ptr = (double *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        *ptr = (double) srcPtr[i];
-                }
+                castPixels(srcPtr, (double *) page, pageSize);
                 break;
-            }
             case DT_UShort:
-            {
-                if (typeid(T) == typeid(unsigned short))
-                {
-                    memcpy(page, srcPtr, pageSize * sizeof(T));
-                }
-                else
-                {
-                    unsigned short * ptr = (unsigned short *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        *ptr = (unsigned short) srcPtr[i];
-                }
+                castPixels(srcPtr, (unsigned short *) page, pageSize);
                 break;
-            }
             case DT_Short:
-            {
-                if (typeid(T) == typeid(short))
-                {
-                    memcpy(page, srcPtr, pageSize * sizeof(T));
-                }
-                else
-                {
-                    short * ptr = (short *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        *ptr = (short) srcPtr[i];
-                }
+                castPixels(srcPtr, (short *) page, pageSize);
+                break;
+            case DT_UInt:
+                castPixels(srcPtr, (unsigned int *) page, pageSize);
+                break;
+            case DT_Int:
+                castPixels(srcPtr, (int *) page, pageSize);
                 break;
-            }
             case DT_UHalfByte:
             case DT_UChar:
-            {
-                if (typeid(T) == typeid(unsigned char))
-                {
-                    memcpy(page, srcPtr, pageSize * sizeof(T));
-                }
-                else
-                {
-                    unsigned char * ptr = (unsigned char *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        *ptr = (unsigned char) srcPtr[i];
-                }
+                castPixels(srcPtr, (unsigned char *) page, pageSize);
                 break;
-            }
             case DT_SChar:
-            {
-                if (typeid(T) == typeid(char))
-                {
-                    memcpy(page, srcPtr, pageSize * sizeof(T));
-                }
-                else
-                {
-                    char * ptr = (char *) page;
-                    for (size_t i = 0; i < pageSize; ++i, ++ptr)
-                        *ptr = (char) srcPtr[i];
-                }
+                castPixels(srcPtr, (char *) page, pageSize);
                 break;
-            }
             default:
             {
                 std::cerr << "outputDatatype = " << datatype << std::endl;
@@ -431,9 +455,8 @@ public:
     CW_CONVERT) const
     {
 
-        double minF, maxF;
+        double minF = 0, maxF;
         double slope;
-        size_t n;
         DataType myTypeId = myT();
 
         switch (datatype)
@@ -456,11 +479,7 @@ public:
                     else
                         slope = 0;
                 }
-                unsigned char * ptr = (unsigned char *) page;
-
-                for (n = 0; n < pageSize; n++)
-                    ptr[n] = static_cast<unsigned char>(minF
-                                                        + (slope * static_cast<double>(srcPtr[n] - min0)));
+                scalePixels(srcPtr, (unsigned char *) page, pageSize, minF, slope, min0);
 
                 break;
             }
@@ -481,11 +500,7 @@ public:
                     else
                         slope = 0;
                 }
-                char * ptr = (char *) page;
-
-                for (n = 0; n < pageSize; n++)
-                    ptr[n] = static_cast<char>(minF
-                                               + (slope * static_cast<double>(srcPtr[n] - min0)));
+                scalePixels(srcPtr, (char *) page, pageSize, minF, slope, min0);
 
                 break;
             }
@@ -512,11 +527,7 @@ public:
                         slope = 0;
                 }
 
-                unsigned short * ptr = (unsigned short *) page;
-
-                for (n = 0; n < pageSize; n++)
-                    ptr[n] = static_cast<unsigned short>(minF
-                                                         + (slope * static_cast<double>(srcPtr[n] - min0)));
+                scalePixels(srcPtr, (unsigned short *) page, pageSize, minF, slope, min0);
 
                 break;
             }
@@ -542,11 +553,7 @@ public:
                     else
                         slope = 0;
                 }
-                short * ptr = (short *) page;
-
-                for (n = 0; n < pageSize; n++)
-                    ptr[n] = static_cast<short>(minF
-                                                + (slope * static_cast<double>(srcPtr[n] - min0)));
+                scalePixels(srcPtr, (short *) page, pageSize, minF, slope, min0);
 
                 break;
             }
@@ -574,11 +581,7 @@ public:
                     else
                         slope = 0;
                 }
-                unsigned int * ptr = (unsigned int *) page;
-
-                for (n = 0; n < pageSize; n++)
-                    ptr[n] = static_cast<unsigned int>(minF
-                                                       + (slope * static_cast<double>(srcPtr[n] - min0)));
+                scalePixels(srcPtr, (unsigned int *) page, pageSize, minF, slope, min0);
                 break;
             }
             case DT_Int:
@@ -605,11 +608,7 @@ public:
                     else
                         slope = 0;
                 }
-                int * ptr = (int *) page;
-
-                for (n = 0; n < pageSize; n++)
-                    ptr[n] = static_cast<int>(minF
-                                              + (slope * static_cast<double>(srcPtr[n] - min0)));
+                scalePixels(srcPtr, (int *) page, pageSize, minF, slope, min0);
                 break;
             }
             default:
@@ -651,6 +650,7 @@ public:
             case DT_Unknown:
                 REPORT_ERROR(ERR_TYPE_INCORRECT, "ERROR: datatype is Unknown_Type");
             case DT_UHalfByte:
+            case DT_HalfFloat:
             {
                 return 0;
             }
@@ -1239,11 +1239,10 @@ private:
         if (dataMode < DATA)
             return;
 
-        if (datatype == DT_UHalfByte){
-            //REPORT_ERROR(ERR_MMAP, "Image Class::readData not supported for  "
-            //                       "data type " + datatype2Str(DT_UHalfByte));
-            std::cout<<"redirecting from readData to readData4bits!"<<std::endl;
+        if (datatype == DT_UHalfByte)
+        {
             readData4bit(fimg, select_img, datatype, pad);
+            return;
         }
         // If only half of a transform is stored, it needs to be handled
         if (transform == Hermitian || transform == CentHerm)
@@ -1326,12 +1325,9 @@ private:
                     //Read page from disc
                     if (fread(page, readsize, 1, fimg) != 1)
                         REPORT_ERROR(ERR_IO_NOREAD, "Cannot read the whole page");
-                    //swap per page
-                    if (swap)
-                        swapPage(page, readsize, datatype, swap);
-                    // cast to T per page
-                    castPage2T(page, MULTIDIM_ARRAY(data) + haveread_n, datatype,
-                               readsize_n);
+                    // swap and cast to T per page
+                    castSwapPage2T(page, MULTIDIM_ARRAY(data) + haveread_n, datatype,
+                                   readsize_n, swap);
                     haveread_n += readsize_n;
                 }
                 if (pad > 0)
@@ -1356,8 +1352,59 @@ private:
 
 
 
+    /** Arguments of the threads unpacking 4-bit frames
+     */
+    struct Unpack4bitData
+    {
+        const unsigned char * packed; // First packed frame
+        size_t stride;                // Bytes between packed frames
+        size_t packedSize;            // Packed bytes of each frame
+        size_t frames;                // Number of frames
+        T * dest;                     // First unpacked frame
+        size_t itemSize;              // Pixels of each frame
+        const T (*lut)[2];            // Pixel pair of each byte value
+    };
+
+    /** Unpack the packed bytes in [first, last) of a run of frames
+     * The range is counted over the packed bytes of all frames, skipping the pads.
+     */
+    static void
+    unpack4bit(const Unpack4bitData &d, size_t first, size_t last)
+    {
+        while (first < last)
+        {
+            size_t frame = first / d.packedSize;
+            size_t j0 = first - frame * d.packedSize;
+            size_t j1 = XMIPP_MIN(d.packedSize, j0 + last - first);
+            const unsigned char * src = d.packed + frame * d.stride;
+            T * dst = d.dest + frame * d.itemSize;
+            for (size_t j = j0; j < j1; ++j)
+            {
+                const T * pair = d.lut[src[j]];
+                dst[2 * j] = pair[0];
+                dst[2 * j + 1] = pair[1];
+            }
+            first += j1 - j0;
+        }
+    }
+
+    /** Thread function unpacking a contiguous share of the packed bytes,
+     * so that a single large frame is also split among threads.
+     */
+    static void
+    threadUnpack4bit(ThreadArgument &thArg)
+    {
+        const Unpack4bitData &d = *((Unpack4bitData *) thArg.data);
+        size_t total = d.frames * d.packedSize;
+        unpack4bit(d, total * thArg.thread_id / thArg.threads,
+                   total * (thArg.thread_id + 1) / thArg.threads);
+    }
+
     /** Read the raw data from compressed 4bit images
-     * We are assuming the values are stored in 4bits (2 values in 1 byte)
+     * We are assuming the values are stored in 4bits (2 values in 1 byte),
+     * the lower 4 bits being the first pixel. Runs of whole frames are read
+     * at once and unpacked straight into the image through a lookup table,
+     * in parallel when setDecodeThreads was given more than one thread.
     */
     void
     readData4bit(FILE* fimg, size_t select_img, DataType datatype, size_t pad)
@@ -1371,67 +1418,63 @@ private:
                                    "data type different than " + datatype2Str(DT_UHalfByte));
         }
 
-        size_t selectImgOffset; //4Mb
         size_t itemSize = ZYXSIZE(data);
-        size_t pagesizeF = itemSize /2;
-        size_t pagesizeM = itemSize;
-        //size_t pagesizeHalf = pagesize/2;
-        size_t haveread_n = 0;
-
-        char* page = NULL;    // Compressed
+        size_t nFrames = NSIZE(data);
+        Unpack4bitData d;
+        d.itemSize = itemSize;
+        d.packedSize = itemSize / 2;
+        d.stride = d.packedSize + pad;
 
         // Allocate memory for image data (Assume xdim, ydim, zdim and ndim are already set
         //if memory already allocated use it (no resize allowed)
         data.coreAllocateReuse();
 
-        page = (char *) askMemory(pagesizeM);
+        T lut[256][2];
+        for (int b = 0; b < 256; ++b)
+        {
+            lut[b][0] = (T) (b & 15); // take the lower 4 bits
+            lut[b][1] = (T) (b >> 4); // take the upper 4 bits
+        }
+        d.lut = lut;
 
-        // Calculate the staring reading pointer.
-        selectImgOffset = offset + IMG_INDEX(select_img) * (pagesizeF + pad);
+        // Read up to 64Mb of consecutive frames at once
+        size_t maxRun = XMIPP_MIN(XMIPP_MAX(16 * rw_max_page_size / d.stride, (size_t) 1), nFrames);
+        size_t bufferSize = (maxRun - 1) * d.stride + d.packedSize;
+        std::vector<unsigned char> buffer(bufferSize);
+        d.packed = &buffer[0];
+        if (decodeThreads > 1 && !decodeThMgr)
+            decodeThMgr.reset(new ThreadManager(decodeThreads));
 
-        if (fseek(fimg, selectImgOffset, SEEK_SET) == -1)
+        if (fseek(fimg, offset + IMG_INDEX(select_img) * d.stride, SEEK_SET) == -1)
             REPORT_ERROR(ERR_IO_SIZE, "readData4bit: can not seek the file pointer");
-        for (size_t myn = 0; myn < NSIZE(data); myn++)
+        for (size_t myn = 0; myn < nFrames; myn += d.frames)
         {
+            d.frames = XMIPP_MIN(maxRun, nFrames - myn);
+            d.dest = MULTIDIM_ARRAY(data) + myn * itemSize;
 
-            //Read page from disc
-            if (fread(page+pagesizeF, pagesizeF, 1, fimg) != 1)
+            //Read the run of frames from disc, the pad after its last frame is skipped
+            if (fread(&buffer[0], (d.frames - 1) * d.stride + d.packedSize, 1, fimg) != 1)
                 REPORT_ERROR(ERR_IO_NOREAD, "Cannot read the whole page");
-
-            // cast to T per page
-
-            size_t start = pagesizeF;
-            uint8_t mask = 15; // 00001111
-
-            for (size_t i = 0, j = start; i < pagesizeM - 1; i += 2, ++j)
-            {
-                char& value = *(page+j);
-                page[i] = value & mask; // take the lower 4 bits
-                page[i+1] = (value >> 4) & mask; // take the upper 4 bits
-            }
-
-            castPage2T(page, MULTIDIM_ARRAY(data) + haveread_n, datatype,
-                       pagesizeM);
-            haveread_n += pagesizeM;
-
-            if (pad > 0)
-                //fread( padpage, pad, 1, fimg);
+            if (pad > 0 && myn + d.frames < nFrames)
                 if (fseek(fimg, pad, SEEK_CUR) == -1)
                     REPORT_ERROR(ERR_IO_SIZE,
                                  "readData4bit: can not seek the file pointer");
 
-            //if ( pad > 0 )
-            //    freeMemory(padpage, pad*sizeof(char));
+            if (decodeThreads > 1)
+                decodeThMgr->run(threadUnpack4bit, &d);
+            else
+                unpack4bit(d, 0, d.frames * d.packedSize);
+
+            // Frames with an odd number of pixels have no data for the last one
+            if (itemSize % 2)
+                for (size_t k = 0; k < d.frames; ++k)
+                    d.dest[(k + 1) * itemSize - 1] = 0;
+        }
 
 #ifdef DEBUG
 
-            printf("DEBUG readData4bit: Finished reading and converting data\n");
+        printf("DEBUG readData4bit: Finished reading and converting data\n");
 #endif
-        }
-        if (page > 0)
-            freeMemory(page, pagesizeM * sizeof(char));
-
-        return;
     }
 
 
@@ -46,6 +46,8 @@ void ImageBase::init()
     _exists = mmapOnRead = mmapOnWrite = false;
     mFd        = 0;
     mappedSize = mappedOffset = virtualOffset = 0;
+    decodeThreads = 1;
+    decodeThMgr.reset();
 }
 
 void ImageBase::clearHeader()
@@ -262,7 +264,7 @@ void ImageBase::swapPage(char * page, size_t pageNrElements, DataType datatype,
     // Swap bytes if required
     if ( swap == 1 )
     {
-        if ( datatype >= DT_CShort )
+        if ( datatype >= DT_CShort && datatype <= DT_CDouble )
             datatypesize /= 2;
         for ( size_t i = 0; i < pageNrElements; i += datatypesize )
             swapbytes(page+i, datatypesize);
@@ -31,6 +31,8 @@
 #include "transformations.h"
 #include "metadata.h"
 #include "xmipp_datatype.h"
+#include "xmipp_threads.h"
+#include <memory>
 //
 //// Includes for rwTIFF which cannot be inside it
 #include <tiffio.h>
@@ -255,6 +257,8 @@ protected:
     size_t              mappedSize;  // Size of the mapped file
     size_t              mappedOffset;// Offset for the mapped file
     size_t          virtualOffset;// MDA Offset when movePointerTo is used
+    int                 decodeThreads;// Threads used to unpack 4-bit frames
+    std::unique_ptr<ThreadManager> decodeThMgr;// Threads kept between 4-bit reads
 
 public:
 
@@ -462,6 +466,17 @@ public:
         swapWrite = true;
     }
 
+    /** Set the number of threads used to unpack 4-bit (DT_UHalfByte) frames.
+     * Frames are decoded in parallel after each read from disk.
+     */
+    void setDecodeThreads(int n)
+    {
+        n = XMIPP_MAX(n, 1);
+        if (n != decodeThreads)
+            decodeThMgr.reset();
+        decodeThreads = n;
+    }
+
     /** Get file name
      *
      * @code
@@ -111,6 +111,10 @@ void ImageGeneric::getInfo(ImageInfo &imgInfo) const
 
 void ImageGeneric::setDatatype(DataType imgType)
 {
+    // Half floats are only a storage format, they are held in memory as float
+    if (imgType == DT_HalfFloat)
+        imgType = DT_Float;
+
     if (imgType == datatype)
         return;
 
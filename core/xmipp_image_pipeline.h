@@ -0,0 +1,339 @@
+/***************************************************************************
+ * Authors:     Xmipp Team (xmipp@cnb.csic.es)
+ *
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef CORE_XMIPP_IMAGE_PIPELINE_H_
+#define CORE_XMIPP_IMAGE_PIPELINE_H_
+
+#include "xmipp_image.h"
+#include "xmipp_image_extension.h"
+#include "xmipp_threads.h"
+#include "metadata.h"
+
+/** @defgroup ImagePipeline Background image reading and writing
+ *  @ingroup Images
+ *  @{
+ */
+
+/** Read images ahead in a background thread.
+ * The images of a stack, of a MetaData image column or of a list of
+ * file names are read in order by a thread that keeps up to K images
+ * ready, so the caller does not wait for the disk while processing.
+ *
+ * @code
+ * ImagePrefetcher<double> prefetcher("particles.mrcs");
+ * Image<double> img;
+ * while (prefetcher.getNext(img))
+ *     process(img());
+ * @endcode
+ */
+template<typename T>
+class ImagePrefetcher: public Thread
+{
+protected:
+    // Names of the images to read, in order
+    std::vector<FileName> names;
+    // Images read ahead, image n is kept in slots[n % slots.size()]
+    std::vector< Image<T> > slots;
+    // Images read by the thread and returned to the caller
+    size_t nRead, nReturned;
+    bool stop, stopped;
+    XmippError * error;
+    Condition condition;
+
+    void init(size_t K)
+    {
+        slots.resize(XMIPP_MAX(K, 1));
+        nRead = nReturned = 0;
+        stop = stopped = false;
+        error = NULL;
+        start();
+    }
+
+public:
+    /** Read all the images of a stack, keeping K of them ahead */
+    ImagePrefetcher(const FileName &fnStack, size_t K = 8)
+    {
+        size_t Xdim, Ydim, Zdim, Ndim;
+        getImageSize(fnStack, Xdim, Ydim, Zdim, Ndim);
+        names.resize(Ndim);
+        for (size_t n = 0; n < Ndim; ++n)
+            names[n].compose(n + 1, fnStack);
+        init(K);
+    }
+
+    /** Read the images of a column of a metadata */
+    ImagePrefetcher(const MetaData &md, MDLabel label = MDL_IMAGE, size_t K = 8)
+    {
+        md.getColumnValues(label, names);
+        init(K);
+    }
+
+    /** Read the images of a list of file names */
+    ImagePrefetcher(const std::vector<FileName> &names, size_t K = 8)
+    {
+        this->names = names;
+        init(K);
+    }
+
+    /** Stop the reading thread */
+    ~ImagePrefetcher()
+    {
+        // ~Thread joins the thread after the slots have been destroyed,
+        // so wait here until it is done with them
+        condition.lock();
+        stop = true;
+        condition.broadcast();
+        while (!stopped)
+            condition.wait();
+        condition.unlock();
+        delete error;
+    }
+
+    /** Number of images to be read */
+    size_t size() const
+    {
+        return names.size();
+    }
+
+    /** Copy the next image into img.
+     * Return false if all the images have been returned.
+     * Errors reading an image are reported here.
+     */
+    bool getNext(Image<T> &img)
+    {
+        if (nReturned == names.size())
+            return false;
+        condition.lock();
+        while (error == NULL && nRead == nReturned)
+            condition.wait();
+        if (error != NULL && nRead == nReturned)
+        {
+            condition.unlock();
+            throw *error;
+        }
+        condition.unlock();
+
+        img = slots[nReturned % slots.size()];
+
+        condition.lock();
+        ++nReturned;
+        condition.broadcast();
+        condition.unlock();
+        return true;
+    }
+
+    /** Thread function, not to be called */
+    void run()
+    {
+        for (size_t n = 0; n < names.size(); ++n)
+        {
+            condition.lock();
+            while (!stop && n - nReturned >= slots.size())
+                condition.wait();
+            bool quit = stop;
+            condition.unlock();
+            if (quit)
+                break;
+
+            try
+            {
+                slots[n % slots.size()].read(names[n]);
+            }
+            catch (XmippError &xe)
+            {
+                condition.lock();
+                error = new XmippError(xe);
+                condition.broadcast();
+                condition.unlock();
+                break;
+            }
+
+            condition.lock();
+            ++nRead;
+            condition.broadcast();
+            condition.unlock();
+        }
+        condition.lock();
+        stopped = true;
+        condition.broadcast();
+        condition.unlock();
+    }
+}
+;//end of class ImagePrefetcher
+
+/** Write images in a background thread.
+ * Images are copied into a queue of K slots and written in the same
+ * order by a thread, so appending to a stack does not block the caller
+ * until the queue is full. Errors writing are reported in the next
+ * call to write or flush, or as a warning when the writer is destroyed
+ * without a final flush.
+ *
+ * @code
+ * ImageWriteBehind<double> writer;
+ * for (size_t n = 1; n <= N; ++n)
+ *     writer.write(img, fnStack, n, true, WRITE_REPLACE);
+ * writer.flush();
+ * @endcode
+ */
+template<typename T>
+class ImageWriteBehind: public Thread
+{
+protected:
+    struct WriteTask
+    {
+        Image<T> img;
+        FileName fn;
+        size_t select_img;
+        bool isStack;
+        int mode;
+        CastWriteMode castMode;
+    };
+    // Images waiting to be written, image n is kept in tasks[n % tasks.size()]
+    std::vector<WriteTask> tasks;
+    // Images queued by the caller and written by the thread
+    size_t nQueued, nWritten;
+    bool stop, stopped;
+    XmippError * error;
+    Condition condition;
+
+    /** Report an error of the writing thread */
+    void checkError()
+    {
+        if (error != NULL)
+        {
+            XmippError xe(*error);
+            delete error;
+            error = NULL;
+            condition.unlock();
+            throw xe;
+        }
+    }
+
+public:
+    /** Writer keeping up to K images in memory */
+    ImageWriteBehind(size_t K = 8)
+    {
+        tasks.resize(XMIPP_MAX(K, 1));
+        nQueued = nWritten = 0;
+        stop = stopped = false;
+        error = NULL;
+        start();
+    }
+
+    /** Write the pending images and stop the thread.
+     * Call flush() first to get the errors as exceptions, an error that
+     * was not reported by write or flush is only shown as a warning here.
+     */
+    ~ImageWriteBehind()
+    {
+        condition.lock();
+        stop = true;
+        condition.broadcast();
+        while (!stopped)
+            condition.wait();
+        condition.unlock();
+        if (error != NULL)
+        {
+            reportWarning("ImageWriteBehind: some images were not written\n" + error->getMessage());
+            delete error;
+        }
+    }
+
+    /** Queue an image to be written, same parameters as Image::write */
+    void write(const Image<T> &img, const FileName &fn, size_t select_img = ALL_IMAGES,
+               bool isStack = false, int mode = WRITE_OVERWRITE, CastWriteMode castMode = CW_CAST)
+    {
+        condition.lock();
+        while (error == NULL && nQueued - nWritten >= tasks.size())
+            condition.wait();
+        checkError();
+        condition.unlock();
+
+        WriteTask &task = tasks[nQueued % tasks.size()];
+        task.img = img;
+        task.fn = fn;
+        task.select_img = select_img;
+        task.isStack = isStack;
+        task.mode = mode;
+        task.castMode = castMode;
+
+        condition.lock();
+        ++nQueued;
+        condition.broadcast();
+        condition.unlock();
+    }
+
+    /** Wait until all the queued images have been written */
+    void flush()
+    {
+        condition.lock();
+        while (error == NULL && nWritten < nQueued)
+            condition.wait();
+        checkError();
+        condition.unlock();
+    }
+
+    /** Thread function, not to be called */
+    void run()
+    {
+        condition.lock();
+        while (true)
+        {
+            while (!stop && nWritten == nQueued)
+                condition.wait();
+            if (nWritten == nQueued)
+                break;
+            WriteTask &task = tasks[nWritten % tasks.size()];
+            condition.unlock();
+
+            try
+            {
+                task.img.write(task.fn, task.select_img, task.isStack, task.mode, task.castMode);
+            }
+            catch (XmippError &xe)
+            {
+                condition.lock();
+                if (error == NULL)
+                    error = new XmippError(xe);
+                // Images after an error are discarded
+                nWritten = nQueued;
+                condition.broadcast();
+                continue;
+            }
+
+            condition.lock();
+            ++nWritten;
+            condition.broadcast();
+        }
+        stopped = true;
+        condition.broadcast();
+        condition.unlock();
+    }
+}
+;//end of class ImageWriteBehind
+
+/** @} */
+
+#endif /* CORE_XMIPP_IMAGE_PIPELINE_H_ */
@@ -0,0 +1,174 @@
+/***************************************************************************
+ * Authors:     Xmipp Team (xmipp@cnb.csic.es)
+ *
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef CORE_XMIPP_IMAGE_STACK_H_
+#define CORE_XMIPP_IMAGE_STACK_H_
+
+#include "xmipp_image.h"
+
+/** @defgroup StackReader Reading several images of a stack
+ *  @ingroup Images
+ *  @{
+ */
+
+/// Maximum bytes read from the stack at once
+#define STACK_READ_BUFFER 67108864
+
+/** Read several images of a stack with a single file handler.
+ * The file is opened and its header parsed once. Any list of images is
+ * read into an array with one image per index, and consecutive indices
+ * are read with a single call to fread.
+ * SPIDER, MRC, IMAGIC and EM stacks are read directly, other formats
+ * are read image by image through the open handler.
+ *
+ * @code
+ * StackReader<double> reader("particles.mrcs");
+ * MultidimArray<double> batch;
+ * std::vector<size_t> indices; // Starting at FIRST_IMAGE
+ * ...
+ * reader.read(indices, batch);
+ * @endcode
+ */
+template<typename T>
+class StackReader: protected Image<T>
+{
+protected:
+    ImageFHandler * stackHandler;
+    FileName fnStack;
+    DataType fileDatatype;
+    // Bytes between the end of an image and the begin of the next one
+    size_t pad;
+    // Images are found at fixed positions in the file
+    bool fixedStride;
+    std::vector<char> buffer;
+
+public:
+    /** Open the stack and read its header */
+    StackReader(const FileName &fn)
+    {
+        fnStack = fn.removeAllPrefixes();
+        stackHandler = this->openFile(fnStack, WRITE_READONLY);
+        this->_read(fnStack, stackHandler, HEADER);
+        fileDatatype = this->datatype();
+
+        const FileName &ext = stackHandler->ext_name;
+        pad = 0;
+        fixedStride = stackHandler->fimg != NULL && this->transform == NoTransform &&
+                      fileDatatype != DT_UHalfByte && fileDatatype != DT_Unknown;
+        // Same format selection as ImageBase::_read
+        if (ext.contains("spi") || ext.contains("xmp") || ext.contains("stk") || ext.contains("vol"))
+            pad = (this->aDimFile.ndim > 1) ? this->offset / 2 : 0; // Each image has its own header
+        else if (ext.contains("mrcs") || ext.contains("st") || ext.contains("mrc") || ext.contains("map") ||
+                 ext.contains("img") || ext.contains("hed"))
+            pad = 0;
+        else if (!ext.contains("ser") && !ext.contains("dm3") && !ext.contains("dm4") && ext.contains("em"))
+            pad = 0;
+        else
+            fixedStride = false;
+    }
+
+    /** Close the stack */
+    ~StackReader()
+    {
+        this->closeFile(stackHandler);
+    }
+
+    /** Number of images in the stack */
+    size_t size() const
+    {
+        return this->aDimFile.ndim;
+    }
+
+    /** Dimensions of the images */
+    void getDimensions(size_t &Xdim, size_t &Ydim, size_t &Zdim, size_t &Ndim) const
+    {
+        Xdim = this->aDimFile.xdim;
+        Ydim = this->aDimFile.ydim;
+        Zdim = this->aDimFile.zdim;
+        Ndim = this->aDimFile.ndim;
+    }
+
+    /** Read the images with the given indices (starting at FIRST_IMAGE).
+     * out is resized to hold one image per index if it does not already have
+     * that size, the image of indices[k] is stored as the k-th image of out.
+     */
+    void read(const std::vector<size_t> &indices, MultidimArray<T> &out)
+    {
+        const ArrayDim &adim = this->aDimFile;
+        size_t n = indices.size();
+        if (NSIZE(out) != n || ZSIZE(out) != adim.zdim || YSIZE(out) != adim.ydim || XSIZE(out) != adim.xdim)
+            out.resizeNoCopy(n, adim.zdim, adim.ydim, adim.xdim);
+
+        for (size_t k = 0; k < n; ++k)
+            if (indices[k] < FIRST_IMAGE || indices[k] > adim.ndim)
+                REPORT_ERROR(ERR_INDEX_OUTOFBOUNDS, formatString("StackReader: %s Image number %lu exceeds stack size %lu",
+                             fnStack.c_str(), indices[k], adim.ndim));
+
+        size_t zyxdim = adim.zyxdim;
+        if (!fixedStride)
+        {
+            for (size_t k = 0; k < n; ++k)
+            {
+                this->_read(fnStack, stackHandler, DATA, indices[k]);
+                memcpy(MULTIDIM_ARRAY(out) + k * zyxdim, MULTIDIM_ARRAY(this->data), zyxdim * sizeof(T));
+            }
+            return;
+        }
+
+        size_t pagesize = zyxdim * gettypesize(fileDatatype);
+        size_t stride = pagesize + pad;
+        size_t maxRun = XMIPP_MAX(STACK_READ_BUFFER / stride, 1);
+        FILE * fimg = stackHandler->fimg;
+
+        for (size_t k = 0; k < n;)
+        {
+            // Consecutive images are read at once
+            size_t run = 1;
+            while (k + run < n && run < maxRun && indices[k + run] == indices[k + run - 1] + 1)
+                ++run;
+            size_t readsize = (run - 1) * stride + pagesize;
+            if (buffer.size() < readsize)
+                buffer.resize(readsize);
+
+            if (fseek(fimg, this->offset + IMG_INDEX(indices[k]) * stride, SEEK_SET) == -1)
+                REPORT_ERROR(ERR_IO_SIZE, "StackReader: can not seek the file pointer");
+            if (fread(&buffer[0], readsize, 1, fimg) != 1)
+                REPORT_ERROR(ERR_IO_NOREAD, "StackReader: cannot read the images from " + fnStack);
+
+            for (size_t i = 0; i < run; ++i)
+            {
+                char * page = &buffer[i * stride];
+                this->castSwapPage2T(page, MULTIDIM_ARRAY(out) + (k + i) * zyxdim, fileDatatype,
+                                     zyxdim, this->swap);
+            }
+            k += run;
+        }
+    }
+}
+;//end of class StackReader
+
+/** @} */
+
+#endif /* CORE_XMIPP_IMAGE_STACK_H_ */
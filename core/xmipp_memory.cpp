@@ -25,6 +25,9 @@
 
 #include "xmipp_memory.h"
 #include "xmipp_strings.h"
+#include <atomic>
+#include <map>
+#include <vector>
 
 char*  askMemory(size_t memsize)
 {
@@ -61,3 +64,122 @@ int  freeMemory(void* ptr, size_t memsize)
     ptr = NULL;
     return(0);
 }
+
+/* Buffers of askAlignedMemory kept for reuse, by size class */
+struct MemoryPool
+{
+    std::map<size_t, std::vector<void*> > buffers;
+    size_t cached;
+};
+
+/* Frees the pool when its thread finishes */
+struct MemoryPoolOwner
+{
+    ~MemoryPoolOwner();
+};
+
+/* Bytes kept in the pools of all the threads, and their limit */
+static std::atomic<size_t> memoryPoolLimit(64 * 1024 * 1024);
+static std::atomic<size_t> memoryPoolCached(0);
+static thread_local MemoryPool * threadPool = NULL;
+static thread_local bool threadPoolClosed = false;
+static thread_local MemoryPoolOwner threadPoolOwner;
+
+MemoryPoolOwner::~MemoryPoolOwner()
+{
+    releaseMemoryPool();
+    delete threadPool;
+    threadPool = NULL;
+    threadPoolClosed = true;
+}
+
+/* Pool of the calling thread, NULL if the thread is finishing */
+static MemoryPool * getMemoryPool()
+{
+    if (threadPoolClosed)
+        return NULL;
+    if (threadPool == NULL)
+    {
+        (void) &threadPoolOwner; // Registers the release at thread exit
+        threadPool = new MemoryPool;
+        threadPool->cached = 0;
+    }
+    return threadPool;
+}
+
+/* Size class of an allocation.
+ * Sizes are rounded up to a multiple of 1/8 to 1/16 of their magnitude,
+ * so reused buffers waste at most 12.5% of their size.
+ */
+static size_t alignedSizeClass(size_t size)
+{
+    size_t step = XMIPP_MEMORY_ALIGNMENT;
+    while (step * 16 <= size)
+        step *= 2;
+    return (size + step - 1) & ~(step - 1);
+}
+
+void* askAlignedMemory(size_t size)
+{
+    if (size == 0)
+        return NULL;
+
+    size_t sizeClass = alignedSizeClass(size);
+    MemoryPool * pool;
+    if (memoryPoolLimit > 0 && sizeClass >= XMIPP_MEMORY_POOL_MIN_SIZE && (pool = getMemoryPool()) != NULL)
+    {
+        std::map<size_t, std::vector<void*> >::iterator it = pool->buffers.find(sizeClass);
+        if (it != pool->buffers.end() && !it->second.empty())
+        {
+            void * ptr = it->second.back();
+            it->second.pop_back();
+            pool->cached -= sizeClass;
+            memoryPoolCached -= sizeClass;
+            return ptr;
+        }
+    }
+
+    void * ptr = NULL;
+    if (posix_memalign(&ptr, XMIPP_MEMORY_ALIGNMENT, sizeClass) != 0)
+        return NULL;
+    return ptr;
+}
+
+void freeAlignedMemory(void* ptr, size_t size)
+{
+    if (ptr == NULL)
+        return;
+
+    size_t sizeClass = alignedSizeClass(size);
+    MemoryPool * pool;
+    if (memoryPoolLimit > 0 && sizeClass >= XMIPP_MEMORY_POOL_MIN_SIZE && (pool = getMemoryPool()) != NULL)
+    {
+        // Reserve room in the budget shared by all the threads
+        if (memoryPoolCached.fetch_add(sizeClass) + sizeClass <= memoryPoolLimit)
+        {
+            pool->buffers[sizeClass].push_back(ptr);
+            pool->cached += sizeClass;
+            return;
+        }
+        memoryPoolCached -= sizeClass;
+    }
+    free(ptr);
+}
+
+void setMemoryPoolLimit(size_t bytes)
+{
+    memoryPoolLimit = bytes;
+}
+
+void releaseMemoryPool()
+{
+    if (threadPool == NULL)
+        return;
+    for (std::map<size_t, std::vector<void*> >::iterator it = threadPool->buffers.begin();
+         it != threadPool->buffers.end(); ++it)
+        for (size_t i = 0; i < it->second.size(); ++i)
+            free(it->second[i]);
+    threadPool->buffers.clear();
+    memoryPoolCached -= threadPool->cached;
+    threadPool->cached = 0;
+}
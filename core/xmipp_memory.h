@@ -168,6 +168,42 @@ char* askMemory(size_t size);
 */
 int freeMemory(void* ptr, size_t memsize);
 
+/** Alignment in bytes of the memory given by askAlignedMemory */
+#define XMIPP_MEMORY_ALIGNMENT 64
+
+/** Allocations smaller than this are never kept in the memory pool */
+#define XMIPP_MEMORY_POOL_MIN_SIZE 4096
+
+/** Allocates aligned memory.
+ *
+ * The memory is aligned to XMIPP_MEMORY_ALIGNMENT bytes and it is not
+ * initialized. Buffers freed with freeAlignedMemory are kept in a pool of
+ * the calling thread, by size class, and handed out again to requests of
+ * the same class, so repeated temporaries of the same size do not go
+ * through the system allocator nor page fault again.
+ *
+ * returns void* : a pointer to the memory (NULL on failure or if size is 0)
+ */
+void* askAlignedMemory(size_t size);
+
+/** Frees memory given by askAlignedMemory.
+ *
+ * size must be the size that was requested. The buffer is kept in the pool
+ * of the calling thread unless the pools of all the threads would exceed
+ * the pool limit.
+ */
+void freeAlignedMemory(void* ptr, size_t size);
+
+/** Set the maximum number of bytes kept in the memory pools.
+ * The limit is shared by the pools of all the threads. A limit of 0
+ * disables the pools. The default is 64Mb.
+ */
+void setMemoryPoolLimit(size_t bytes);
+
+/** Free the buffers kept in the memory pool of the calling thread.
+ */
+void releaseMemoryPool();
+
 //@}
 #endif
 
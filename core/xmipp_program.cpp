@@ -27,6 +27,7 @@
 #include "xmipp_program.h"
 #include "metadata_extension.h"
 #include "args.h"
+#include "xmipp_threads.h"
 void XmippProgram::initComments()
 {
     CommentList comments;
@@ -505,6 +506,8 @@ XmippMetadataProgram::XmippMetadataProgram()
     save_metadata_stack = false;
     keep_input_columns = false;
     track_origin = false;
+    allow_threads = false;
+    nThreads = 1;
 }
 
 void XmippMetadataProgram::init()
@@ -566,6 +569,9 @@ void XmippMetadataProgram::defineParams()
     {
         addParamsLine("  [--dont_apply_geo]   : for 2D-images: do not apply transformation stored in metadata");
     }
+
+    if (allow_threads)
+        addParamsLine("  [--thr <N=1>]   : Number of threads used to process the images");
 }//function defineParams
 
 void XmippMetadataProgram::defineLabelParam()
@@ -590,6 +596,9 @@ void XmippMetadataProgram::readParams()
     if (allow_apply_geo)
         apply_geo = !checkParam("--dont_apply_geo");
 
+    if (allow_threads)
+        nThreads = XMIPP_MAX(1, getIntParam("--thr"));
+
     // The following flags are an "advanced" options to allow save metadata
     // when the -o is an stack, each program can define its default value
     // that's why the || construct before checkParam call
@@ -766,11 +775,267 @@ void XmippMetadataProgram::checkPoint()
 {
 }
 
+bool XmippMetadataProgram::setupImage(const MDRow &rowIn, size_t objIndex, FileName &fnImg, FileName &fnImgOut, MDRow &rowOut)
+{
+    rowIn.getValue(image_label, fnImg);
+
+    if (fnImg.empty())
+        return false;
+
+    fnImgOut = fnImg;
+
+    if (each_image_produces_an_output)
+    {
+        if (!oroot.empty()) // Compose out name to save as independent images
+        {
+            if (oext.empty()) // If oext is still empty, then use ext of indep input images
+            {
+                if (input_is_stack)
+                    oextBaseName = "spi";
+                else
+                    oextBaseName = fnImg.getFileFormat();
+            }
+
+            FileName fullBaseName = oroot.removeFileFormat();
+            if (!baseName.empty() )
+                fnImgOut.compose(fullBaseName, objIndex, oextBaseName);
+            else if (fnImg.isInStack())
+                fnImgOut.compose(pathBaseName + (fnImg.withoutExtension()).getDecomposedFileName(), objIndex, oextBaseName);
+            else
+                fnImgOut = pathBaseName + fnImg.withoutExtension()+ "." + oextBaseName;
+        }
+        else if (!fn_out.empty() )
+        {
+            if (single_image)
+                fnImgOut = fn_out;
+            else
+                fnImgOut.compose(objIndex, fn_out); // Compose out name to save as stacks
+        }
+        else
+            fnImgOut = fnImg;
+        setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
+    }
+    else if (produces_a_metadata)
+        setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
+
+    return true;
+}
+
+/** Window of images being processed by the threads.
+ * The main thread reads the rows in order into the slots, the threads
+ * process them in the same order and the main thread adds the output
+ * rows to the metadata once all the previous ones have been added.
+ */
+class ImageTaskWindow
+{
+public:
+    enum TaskState { TASK_FREE, TASK_READY, TASK_DONE };
+
+    struct ImageTask
+    {
+        FileName fnImg, fnImgOut;
+        MDRow rowIn, rowOut;
+        TaskState state;
+    };
+
+    std::vector<ImageTask> tasks;
+    Condition condition;
+    size_t produced; // Tasks filled by the main thread
+    size_t taken; // Tasks taken by the threads
+    bool finished; // No more tasks will be produced
+    XmippError * error; // First error raised in a thread
+
+    ImageTaskWindow(size_t size): tasks(size)
+    {
+        for (size_t i = 0; i < size; ++i)
+            tasks[i].state = TASK_FREE;
+        produced = taken = 0;
+        finished = false;
+        error = NULL;
+    }
+
+    ~ImageTaskWindow()
+    {
+        delete error;
+    }
+
+    ImageTask &task(size_t n)
+    {
+        return tasks[n % tasks.size()];
+    }
+
+    /** Keep the first error and wake up everybody */
+    void setError(const XmippError &xe)
+    {
+        condition.lock();
+        if (error == NULL)
+            error = new XmippError(xe);
+        condition.broadcast();
+        condition.unlock();
+    }
+
+    /** Keep the first error of an exception being handled and wake up everybody.
+     * Must be called from a catch block.
+     */
+    void setCurrentError()
+    {
+        try
+        {
+            throw;
+        }
+        catch (XmippError &xe)
+        {
+            setError(xe);
+        }
+        catch (std::exception &e)
+        {
+            setError(XmippError(ERR_UNCLASSIFIED, e.what(), __FILE__, __LINE__));
+        }
+        catch (...)
+        {
+            setError(XmippError(ERR_UNCLASSIFIED, "Unknown exception", __FILE__, __LINE__));
+        }
+    }
+};
+
+void XmippMetadataProgram::processImagesThread(ThreadArgument &arg)
+{
+    XmippMetadataProgram * program = (XmippMetadataProgram *) arg.workClass;
+    ImageTaskWindow * window = (ImageTaskWindow *) arg.data;
+    Condition &condition = window->condition;
+
+    try
+    {
+        program->preProcessThread(arg.thread_id);
+    }
+    catch (...)
+    {
+        window->setCurrentError();
+    }
+
+    condition.lock();
+    while (true)
+    {
+        while (window->error == NULL && window->taken == window->produced && !window->finished)
+            condition.wait();
+        if (window->error != NULL || window->taken == window->produced)
+            break;
+        ImageTaskWindow::ImageTask &task = window->task(window->taken++);
+        condition.unlock();
+
+        bool failed = false;
+        try
+        {
+            program->processImageThread(arg.thread_id, task.fnImg, task.fnImgOut, task.rowIn, task.rowOut);
+        }
+        catch (...)
+        {
+            window->setCurrentError();
+            failed = true;
+        }
+
+        condition.lock();
+        if (failed)
+            break;
+        task.state = ImageTaskWindow::TASK_DONE;
+        condition.broadcast();
+    }
+    condition.unlock();
+
+    program->postProcessThread(arg.thread_id);
+}
+
+void XmippMetadataProgram::runThreads()
+{
+    size_t objId, objIndex = 0;
+    MDRowCursor cursor(*mdIn);
+    ImageTaskWindow window(4 * nThreads);
+    Condition &condition = window.condition;
+    ThreadManager threads(nThreads, this);
+    size_t committed = 0;
+
+    // Add to mdOut the output rows of the images processed, in order
+    // until count images have been added
+#define COMMIT_IMAGES(count) \
+    while (committed < (count)) \
+    { \
+        condition.lock(); \
+        while (window.error == NULL && window.task(committed).state != ImageTaskWindow::TASK_DONE) \
+            condition.wait(); \
+        condition.unlock(); \
+        if (window.error != NULL) \
+            break; \
+        ImageTaskWindow::ImageTask &task = window.task(committed); \
+        if (each_image_produces_an_output || produces_a_metadata) \
+            mdOut.addRow(task.rowOut); \
+        condition.lock(); \
+        task.state = ImageTaskWindow::TASK_FREE; \
+        condition.unlock(); \
+        ++committed; \
+        checkPoint(); \
+        showProgress(); \
+    }
+
+    threads.runAsync(processImagesThread, &window);
+
+    try
+    {
+        while (window.error == NULL && getImageToProcess(objId, objIndex))
+        {
+            ++objIndex; //increment for composing starting at 1
+
+            // Wait until the slot of the image is free
+            if (window.produced >= window.tasks.size())
+                COMMIT_IMAGES(window.produced - window.tasks.size() + 1);
+            if (window.error != NULL)
+                break;
+
+            // Slots not in the threads range can be filled without locking
+            ImageTaskWindow::ImageTask &task = window.task(window.produced);
+            cursor.read(objId);
+            task.rowIn = cursor.row();
+            if (!setupImage(task.rowIn, objIndex, task.fnImg, task.fnImgOut, task.rowOut))
+                break;
+
+            condition.lock();
+            task.state = ImageTaskWindow::TASK_READY;
+            ++window.produced;
+            condition.broadcast();
+            condition.unlock();
+        }
+
+        condition.lock();
+        window.finished = true;
+        condition.broadcast();
+        condition.unlock();
+
+        COMMIT_IMAGES(window.produced);
+    }
+    catch (...)
+    {
+        // Stop the threads before the ThreadManager is destroyed, otherwise
+        // it would wait forever for threads waiting for tasks
+        window.setCurrentError();
+        condition.lock();
+        window.finished = true;
+        condition.broadcast();
+        condition.unlock();
+        threads.wait();
+        throw;
+    }
+#undef COMMIT_IMAGES
+
+    threads.wait();
+
+    if (window.error != NULL)
+        throw *window.error;
+}
+
 void XmippMetadataProgram::run()
 {
     FileName fnImg, fnImgOut, fullBaseName;
     size_t objId;
-    MDRow rowIn, rowOut;
+    MDRow rowOut;
     mdOut.clear(); //this allows multiple runs of the same Program object
 
     //Perform particular preprocessing
@@ -790,59 +1055,31 @@ void XmippMetadataProgram::run()
         pathBaseName   = fullBaseName.getDir();
     }
 
-    //FOR_ALL_OBJECTS_IN_METADATA(mdIn)
-    while (getImageToProcess(objId, objIndex))
+    if (nThreads > 1)
+        runThreads();
+    else
     {
-        ++objIndex; //increment for composing starting at 1
-
-        mdIn->getRow(rowIn, objId);
-        rowIn.getValue(image_label, fnImg);
-
-        if (fnImg.empty())
-            break;
-
-        fnImgOut = fnImg;
+        //Input rows are read into the same row object
+        MDRowCursor cursor(*mdIn);
+        const MDRow &rowIn = cursor.row();
 
-        if (each_image_produces_an_output)
+        //FOR_ALL_OBJECTS_IN_METADATA(mdIn)
+        while (getImageToProcess(objId, objIndex))
         {
-            if (!oroot.empty()) // Compose out name to save as independent images
-            {
-                if (oext.empty()) // If oext is still empty, then use ext of indep input images
-                {
-                    if (input_is_stack)
-                        oextBaseName = "spi";
-                    else
-                        oextBaseName = fnImg.getFileFormat();
-                }
+            ++objIndex; //increment for composing starting at 1
 
-                if (!baseName.empty() )
-                    fnImgOut.compose(fullBaseName, objIndex, oextBaseName);
-                else if (fnImg.isInStack())
-                    fnImgOut.compose(pathBaseName + (fnImg.withoutExtension()).getDecomposedFileName(), objIndex, oextBaseName);
-                else
-                    fnImgOut = pathBaseName + fnImg.withoutExtension()+ "." + oextBaseName;
-            }
-            else if (!fn_out.empty() )
-            {
-                if (single_image)
-                    fnImgOut = fn_out;
-                else
-                    fnImgOut.compose(objIndex, fn_out); // Compose out name to save as stacks
-            }
-            else
-                fnImgOut = fnImg;
-            setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
-        }
-        else if (produces_a_metadata)
-            setupRowOut(fnImg, rowIn, fnImgOut, rowOut);
+            cursor.read(objId);
+            if (!setupImage(rowIn, objIndex, fnImg, fnImgOut, rowOut))
+                break;
 
-        processImage(fnImg, fnImgOut, rowIn, rowOut);
+            processImage(fnImg, fnImgOut, rowIn, rowOut);
 
-        if (each_image_produces_an_output || produces_a_metadata)
-            mdOut.addRow(rowOut);
+            if (each_image_produces_an_output || produces_a_metadata)
+                mdOut.addRow(rowOut);
 
-        checkPoint();
-        showProgress();
+            checkPoint();
+            showProgress();
+        }
     }
     wait();
 
@@ -258,6 +258,9 @@ public:
 }
 ;//end of class XmippProgram
 
+class ThreadArgument;
+class ImageTaskWindow;
+
 /** Special class of XmippProgram that performs some operation related with processing images.
  * It can receive a file with images(MetaData) or a single image.
  * The function processImage is virtual here and needs to be implemented by derived classes.
@@ -336,6 +339,9 @@ protected:
     bool remove_disabled; // Default true
     /// Show process time bar
     bool allow_time_bar; // Default true
+    /// Provide the program with the param --thr to process images in parallel.
+    /// Only for programs whose processImage can run concurrently
+    bool allow_threads; // Default false
 
     // DEDUCED FLAGS
     /// Input is a metadata
@@ -354,12 +360,38 @@ protected:
     /// Some time bar related counters
     size_t time_bar_step, time_bar_size, time_bar_done;
 
+    /// Number of threads processing images (--thr)
+    int nThreads;
+
     virtual void initComments();
     virtual void defineParams();
     virtual void readParams();
     virtual void preProcess();
     virtual void postProcess();
     virtual void processImage(const FileName &fnImg, const FileName &fnImgOut, const MDRow &rowIn, MDRow &rowOut) = 0;
+    /** @name Threaded processing
+     * With --thr N the input rows are read ahead by the main thread,
+     * processImageThread is called from N threads and the output rows are
+     * added to the output metadata in input order.
+     * @{
+     */
+    /** Called by each thread before processing images,
+     * to create the per-thread state.
+     */
+    virtual void preProcessThread(int /*thread_id*/)
+    {}
+    /** Called by each thread when there are no more images */
+    virtual void postProcessThread(int /*thread_id*/)
+    {}
+    /** Process an image from a thread. By default calls processImage,
+     * programs with per-thread state should reimplement this one.
+     */
+    virtual void processImageThread(int /*thread_id*/, const FileName &fnImg, const FileName &fnImgOut,
+                                    const MDRow &rowIn, MDRow &rowOut)
+    {
+        processImage(fnImg, fnImgOut, rowIn, rowOut);
+    }
+    /** @} */
     virtual void show();
     /** Do some stuff before starting processing
      * in a parallel environment usually this only be executed
@@ -379,6 +411,16 @@ protected:
     /** Define the label param */
     virtual void defineLabelParam();
 
+private:
+    /** Compose the output name and row of an input image.
+     * Return false if the row has no image.
+     */
+    bool setupImage(const MDRow &rowIn, size_t objIndex, FileName &fnImg, FileName &fnImgOut, MDRow &rowOut);
+    /** Process all images with nThreads threads */
+    void runThreads();
+    /** Work function of the processing threads */
+    static void processImagesThread(ThreadArgument &arg);
+
 public:
     XmippMetadataProgram();
 
@@ -125,11 +125,14 @@ void Barrier::wait()
 
 Thread::Thread()
 {
+    started = false;
 }
 
 Thread::~Thread()
 {
-    pthread_join(thId, NULL);
+    // Subclasses may throw in their constructors before calling start()
+    if (started)
+        pthread_join(thId, NULL);
 }
 
 void Thread::start()
@@ -141,6 +144,7 @@ void Thread::start()
         std::cerr << "Thread: can't start thread." << std::endl;
         exit(1);
     }
+    started = true;
 }
 
 void * _singleThreadMain(void * data){
@@ -193,6 +193,7 @@ class Thread
 {
 private:
     pthread_t thId; ///< pthreads id
+    bool started; ///< whether start() created the thread
 
 public:
     /** Default constructor.